@@ -0,0 +1,236 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+
+#include "BrickGrid.h"
+#include "FieldSet.h"
+
+// Expressions over solver channels and field rows, composed at compile time. `p = r + beta * p` computes nothing:
+// it builds a statement whose type spells out the arithmetic and which holds the channels and scalars it reads.
+// evaluate runs a list of statements over the cells in one loop, so updates, and sums over what they wrote, share
+// one pass over memory however they are written.
+//
+// Leaves are solver channels, bound to one brick at a time, or rows of values bound when they are made.
+
+// Base of every expression node, so the operators below apply to expressions only
+struct Expression
+{
+};
+
+template <typename T>
+constexpr bool isExpression = std::is_base_of_v<Expression, T>;
+
+struct Scalar : Expression
+{
+    float value;
+
+    explicit Scalar(float v) : value(v) {}
+    void bind(BrickGrid &, uint32_t) {}
+    float operator[](uint32_t) const { return value; }
+};
+
+// A row of floats read from cell 0 on, such as one row of a haloed tile
+struct Values : Expression
+{
+    const float *values;
+
+    explicit Values(const float *v) : values(v) {}
+    void bind(BrickGrid &, uint32_t) {}
+    float operator[](uint32_t cell) const { return values[cell]; }
+};
+
+// A row of a field from one index on, converted to and from the field's storage
+struct FieldRow : Expression
+{
+    FieldSpan span;
+    size_t first;
+
+    FieldRow(const FieldSpan &field, size_t index) : span(field), first(index) {}
+    void bind(BrickGrid &, uint32_t) {}
+    float operator[](uint32_t cell) const { return span[first + cell]; }
+    void store(uint32_t cell, float value) const { span[first + cell] = value; }
+};
+
+struct SetOp
+{
+    static float apply(float, float value) { return value; }
+};
+struct AddOp
+{
+    static float apply(float a, float b) { return a + b; }
+};
+struct SubtractOp
+{
+    static float apply(float a, float b) { return a - b; }
+};
+struct MultiplyOp
+{
+    static float apply(float a, float b) { return a * b; }
+};
+
+template <typename A, typename B, typename Op>
+struct [[nodiscard]] Binary : Expression
+{
+    A a;
+    B b;
+
+    Binary(const A &left, const B &right) : a(left), b(right) {}
+    void bind(BrickGrid &solver, uint32_t brick)
+    {
+        a.bind(solver, brick);
+        b.bind(solver, brick);
+    }
+    float operator[](uint32_t cell) const { return Op::apply(a[cell], b[cell]); }
+};
+
+// Statements. begin readies one for a brick, run does its work on one cell and runFour on four from cell n, with
+// the four cells' running totals for Sum statements. runFour reads before it writes, so the four cells can share
+// vector registers without the compiler having to prove the channels do not overlap. A statement does nothing
+// until it is passed to evaluate or a solver pass, so dropping one is a warning.
+
+// target = value, target += value or target -= value
+template <typename Target, typename E, typename Op>
+struct [[nodiscard]] Store
+{
+    static constexpr uint32_t GRAIN = 4; // bricks per chunk of a solver pass
+    Target target;
+    E value;
+
+    void begin(BrickGrid &solver, uint32_t brick)
+    {
+        target.bind(solver, brick);
+        value.bind(solver, brick);
+    }
+    void run(uint32_t cell, float &) const { target.store(cell, Op::apply(target[cell], value[cell])); }
+    void runFour(uint32_t n, float &, float &, float &, float &) const
+    {
+        float a = Op::apply(target[n], value[n]);
+        float b = Op::apply(target[n + 1], value[n + 1]);
+        float c = Op::apply(target[n + 2], value[n + 2]);
+        float d = Op::apply(target[n + 3], value[n + 3]);
+        target.store(n, a);
+        target.store(n + 1, b);
+        target.store(n + 2, c);
+        target.store(n + 3, d);
+    }
+};
+
+// Adds value over the cells, after the statements before it have updated each cell
+template <typename E>
+struct [[nodiscard]] Sum
+{
+    static constexpr uint32_t GRAIN = 4;
+    E value;
+
+    void begin(BrickGrid &solver, uint32_t brick) { value.bind(solver, brick); }
+    void run(uint32_t cell, float &sum) const { sum += value[cell]; }
+    void runFour(uint32_t n, float &s0, float &s1, float &s2, float &s3) const
+    {
+        s0 += value[n];
+        s1 += value[n + 1];
+        s2 += value[n + 2];
+        s3 += value[n + 3];
+    }
+};
+
+// Work on a whole brick ahead of the per-cell statements, such as a stencil product they then read in cache
+template <typename F>
+struct [[nodiscard]] EachBrick
+{
+    static constexpr uint32_t GRAIN = 1;
+    F body;
+
+    void begin(BrickGrid &, uint32_t brick) { body(brick); }
+    void run(uint32_t, float &) const {}
+    void runFour(uint32_t, float &, float &, float &, float &) const {}
+};
+
+// A solver channel: reads and writes one brick's values once bound to it
+struct Channel : Expression
+{
+    uint32_t id;
+    float *values = nullptr;
+
+    explicit Channel(uint32_t channel) : id(channel) {}
+    Channel(const Channel &) = default;
+    void bind(BrickGrid &solver, uint32_t brick) { values = solver.data(id, brick); }
+    float operator[](uint32_t cell) const { return values[cell]; }
+    void store(uint32_t cell, float value) const { values[cell] = value; }
+
+    // Assigning makes a statement and never rebinds this channel. Between two channels only const ones do, so
+    // that `a = b;` on channels held by value does not compile as a copy that is thrown away.
+    template <typename E, typename = std::enable_if_t<isExpression<E>>>
+    Store<Channel, E, SetOp> operator=(const E &value) const { return {*this, value}; }
+    Store<Channel, Channel, SetOp> operator=(const Channel &value) const { return {*this, value}; }
+    Channel &operator=(const Channel &) = delete;
+};
+
+template <typename A, typename B, typename = std::enable_if_t<isExpression<A> && isExpression<B>>>
+Binary<A, B, AddOp> operator+(const A &a, const B &b)
+{
+    return {a, b};
+}
+
+template <typename A, typename B, typename = std::enable_if_t<isExpression<A> && isExpression<B>>>
+Binary<A, B, SubtractOp> operator-(const A &a, const B &b)
+{
+    return {a, b};
+}
+
+template <typename A, typename B, typename = std::enable_if_t<isExpression<A> && isExpression<B>>>
+Binary<A, B, MultiplyOp> operator*(const A &a, const B &b)
+{
+    return {a, b};
+}
+
+template <typename B, typename = std::enable_if_t<isExpression<B>>>
+Binary<Scalar, B, MultiplyOp> operator*(float a, const B &b)
+{
+    return {Scalar(a), b};
+}
+
+template <typename Target, typename E, typename = std::enable_if_t<isExpression<Target> && isExpression<E>>>
+Store<Target, E, AddOp> operator+=(const Target &target, const E &value)
+{
+    return {target, value};
+}
+
+template <typename Target, typename E, typename = std::enable_if_t<isExpression<Target> && isExpression<E>>>
+Store<Target, E, SubtractOp> operator-=(const Target &target, const E &value)
+{
+    return {target, value};
+}
+
+template <typename E>
+Sum<E> sum(const E &value)
+{
+    return {value};
+}
+
+template <typename F>
+EachBrick<F> eachBrick(const F &body)
+{
+    return {body};
+}
+
+// Runs the statements in order on each of count cells and returns the total of their sums. Each statement runs on
+// four cells before the next one, which sees them updated. Consecutive cells add to four partial sums that are
+// combined in a fixed order, so the adds do not wait on each other and the result does not depend on how the
+// cells were split.
+template <typename... Statements>
+float evaluate(uint32_t count, const Statements &...statements)
+{
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    uint32_t n = 0;
+    for (; n + 4 <= count; n += 4)
+    {
+        (statements.runFour(n, s0, s1, s2, s3), ...);
+    }
+    for (; n < count; n++)
+    {
+        (statements.run(n, s0), ...);
+    }
+    return (s0 + s1) + (s2 + s3);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <vector>
+
+constexpr uint32_t BRICK_LOG2 = 3;
+constexpr uint32_t BRICK_SIZE = 1u << BRICK_LOG2; // cells along each brick edge
+constexpr uint32_t BRICK_CELLS = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+constexpr uint32_t BRICK_TILE_SIZE = BRICK_SIZE + 2; // brick plus a one-cell halo on every side
+constexpr uint32_t BRICK_TILE_CELLS = BRICK_TILE_SIZE * BRICK_TILE_SIZE * BRICK_TILE_SIZE;
+constexpr uint32_t INVALID_BRICK = UINT32_MAX;
+
+enum BrickFace : uint32_t
+{
+    BRICK_MINUS_I = 0,
+    BRICK_PLUS_I,
+    BRICK_MINUS_J,
+    BRICK_PLUS_J,
+    BRICK_MINUS_K,
+    BRICK_PLUS_K,
+    BRICK_FACE_COUNT
+};
+
+// Cells inside a brick and inside a tile are laid out i-major like the dense grid
+inline uint32_t brickCell(uint32_t li, uint32_t lj, uint32_t lk) { return (li * BRICK_SIZE + lj) * BRICK_SIZE + lk; }
+inline uint32_t tileCell(uint32_t ti, uint32_t tj, uint32_t tk) { return (ti * BRICK_TILE_SIZE + tj) * BRICK_TILE_SIZE + tk; }
+
+struct BrickInfo
+{
+    uint32_t bi, bj, bk;                             // brick coordinates, the first cell is (bi, bj, bk) * BRICK_SIZE
+    std::array<uint32_t, BRICK_FACE_COUNT> neighbors; // face neighbours, INVALID_BRICK where not allocated
+};
+
+// Two-level sparse grid: a dense root table over brick coordinates points into a pool of 8^3 leaf bricks.
+// Every brick holds all channels (structure of arrays), so one allocation covers every solver field.
+// Cells in bricks that are not allocated read as zero.
+class BrickGrid
+{
+public:
+    BrickGrid(uint32_t nx, uint32_t ny, uint32_t nz, uint32_t channelCount);
+
+    uint32_t bricksX() const { return brickDims[0]; }
+    uint32_t bricksY() const { return brickDims[1]; }
+    uint32_t bricksZ() const { return brickDims[2]; }
+
+    uint32_t find(uint32_t bi, uint32_t bj, uint32_t bk) const { return root[rootIndex(bi, bj, bk)]; }
+    // Returns the brick with every channel zeroed, or the existing one
+    uint32_t allocate(uint32_t bi, uint32_t bj, uint32_t bk);
+    void release(uint32_t brick);
+
+    const std::vector<uint32_t> &activeBricks() const { return active; }
+    uint32_t capacity() const { return (uint32_t)infos.size(); } // every brick id is below this
+    const BrickInfo &info(uint32_t brick) const { return infos[brick]; }
+
+    float *data(uint32_t channel, uint32_t brick) { return &pools[channel][(size_t)brick * BRICK_CELLS]; }
+    const float *data(uint32_t channel, uint32_t brick) const { return &pools[channel][(size_t)brick * BRICK_CELLS]; }
+
+    // Copies a brick and the face layers of its six neighbours into a 10^3 tile, so 7-point stencils over the
+    // brick need no bounds checks. Halo cells of missing neighbours (and the tile's edges/corners) are zero.
+    void loadTile(uint32_t channel, uint32_t brick, float *tile) const;
+
+    // Conversion to and from a dense nx*ny*nz array, for checkpoints
+    void gather(uint32_t channel, float *dense) const;
+    void scatter(uint32_t channel, const float *dense);
+
+    size_t memoryBytes() const;
+
+private:
+    uint32_t rootIndex(uint32_t bi, uint32_t bj, uint32_t bk) const { return (bi * brickDims[1] + bj) * brickDims[2] + bk; }
+    void link(uint32_t brick, BrickFace face, uint32_t neighbor);
+
+    std::array<uint32_t, 3> dims;
+    std::array<uint32_t, 3> brickDims;
+    std::vector<uint32_t> root;
+    std::vector<std::vector<float>> pools; // one per channel, BRICK_CELLS floats per brick
+    std::vector<BrickInfo> infos;
+    std::vector<uint32_t> freeBricks;
+    std::vector<uint32_t> active;
+    std::vector<uint32_t> activeSlot; // position of each brick in active, for O(1) release
+};
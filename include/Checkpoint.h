@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+constexpr char CHECKPOINT_MAGIC[8] = {'V', 'F', 'L', 'U', 'I', 'D', 'C', 'K'};
+constexpr uint32_t CHECKPOINT_VERSION = 2; // version 1 lacks windowOrigin, which reads as zero from its header padding
+constexpr uint32_t CHECKPOINT_ENDIAN_TAG = 0x01020304;
+constexpr uint64_t CHECKPOINT_ALIGNMENT = 4096; // every field block starts on a page boundary so it can be used straight from the mapping
+
+enum CheckpointField : uint32_t
+{
+    CHECKPOINT_PHI = 0,
+    CHECKPOINT_U_MINUS,
+    CHECKPOINT_V_MINUS,
+    CHECKPOINT_W_MINUS,
+    CHECKPOINT_PRESSURE,
+    CHECKPOINT_FIELD_COUNT
+};
+
+struct CheckpointFieldEntry
+{
+    uint64_t offset; // bytes from start of file
+    uint64_t count;  // number of floats
+};
+
+struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t endianTag;
+    uint32_t nx;
+    uint32_t ny;
+    uint32_t nz;
+    uint32_t fieldCount;
+    double simTime;
+    uint64_t frame;
+    CheckpointFieldEntry fields[CHECKPOINT_FIELD_COUNT];
+    int32_t windowOrigin[3]; // world cell of grid cell (0, 0, 0)
+};
+
+// Header plus page-aligned field blocks in one contiguous buffer, so the whole file goes out in a single write.
+class CheckpointImage
+{
+public:
+    void reset(uint32_t nx, uint32_t ny, uint32_t nz, double simTime, uint64_t frame, const std::array<int32_t, 3> &windowOrigin,
+               const std::array<uint64_t, CHECKPOINT_FIELD_COUNT> &counts);
+    float *field(CheckpointField field);
+    std::vector<char> bytes;
+};
+
+// Read-only mapping of a checkpoint file. Field pointers point directly into the mapped pages.
+class MappedCheckpoint
+{
+public:
+    explicit MappedCheckpoint(const std::string &path);
+    ~MappedCheckpoint();
+    MappedCheckpoint(const MappedCheckpoint &) = delete;
+    MappedCheckpoint &operator=(const MappedCheckpoint &) = delete;
+
+    const CheckpointHeader &header() const { return *reinterpret_cast<const CheckpointHeader *>(data); }
+    const float *field(CheckpointField field, uint64_t expectedCount) const;
+
+private:
+    void *data = nullptr;
+    size_t size = 0;
+};
+
+// Writes checkpoint images on a background thread so saving never blocks the frame loop.
+class CheckpointWriter
+{
+public:
+    CheckpointWriter();
+    ~CheckpointWriter();
+
+    bool busy();
+    // Takes ownership of image's contents by swapping with the previously written image, so buffers are reused.
+    // Returns false (and leaves image untouched) if the previous checkpoint is still being written.
+    bool submit(const std::string &path, CheckpointImage &image);
+
+private:
+    void run();
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool pending = false;
+    bool stopping = false;
+    std::string pendingPath;
+    CheckpointImage pendingImage;
+    std::thread worker; // declared last so it starts after the members it uses
+};
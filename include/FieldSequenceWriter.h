@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <deque>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+constexpr char FIELD_SEQUENCE_MAGIC[8] = {'V', 'F', 'L', 'U', 'I', 'D', 'S', 'Q'};
+constexpr uint32_t FIELD_SEQUENCE_VERSION = 2;
+constexpr uint32_t FIELD_SEQUENCE_CHUNK_TAG = 0x4D415246; // "FRAM"
+constexpr uint32_t FIELD_SEQUENCE_FIELD_COUNT = 4;        // phi, u_minus, v_minus, w_minus
+
+struct FieldSequenceHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t nx;
+    uint32_t ny;
+    uint32_t nz;
+    uint32_t fieldCount;
+    float cellWidth;
+};
+
+// Precedes every frame's payload: run list, then one compressed stream per field
+struct FieldChunkHeader
+{
+    uint32_t tag;
+    uint32_t payloadBytes;
+    uint64_t frame;
+    double simTime;
+    float bandWidth;
+    uint32_t activeCells;
+    uint32_t runBytes;
+    uint32_t fieldBytes[FIELD_SEQUENCE_FIELD_COUNT];
+    int32_t windowOrigin[3]; // world cell of grid cell (0, 0, 0)
+};
+
+// Narrow-band slice of the simulation fields for one frame, filled by Grid::captureFields
+struct FieldFrame
+{
+    uint64_t frame = 0;
+    double simTime = 0.0;
+    float bandWidth = 0.0f;
+    std::array<int32_t, 3> windowOrigin = {0, 0, 0};
+    std::vector<uint32_t> runs;                                          // alternating (gap, length) over the linear cell index
+    std::array<std::vector<float>, FIELD_SEQUENCE_FIELD_COUNT> values; // band cells only, in cell order
+};
+
+// Lossless float codec: each value's bit pattern is stored as the zigzagged residual of a linear prediction from
+// the previous two, without its leading zero bytes.
+// A 4-bit byte count per value is packed two to a control byte ahead of the data bytes.
+void encodeFloats(const float *values, size_t count, std::vector<uint8_t> &out);
+size_t decodeFloats(const uint8_t *data, size_t size, float *values, size_t count);
+void encodeRuns(const std::vector<uint32_t> &runs, std::vector<uint8_t> &out);
+size_t decodeRuns(const uint8_t *data, size_t size, std::vector<uint32_t> &runs);
+
+// Appends compressed frames to a chunked container from a background I/O thread.
+// Memory is bounded by a fixed pool of frame buffers; when all are queued, acquire() waits for the writer.
+class FieldSequenceWriter
+{
+public:
+    FieldSequenceWriter(const std::string &path, uint32_t maxQueuedFrames = 4);
+    ~FieldSequenceWriter();
+    FieldSequenceWriter(const FieldSequenceWriter &) = delete;
+    FieldSequenceWriter &operator=(const FieldSequenceWriter &) = delete;
+
+    FieldFrame &acquire();
+    void submit();
+
+    void printStats();
+
+private:
+    void run();
+    void writeFrame(const FieldFrame &frame);
+
+    int fd = -1;
+    std::vector<FieldFrame> pool;
+    std::deque<FieldFrame *> freeFrames;
+    std::deque<FieldFrame *> queuedFrames;
+    FieldFrame *acquired = nullptr;
+
+    // owned by the writer thread
+    std::vector<uint8_t> runBytes;
+    std::array<std::vector<uint8_t>, FIELD_SEQUENCE_FIELD_COUNT> fieldBytes;
+
+    uint64_t framesWritten = 0;
+    uint64_t bytesWritten = 0;
+    uint64_t rawBytes = 0;
+    double stallSeconds = 0.0;
+    bool failed = false;
+
+    std::mutex mutex;
+    std::condition_variable frameQueued;
+    std::condition_variable frameFreed;
+    bool stopping = false;
+    std::thread worker; // declared last so it starts after the members it uses
+};
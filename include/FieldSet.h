@@ -0,0 +1,203 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <cstring>
+#include <memory>
+
+#if defined(FIELD_STORAGE_FP16) && defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+constexpr size_t FIELD_ALIGNMENT = 64; // cache line, so every field starts on a fresh line and can be loaded aligned
+
+// Storage precision of phi and the face velocities, chosen at build time (make FIELD_PRECISION=fp16|bf16).
+// Values are always widened to fp32 on load and rounded to nearest even on store, so every kernel computes in fp32.
+#if defined(FIELD_STORAGE_FP16) || defined(FIELD_STORAGE_BF16)
+using FieldStorage = uint16_t;
+#else
+using FieldStorage = float;
+#endif
+
+#if defined(FIELD_STORAGE_FP16)
+inline float decodeField(uint16_t half)
+{
+#if defined(__aarch64__)
+    __fp16 value;
+    std::memcpy(&value, &half, sizeof(half));
+    return (float)value;
+#elif defined(__F16C__)
+    return _cvtsh_ss(half);
+#else
+    constexpr uint32_t shiftedExponent = 0x7C00u << 13;
+    uint32_t bits = (uint32_t)(half & 0x7FFF) << 13;
+    uint32_t exponent = bits & shiftedExponent;
+    bits += (127 - 15) << 23;
+    float value;
+    if (exponent == shiftedExponent) // inf/nan
+    {
+        bits += (128 - 16) << 23;
+        std::memcpy(&value, &bits, sizeof(value));
+    }
+    else if (exponent == 0) // zero/subnormal, renormalised through a float subtract
+    {
+        bits += 1 << 23;
+        std::memcpy(&value, &bits, sizeof(value));
+        value -= 6.103515625e-05f; // 2^-14
+    }
+    else
+    {
+        std::memcpy(&value, &bits, sizeof(value));
+    }
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    std::memcpy(&bits, &value, sizeof(bits));
+    bits |= sign;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+#endif
+}
+
+inline uint16_t encodeField(float value)
+{
+#if defined(__aarch64__)
+    __fp16 half = (__fp16)value;
+    uint16_t bits;
+    std::memcpy(&bits, &half, sizeof(bits));
+    return bits;
+#elif defined(__F16C__)
+    return _cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT);
+#else
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = bits & 0x80000000u;
+    bits ^= sign;
+    uint16_t half;
+    if (bits >= 0x47800000u) // too large for fp16: inf, or quiet nan
+    {
+        half = bits > 0x7F800000u ? 0x7E00 : 0x7C00;
+    }
+    else if (bits < 0x38800000u) // subnormal or zero, a float add of 0.5 rounds the mantissa into place
+    {
+        float magnitude;
+        std::memcpy(&magnitude, &bits, sizeof(magnitude));
+        magnitude += 0.5f;
+        std::memcpy(&bits, &magnitude, sizeof(bits));
+        half = (uint16_t)(bits - 0x3F000000u);
+    }
+    else
+    {
+        uint32_t mantissaOdd = (bits >> 13) & 1;
+        bits += ((uint32_t)(15 - 127) << 23) + 0xFFF + mantissaOdd;
+        half = (uint16_t)(bits >> 13);
+    }
+    return half | (uint16_t)(sign >> 16);
+#endif
+}
+#elif defined(FIELD_STORAGE_BF16)
+inline float decodeField(uint16_t bf16)
+{
+    uint32_t bits = (uint32_t)bf16 << 16;
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+inline uint16_t encodeField(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    if ((bits & 0x7FFFFFFFu) > 0x7F800000u) // keep nan a nan
+    {
+        return (uint16_t)((bits >> 16) | 0x40);
+    }
+    bits += 0x7FFF + ((bits >> 16) & 1);
+    return (uint16_t)(bits >> 16);
+}
+#endif
+
+#if defined(FIELD_STORAGE_FP16) || defined(FIELD_STORAGE_BF16)
+// Reference to one stored 16-bit value that reads and writes as float
+class FieldRef
+{
+public:
+    explicit FieldRef(uint16_t *value) : ptr(value) {}
+    operator float() const { return decodeField(*ptr); }
+    FieldRef &operator=(float value)
+    {
+        *ptr = encodeField(value);
+        return *this;
+    }
+    FieldRef &operator=(const FieldRef &other)
+    {
+        *ptr = *other.ptr;
+        return *this;
+    }
+    FieldRef &operator+=(float value) { return *this = (float)*this + value; }
+    FieldRef &operator-=(float value) { return *this = (float)*this - value; }
+
+private:
+    uint16_t *ptr;
+};
+using FieldReference = FieldRef;
+#else
+using FieldReference = float &;
+#endif
+
+enum FieldId : uint32_t
+{
+    FIELD_PHI = 0,
+    FIELD_U_MINUS,
+    FIELD_V_MINUS,
+    FIELD_W_MINUS,
+    FIELD_COUNT
+};
+
+// Non-owning view of one field buffer. Copying a span never copies field data.
+class FieldSpan
+{
+public:
+    FieldSpan(FieldStorage *data, size_t size) : ptr(data), count(size) {}
+
+#if defined(FIELD_STORAGE_FP16) || defined(FIELD_STORAGE_BF16)
+    FieldReference operator[](size_t index) const { return FieldRef(ptr + index); }
+#else
+    FieldReference operator[](size_t index) const { return ptr[index]; }
+#endif
+    FieldStorage *data() const { return ptr; }
+    size_t size() const { return count; }
+
+    // Bulk conversion to and from fp32, for checkpoints
+    void read(float *out) const;
+    void write(const float *in) const;
+
+private:
+    FieldStorage *ptr;
+    size_t count;
+};
+
+// Double-buffered phi and face velocities in a single aligned allocation.
+// The current buffer holds the latest state and the previous one the state before it; swap() exchanges the two
+// by flipping pointers, so changing buffers costs the same at any grid size.
+class FieldSet
+{
+public:
+    explicit FieldSet(const std::array<size_t, FIELD_COUNT> &sizes);
+
+    FieldSpan current(FieldId field) const { return FieldSpan(buffers[currentBuffer][field], sizes[field]); }
+    FieldSpan previous(FieldId field) const { return FieldSpan(buffers[1 - currentBuffer][field], sizes[field]); }
+    size_t size(FieldId field) const { return sizes[field]; }
+
+    void swap() { currentBuffer = 1 - currentBuffer; }
+
+private:
+    struct AlignedFree
+    {
+        void operator()(FieldStorage *p) const;
+    };
+
+    std::array<size_t, FIELD_COUNT> sizes;
+    std::unique_ptr<FieldStorage[], AlignedFree> storage;
+    std::array<std::array<FieldStorage *, FIELD_COUNT>, 2> buffers;
+    uint32_t currentBuffer = 0;
+};
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include "Grid.h"
+
+// Wall time of each stage of one frame, in seconds
+struct FrameTimings
+{
+    double advect = 0.0;
+    double assemble = 0.0; // updateSOE
+    double solve = 0.0;    // solveSOE, the only stage the solve budget limits
+    double project = 0.0;
+    double reinit = 0.0;   // smoothSurface
+    double mesh = 0.0;
+    double present = 0.0;  // checkpoints, capture, drawing and export
+
+    double total() const { return advect + assemble + solve + project + reinit + mesh + present; }
+};
+
+// Holds the frame time near a target by trading accuracy for time. Quality levels go from full effort (0) to
+// GOVERNOR_LEVELS - 1, each lowering the solver tolerance, redistancing less often and meshing fewer frames.
+// Above level 0 the pressure solve also gets whatever the other stages, smoothed over recent frames, leave of the
+// target. Quality changes with hysteresis: it drops after a few slow frames, comes back only after a longer run of
+// fast frames whose solves all converged, and never changes again until the smoothed timings have seen the last
+// change.
+class FrameGovernor
+{
+public:
+    explicit FrameGovernor(double targetSeconds);
+
+    // Folds in the timings of the frame just finished and picks the effort for the next one, logging any change.
+    // solveCut is whether that frame's pressure solve stopped at its budget.
+    void update(const FrameTimings &timings, bool solveCut);
+
+    const GridEffort &getGridEffort() const { return gridEffort; }
+    uint32_t getMeshInterval() const { return meshInterval; }
+    uint32_t getLevel() const { return level; }
+    double getSmoothedFrameTime() const { return smoothed.total(); }
+
+private:
+    void applyLevel();
+
+    double target;
+    FrameTimings smoothed;
+    bool primed = false;
+    uint32_t level = 0;
+    uint32_t slowFrames = 0;
+    uint32_t fastFrames = 0; // in a row, with no solve cut
+    uint32_t holdFrames = 0;
+    GridEffort gridEffort;
+    uint32_t meshInterval = 1;
+};
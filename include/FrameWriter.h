@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+enum class FrameFormat
+{
+    RAW, // concatenated RGBA8 frames in one file
+    PPM, // one binary P6 file per frame
+    Y4M  // one YUV4MPEG2 4:2:0 stream
+};
+
+// Writes read-back RGBA8 frames from the headless renderer to disk.
+// The format is chosen from the path: *.y4m, *.rgba / *.raw, anything else is a PPM prefix.
+class FrameWriter
+{
+public:
+    FrameWriter(const std::string &path, uint32_t width, uint32_t height, uint32_t fps = 30);
+    ~FrameWriter();
+    FrameWriter(const FrameWriter &) = delete;
+    FrameWriter &operator=(const FrameWriter &) = delete;
+
+    void write(const uint8_t *rgba);
+    uint64_t getFramesWritten() const { return framesWritten; }
+
+private:
+    std::string path;
+    FrameFormat format;
+    uint32_t width;
+    uint32_t height;
+    FILE *stream = nullptr;
+    std::vector<uint8_t> scratch;
+    uint64_t framesWritten = 0;
+};
@@ -2,47 +2,340 @@
 
 #include <cstdint>
 #include <vector>
+#include <string>
+#include <chrono>
 #include <glm/glm.hpp>
 #include "Vertex.h"
+#include "SurfaceMesh.h"
+#include "GridConstants.h"
+#include "Checkpoint.h"
+#include "FieldSet.h"
+#include "BrickGrid.h"
+#include "BrickExpression.h"
+#include "FieldSequenceWriter.h"
+#include "ThreadPool.h"
+#include "ParticleSet.h"
+
+// Channels of the solver's brick grid
+enum SolverChannel : uint32_t
+{
+    SOLVER_PRESSURE = 0,
+    SOLVER_D,
+    SOLVER_RESIDUAL,
+    SOLVER_CONJUGATE,
+    SOLVER_AP,
+    SOLVER_INV_DIAGONAL, // Chebyshev solves only, allocated last so CG solves go without it
+    SOLVER_CHANNEL_COUNT
+};
+
+// Cell types of a solver brick and its one-cell halo, two bits per cell: fluid and solid masks with one word per
+// tile row, bit tk for cell (ti, tj, tk) in word ti * BRICK_TILE_SIZE + tj. Air cells have neither bit, rows folded
+// into tall cells are solid. The tile's edge and corner cells are in no 7-point stencil, and are not kept up to date.
+struct BrickCellTypes
+{
+    static_assert(BRICK_TILE_SIZE <= 16, "a tile row must fit in one mask word");
+    std::array<uint16_t, BRICK_TILE_SIZE * BRICK_TILE_SIZE> fluid;
+    std::array<uint16_t, BRICK_TILE_SIZE * BRICK_TILE_SIZE> solid;
+};
+
+// Bounds of phi over the corner samples of a block of marching cubes
+struct PhiRange
+{
+    float min;
+    float max;
+};
+
+// Particle-to-grid sums of one node, interleaved so the eight nodes a particle splats on share cache lines
+struct TransferNode
+{
+    float weight;
+    float momentum[3];
+};
+
+// How velocities are carried from one step to the next
+enum ParticleTransfer : uint32_t
+{
+    TRANSFER_NONE = 0, // semi-Lagrangian advection of the grid velocities
+    TRANSFER_FLIP,     // particles add the grid's velocity change to their own, blended with a little PIC
+    TRANSFER_APIC      // particles take the grid velocity and its gradient
+};
+
+// How the pressure system is solved
+enum PressureSolver : uint32_t
+{
+    PRESSURE_CG = 0,   // conjugate gradients, two global dot products per iteration
+    PRESSURE_CHEBYSHEV // Chebyshev-accelerated Jacobi, dot products only to estimate eigenvalues and check the residual
+};
+
+// Scene setup and grid modes, fixed for the lifetime of a Grid
+struct GridOptions
+{
+    float poolDepth = 0.0f; // water filling the bottom of the domain to this depth under the sphere, 0 for none
+    bool tallCells = false; // fold deep water far below the surface into one tall cell per column
+    bool coarseBricks = false; // coarse interior pressure: 2^3-cell aggregates in liquid bricks away from the surface
+    bool refineSurface = false; // phi at twice the resolution in the surface bricks near the liquid, meshed at that resolution
+    bool movingWindow = false; // translate the grid in whole cells to keep the liquid away from its walls, each move copies every field
+    ParticleTransfer particles = TRANSFER_NONE;
+    PressureSolver pressureSolver = PRESSURE_CG;
+    double solveBudget = 0.0; // seconds a pressure solve may take before it stops with its latest iterate, 0 for no limit
+    uint32_t threads = 0; // threads of the simulation's pool including the caller, 0 for one per hardware thread
+};
+
+// Effort knobs that may change from one step to the next, see FrameGovernor
+struct GridEffort
+{
+    double solveBudget = 0.0;     // seconds a pressure solve may take, 0 for no limit
+    float solveTolerance = 1e-6f; // squared residual per cell at which the pressure solve stops
+    uint32_t reinitInterval = 1;  // steps between redistancing phi, velocities are extrapolated every step
+};
 
 class Grid
 {
 public:
-    Grid();
+    Grid(const GridOptions &options = {});
     glm::vec3 getPosition(uint32_t x_i, uint32_t y_i, uint32_t z_i);
     void advect(float deltaT);
     void updateSOE(float deltaT);
+    // advect then updateSOE, overlapped slab by slab where their dependencies allow
+    void advectAndAssemble(float deltaT);
     void solveSOE();
     void project(float deltaT);
+    // project, then constructSurface if mesh is set, as one task graph. Meshing reads only the cells at the
+    // surface, which smoothSurface leaves as they are, so it runs beside projection instead of after smoothSurface.
+    // Follows advectAndAssemble in the same step.
+    void projectAndMesh(float deltaT, SurfaceMesh *mesh);
     void smoothSurface();
-    void constructSurface(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices);
-    inline float updatePhi(uint32_t base_index, float old_phi, const std::array<float, 6> &neighbor_phis);
+    // Brings the cached mesh up to date, re-meshing only surface bricks whose phi samples changed
+    void constructSurface(SurfaceMesh &mesh);
+
+    // Checkpoint/restart: saving snapshots the current state and hands it to a background writer
+    bool saveCheckpoint(const std::string &path);
+    void loadCheckpoint(const std::string &path);
+    double getSimTime() const { return simTime; }
+    // Copies phi and velocities of cells within bandWidth of the surface, for offline capture
+    void captureFields(FieldFrame &out, float bandWidth);
+    uint64_t getFrame() const { return frame; }
+    // World-space translation of the grid from where it started, nonzero only with a moving window
+    glm::vec3 getWindowOffset() const { return glm::vec3((float)windowOrigin[0], (float)windowOrigin[1], (float)windowOrigin[2]) * CELL_WIDTH; }
+    // Copies the current phi, i-major like every field: as stored in fp16 builds, as fp32 otherwise
+    void copyPhi(void *out) const;
+    const GridEffort &getEffort() const { return effort; }
+    void setEffort(const GridEffort &newEffort) { effort = newEffort; }
+    // Whether the last pressure solve stopped at effort.solveBudget rather than at its tolerance
+    bool getSolveCut() const { return solveCut; }
 
 private:
-    std::array<std::vector<float>, 2> phi_arrays;
+    GridOptions options;
+    GridEffort effort;
+    FieldSet fields; // phi and face velocities, current and previous step
+
+    // Pressure system, stored only in bricks that contain liquid
+    BrickGrid solver;
+    std::vector<uint8_t> brickTouched;
+    std::vector<uint32_t> touchedBricks;
+    std::vector<BrickCellTypes> cellTypes; // per brick id; the matrix is derived from it
+    std::vector<uint64_t> fluidCells;      // one bit per cell, phi < 0 when the cell types were last brought up to date
+    std::vector<uint8_t> typesState;       // per brick id, whether its cell types need rebuilding
+    std::vector<uint32_t> brickRowsRebuilt; // per active brick, assembly stats of the last updateSOE
+    std::vector<uint32_t> brickRowsChanged;
+    uint32_t flippedCells = 0; // band cells that changed between air and fluid in the last updateSOE
+    void updateSolverBricks(bool full);
+    void prepareSOE();
+    void assembleBrick(uint32_t n, float deltaT);
+    void projectBrick(uint32_t brick, float deltaT);
+    void finishSOE(float deltaT);
+
+    // advectAndAssemble's and projectAndMesh's task graph and the active bricks of each (bi, bj) column, rebuilt
+    // every step
+    TaskGraph stepGraph;
+    std::vector<uint32_t> velocityTasks; // per i slab
+    std::vector<uint32_t> columnTasks;   // per column, its projection task
+    std::vector<uint32_t> columnStarts;
+    std::vector<uint32_t> columnCursors; // per column, the next free entry of columnBricks while it is filled
+    std::vector<uint32_t> columnBricks;  // indices into the active bricks
+
+    // Tall cells: every interior column keeps regular cells at rows tallTop and tallBottom, and the rows between
+    // them are one tall cell whose pressure and velocities vary linearly from top to bottom. Its rows are solid
+    // to the brick stencil and couple through an extra column term instead. tallTop == tallBottom when unused.
+    uint32_t tallTop = Ny - 2;
+    uint32_t tallBottom = Ny - 2;
+    uint32_t tallRefresh[2] = {1, 0}; // rows whose cell types changed when the level last moved, empty if first > last
+    float tallSame = 0.0f;            // Galerkin weights of the horizontal coupling, see updateTallCells
+    float tallCross = 0.0f;
+    std::vector<uint32_t> tallSlots; // per interior column, solver offsets of its top and bottom cells
+    std::vector<uint32_t> tallHalo;  // tallSlots over all Nx * Nz columns, the wall ring repeating its inner neighbour
+    std::vector<float> tallJacobi;   // per tall slot, 6 over the diagonal of its row of A
+    float tallResidual(uint32_t r);  // sum over tall slots of (jacobi - 1) r^2
+    void tallPrecondition(uint32_t r, uint32_t p);
 
-    std::array<std::vector<float>, 2> u_minus_arrays;
-    std::array<std::vector<float>, 2> v_minus_arrays;
-    std::array<std::vector<float>, 2> w_minus_arrays;
+    // Coarse interior pressure aggregates: liquid bricks with no band cell in or next to them hold their cells in
+    // 2^3 aggregates, each storing twice the pressure of its eight cells so its row of the Galerkin operator is the
+    // plain 7-point stencil. Fine neighbours see the aggregate's pressure in each of its cells. Only the solver is
+    // coarsened; phi and velocities stay on the uniform grid, and the refined band below only ever refines phi.
+    std::vector<uint8_t> brickCoarse;   // per brick id
+    std::vector<uint8_t> brickNearBand; // per root brick, scratch for updateCoarseBricks
+    std::vector<uint32_t> nearBandBricks;
+    bool isCoarse(uint32_t brick) const { return brick < brickCoarse.size() && brickCoarse[brick]; }
+    uint32_t solverCells(uint32_t brick) const;
+    void updateCoarseBricks();
+    void patchCoarseHalo(uint32_t channel, uint32_t brick, float *tile) const;
+    void loadCoarseTile(uint32_t channel, uint32_t brick, float *tile) const;
+    bool inTallCell(uint32_t j) const { return j > tallTop && j < tallBottom; }
+    void updateTallCells();
+    void fillTallVelocities();
+    void fillTallSlab(uint32_t i);
+    void projectTallCells(float deltaT);
+    void projectTallSlab(uint32_t i, float deltaT);
 
-    std::vector<float> AplusI;
-    std::vector<float> AplusJ;
-    std::vector<float> AplusK;
-    std::vector<float> Adiag;
-    std::vector<float> D;
-    std::vector<float> pressures;
+    // Refined surface band: surface bricks with a sample within two cells of the surface, or whose fine values cross
+    // it, hold phi on a lattice twice as fine whose even nodes are the grid's samples. A fine node outside them is the coarse samples
+    // interpolated, so every node has one value and marching the fine lattice leaves no cracks where refined bricks
+    // end. Fine phi is advected through the grid velocities and copied onto the coarse samples it shares with the
+    // band, so the pressure solve sees the liquid the mesh shows. Velocities and pressure stay on the grid.
+    std::vector<uint32_t> fineSlots;               // per surface brick, its block of fine values, NO_FINE_SLOT if coarse
+    std::vector<uint32_t> fineBricks;              // refined surface bricks in brick order
+    std::vector<uint32_t> fineFree;                // blocks no brick uses
+    std::vector<uint8_t> fineWanted;               // per surface brick, scratch for updateFineBricks
+    std::array<std::vector<float>, 2> fineValues; // current and previous fine phi, one block per refined brick
+    uint32_t fineCurrent = 0;
+    float fineNode(const float *fine, const FieldSpan &phi, uint32_t I, uint32_t J, uint32_t K) const;
+    void fineRow(const float *fine, const FieldSpan &phi, uint32_t I, uint32_t J, uint32_t K, uint32_t count, float *out) const;
+    float sampleFine(const float *fine, const FieldSpan &phi, float x, float y, float z) const;
+    void advectFine(float deltaT);
+    void redistanceFine();
+    void updateFineBricks(bool reset);
+    uint64_t loadFineTile(uint32_t bi, uint32_t bj, uint32_t bk, float *tile, PhiRange &range) const; // returns the tile's hash
 
-    uint32_t oldStorage = 0;
-    uint32_t newStorage = 1;
+    // Moving window: the world cell that grid cell (0, 0, 0) covers, relative to where the grid started. The
+    // window moves when the liquid comes within a margin of a wall, up to 8 cells and at most a quarter of the axis,
+    // and re-centres it.
+    std::array<int32_t, 3> windowOrigin = {0, 0, 0};
+    std::vector<float> windowPressures;    // dense pressures before a move
+    std::vector<float> windowShifted;      // and after it
+    std::vector<FieldStorage> windowEdges; // slabs 1 and Nx - 2 of the field being shifted
+    void updateWindow();
+    void scrollWindow(const std::array<int32_t, 3> &shift);
 
+    // FLIP/APIC particles carry the velocities between steps and the grid only solves for pressure. Each step
+    // seeds liquid cells left without particles, moves the particles, rebins them by cell and splats them onto
+    // the nodes; project then updates them from the grid. Nodes no particle reaches are advected as before.
+    ParticleSet particles;
+    std::vector<uint32_t> particleKeys; // per particle, the cell it was moved into
+    std::vector<uint32_t> slabSeeds;    // per i slab, particles seeded this step
+    std::vector<TransferNode> transferNodes;
+    uint32_t particlesSeeded = 0;
+    uint32_t particlesRemoved = 0;
+    double particleSeconds = 0.0; // spent on particles this step, for the throughput report
+    void seedParticles();
+    void moveParticles(float deltaT);
+    void splatParticles();
+    void transferParticles(float deltaT); // the three passes above, timed
+    void gatherParticles(float deltaT);
+
+    double simTime = 0.0;
+    uint64_t frame = 0;
+
+    CheckpointImage checkpointImage;
+    CheckpointWriter checkpointWriter;
+
+    void beginStep(float deltaT);
+    void advectPhi(uint32_t begin, uint32_t end, float deltaT);
+    void advectVelocitySlab(uint32_t i, float deltaT, const TransferNode *transfer);
+    void carryWallFaces();
     void flipStorage();
+    void resetDerivedState(); // after phi was replaced wholesale
+    void gatherPressure(float *dense) const;
+
+    // Narrow band: interior cells within NARROW_BAND_WIDTH of the surface plus a one-cell halo, grouped by i slab
+    std::vector<uint32_t> bandCells;
+    std::vector<uint32_t> bandCore;
+    std::vector<uint32_t> bandUnsorted;
+    std::vector<uint32_t> slabStarts;
+    std::vector<uint8_t> reinitFlags; // per cell, REINIT_FAR for cells outside the band list
+    void updateBand();
+    void resetBand();
+
+    // Surface bricks whose samples were in the band this frame (bit 0) or the previous one (bit 1)
+    uint32_t surfaceBricks[3];
+    std::vector<uint8_t> surfaceTouched;
+    bool surfaceReset = true; // phi was replaced wholesale, every brick must be re-meshed
+    void touchSurfaceBricks(uint32_t index, std::vector<uint8_t> &flags) const; // sets bit 0 for each brick
+
+    // Min/max phi pyramid: blocks of 4^3 cubes, surface bricks, and super-bricks of 4^3 surface bricks. Brought up
+    // to date by constructSurface for the bricks it checks, so it describes phi as of the last surface.
+    uint32_t phiBlocks[3];
+    uint32_t phiSuperBricks[3];
+    std::vector<PhiRange> blockRanges;
+    std::vector<PhiRange> brickRanges;
+    std::vector<PhiRange> superBrickRanges;
+    uint64_t scanSurfaceBrick(uint32_t bi, uint32_t bj, uint32_t bk, bool hashSamples); // returns the sample hash if hashSamples is set
+    void updateSuperBrickRanges();
+    void rebuildPhiRanges();
+    void marchCube(const FieldSpan &phi, uint32_t i, uint32_t j, uint32_t k, uint8_t vertexMask, std::vector<Vertex> &vertices);
+
+    // Cubes of the brick being meshed that the surface passes through
+    struct ActiveCube
+    {
+        uint32_t i, j, k;
+        uint8_t vertexMask;
+    };
+    void classifyCubes(const FieldSpan &phi, uint32_t i0, uint32_t i1, uint32_t j0, uint32_t j1, uint32_t k0, uint32_t k1, std::vector<ActiveCube> &cubes);
+    static void classifyRows(const uint32_t *rowSigns, uint32_t rowStride, uint32_t i0, uint32_t i1, uint32_t j0, uint32_t j1, uint32_t k0, uint32_t k1,
+                             std::vector<ActiveCube> &cubes);
+    void marchFineTile(uint32_t bi, uint32_t bj, uint32_t bk, const float *tile, std::vector<ActiveCube> &cubes, std::vector<Vertex> &vertices);
+
+    // Surface slabs, one per i of surface bricks: the bricks meshSurfaceSlab found stale and their triangles, kept
+    // until commitSurfaceSlab hands them to the mesh
+    struct SurfaceSlab
+    {
+        std::vector<uint32_t> bricks;
+        std::vector<uint64_t> hashes;
+        std::vector<std::vector<Vertex>> vertices; // per stale brick, reused across frames
+        std::vector<ActiveCube> cubes;
+        std::vector<float> fineTile; // fine phi of the brick being meshed, with a refined surface
+        uint32_t hashed = 0;
+    };
+    std::vector<SurfaceSlab> surfaceSlabs;
+    void prepareSurface(SurfaceMesh &mesh);
+    void meshSurfaceSlab(uint32_t bi, const SurfaceMesh &mesh);
+    void commitSurfaceSlab(uint32_t bi, SurfaceMesh &mesh);
+    void finishSurface(const SurfaceMesh &mesh);
+
+    // Reinitialisation state:
+    std::array<std::vector<uint32_t>, 4> sweepOrders; // band cells bucketed by hyperplane, one per sweep corner
+    std::array<std::vector<uint32_t>, 4> planeStarts;
+    std::array<std::vector<uint32_t>, 4> sweepPlanes;
+    void sortSweepOrders(uint32_t orderCount);
+    inline void extrapolateVelocity(uint32_t base_index, int direction);
+
+    ThreadPool threadPool;
+
+    // SOE Solver helpers, operating on solver channels:
+    std::vector<float> brickPartials;
+    std::vector<float> slabPartials; // per interior i slab, the tall cells' share of a sum over a product
+    // Runs the statements over every active brick in one pass and returns the total of their sums, see evaluate
+    template <typename... Statements>
+    float solverPass(const Statements &...statements);
+    // result = A * x, brick by brick, as a statement that a solverPass can follow with a sum over the products
+    auto product(const Channel &x, const Channel &result)
+    {
+        return eachBrick([this, x = x.id, result = result.id](uint32_t brick)
+                         { mulBrick(x, result, brick); });
+    }
+    void mulBrick(uint32_t x, uint32_t result, uint32_t brick);
+    float tallProduct(uint32_t x, uint32_t result, float total); // adds the column term, and its share of x * A x to total
+    void mulA(uint32_t x, uint32_t result);
 
-    // SOE Solver variables:
-    std::vector<float> residuals;
-    std::vector<float> conjugates;
+    // Deadline: the solve stops before an iteration that would end past solveStart + effort.solveBudget, at the
+    // mean cost of the iterations so far. The pressure it leaves warm-starts the next step, and the divergence it
+    // left in the velocities is part of the next step's right-hand side.
+    std::chrono::steady_clock::time_point solveStart;
+    bool solveCut = false;
+    bool solveOverBudget(uint32_t iterations) const;
+    void stopAtDeadline(uint32_t iterations, float r_dot_r);
 
-    // SOE Solver helpers:
-    void mulA(const std::vector<float> &x, std::vector<float> &result);
-    float dot(const std::vector<float> &a, const std::vector<float> &b);
-    void sumC(const std::vector<float> &a, const std::vector<float> &b, float C, std::vector<float> &result);
+    // Chebyshev solver: a few Jacobi-preconditioned CG steps estimate the extreme eigenvalues of D^-1 A, then the
+    // iteration runs on those bounds with the residual only checked every CHEBYSHEV_CHECK_INTERVAL iterations
+    void solveChebyshev();
+    double updateInverseDiagonal(); // returns a bound on the eigenvalues of D^-1 A
 };
\ No newline at end of file
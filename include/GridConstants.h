@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// Grid resolution and geometry, shared by the simulation and anything that reads or writes its fields
+constexpr uint32_t Nx = 10;
+constexpr uint32_t Ny = 10;
+constexpr uint32_t Nz = 10;
+constexpr uint32_t NyNz = Ny * Nz;
+constexpr float CELL_WIDTH = 10.0f / (float)Nx;
+constexpr float INV_CELL_WIDTH = 1.0f / CELL_WIDTH;
+constexpr glm::vec3 globalOffset = {-(Nx * CELL_WIDTH) / 2.0f, -(Ny *CELL_WIDTH) / 2.0f, -(Nz *CELL_WIDTH) / 2.0f};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "Vertex.h"
+
+// Writes one binary little-endian PLY per frame from a background thread.
+// Meshes are handed over by swapping vectors into a back buffer, so submit() is O(1) unless the writer is
+// still busy with the previous two frames, in which case it waits (back-pressure) and records the stall.
+class MeshExporter
+{
+public:
+    explicit MeshExporter(const std::string &prefix);
+    ~MeshExporter();
+    MeshExporter(const MeshExporter &) = delete;
+    MeshExporter &operator=(const MeshExporter &) = delete;
+
+    // vertices and indices are swapped out; callers get back previously written buffers to refill
+    void submit(uint64_t frame, std::vector<Vertex> &vertices, std::vector<uint32_t> &indices);
+
+    void printStats();
+
+private:
+    void run();
+    void writeMesh();
+
+    std::string prefix;
+
+    // back buffer, filled by submit()
+    std::vector<Vertex> backVertices;
+    std::vector<uint32_t> backIndices;
+    uint64_t backFrame = 0;
+    bool backFull = false;
+
+    // front buffer, owned by the writer thread
+    std::vector<Vertex> frontVertices;
+    std::vector<uint32_t> frontIndices;
+    uint64_t frontFrame = 0;
+    bool writing = false;
+    std::vector<float> packedVertices;
+    std::vector<uint8_t> packedFaces;
+
+    uint64_t framesWritten = 0;
+    uint64_t bytesWritten = 0;
+    uint64_t failedFrames = 0;
+    uint64_t stalledFrames = 0;
+    double writeSeconds = 0.0;
+    double stallSeconds = 0.0;
+
+    std::mutex mutex;
+    std::condition_variable meshQueued;
+    std::condition_variable bufferFreed;
+    bool stopping = false;
+    std::thread worker; // declared last so it starts after the members it uses
+};
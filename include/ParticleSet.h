@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "ThreadPool.h"
+
+// Per-particle values. The affine channels hold the APIC velocity gradient row by row, C[a][b] at
+// PARTICLE_AFFINE + 3 * a + b, and are only allocated when the set is built with all channels.
+enum ParticleChannel : uint32_t
+{
+    PARTICLE_X = 0, // position in cells, on the lattice the grid samples its fields on
+    PARTICLE_Y,
+    PARTICLE_Z,
+    PARTICLE_U,
+    PARTICLE_V,
+    PARTICLE_W,
+    PARTICLE_AFFINE,
+    PARTICLE_CHANNEL_COUNT = PARTICLE_AFFINE + 9
+};
+
+constexpr uint32_t PARTICLE_DROPPED = UINT32_MAX; // cell key of a particle rebin removes
+
+// Particles stored as structure of arrays, one pooled array per channel, kept sorted by cell. Cells are numbered
+// slab by slab, so the particles of each slab are contiguous too. Arrays only grow, a step that needs fewer
+// particles than an earlier one allocates nothing.
+class ParticleSet
+{
+public:
+    ParticleSet(uint32_t channelCount, uint32_t slabCount, uint32_t cellsPerSlab);
+
+    uint32_t size() const { return count; }
+    uint32_t channels() const { return (uint32_t)pools.size(); }
+    float *data(uint32_t channel) { return pools[channel].data(); }
+    const float *data(uint32_t channel) const { return pools[channel].data(); }
+
+    // Appends count particles with unset values and returns the first, the set is unsorted until the next rebin
+    uint32_t append(uint32_t added);
+    void clear();
+
+    // Particles of cell c are [cellStart(c), cellStart(c + 1)) as of the last rebin
+    uint32_t cellStart(uint32_t cell) const { return starts[cell]; }
+    uint32_t slabStart(uint32_t slab) const { return starts[(size_t)slab * slabCells]; }
+
+    // Counting sort by the cell key of each particle, in two passes: particles are scattered to their slab from
+    // fixed chunks with one slab histogram per chunk, then each slab is sorted by cell on its own. Order within
+    // a cell is kept, particles keyed PARTICLE_DROPPED and those past the first maxPerCell of their cell are
+    // removed. Returns the number removed.
+    uint32_t rebin(const uint32_t *keys, uint32_t maxPerCell, ThreadPool &threadPool);
+
+    size_t memoryBytes() const;
+
+private:
+    uint32_t slabs;
+    uint32_t slabCells;
+    uint32_t count = 0;
+    std::vector<std::vector<float>> pools;   // one per channel
+    std::vector<std::vector<float>> scratch; // particles in slab order, between the two rebin passes
+    std::vector<uint32_t> scratchKeys;
+    std::vector<uint32_t> destinations; // per particle, where the current rebin pass moves it
+    std::vector<uint32_t> starts;      // per cell, plus the end of the last one
+    std::vector<uint32_t> chunkSlabs;  // per chunk and slab, particles of the chunk in the slab
+    std::vector<uint32_t> slabCounts;  // per slab, kept particles
+    std::vector<uint32_t> slabOffsets; // per slab, first particle after the slab pass
+};
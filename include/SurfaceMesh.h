@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "Vertex.h"
+
+constexpr uint32_t SURFACE_BRICK_LOG2 = 3;
+constexpr uint32_t SURFACE_BRICK_SIZE = 1u << SURFACE_BRICK_LOG2; // marching cubes along each surface brick edge
+
+struct VertexRange
+{
+    uint32_t first;
+    uint32_t count;
+};
+
+// Marching-cubes surface cached per brick of cubes. Each brick keeps the hash of the phi samples it was meshed
+// from, and its triangles live in a block of one shared vertex array, so a changed brick rewrites (and the GPU
+// copy re-uploads) only its own block.
+// Blocks are power-of-two multiples of MIN_BLOCK_TRIANGLES; slots not holding triangles hold degenerate ones, so
+// the whole array can be drawn as a non-indexed triangle list.
+class SurfaceMesh
+{
+public:
+    SurfaceMesh(uint32_t cubesX, uint32_t cubesY, uint32_t cubesZ, uint32_t maxVertices);
+
+    uint32_t bricksX() const { return brickDims[0]; }
+    uint32_t bricksY() const { return brickDims[1]; }
+    uint32_t bricksZ() const { return brickDims[2]; }
+    uint32_t brickIndex(uint32_t bi, uint32_t bj, uint32_t bk) const { return (bi * brickDims[1] + bj) * brickDims[2] + bk; }
+
+    bool meshed(uint32_t brick) const { return bricks[brick].meshed; }
+    // True if the brick was never meshed or was meshed from samples with a different hash
+    bool stale(uint32_t brick, uint64_t hash) const { return !bricks[brick].meshed || bricks[brick].hash != hash; }
+    // Replaces a brick's triangles; throws if the vertex array is full
+    void update(uint32_t brick, uint64_t hash, const std::vector<Vertex> &brickVertices);
+    // Forces every brick to be re-meshed, e.g. after phi was replaced wholesale
+    void invalidate();
+
+    // Every slot up to the high-water mark, degenerate where unused
+    const Vertex *vertexData() const { return arena.data(); }
+    uint32_t vertexCount() const { return (uint32_t)arena.size(); }
+    uint32_t triangleCount() const { return triangles; }
+
+    // Vertex ranges rewritten since the last clearDirty(), sorted and merged
+    const std::vector<VertexRange> &dirtyRanges();
+    void clearDirty() { dirty.clear(); }
+
+    // Packs the live triangles into plain vertex and index lists, for export
+    void compact(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices) const;
+
+private:
+    static constexpr uint32_t MIN_BLOCK_TRIANGLES = 16;
+    static constexpr uint32_t NO_BLOCK = UINT32_MAX;
+
+    struct Brick
+    {
+        uint64_t hash = 0;
+        uint32_t first = 0;
+        uint32_t sizeClass = NO_BLOCK;
+        uint32_t count = 0; // vertices
+        bool meshed = false;
+    };
+
+    static uint32_t blockVertices(uint32_t sizeClass) { return MIN_BLOCK_TRIANGLES * 3 << sizeClass; }
+    uint32_t allocateBlock(uint32_t sizeClass);
+    void clearSlots(uint32_t first, uint32_t count);
+
+    uint32_t brickDims[3];
+    uint32_t capacity;
+    std::vector<Brick> bricks;
+    std::vector<Vertex> arena;
+    std::vector<std::vector<uint32_t>> freeBlocks; // block offsets, per size class
+    std::vector<VertexRange> dirty;
+    uint32_t triangles = 0;
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Tasks and the order between them, run by ThreadPool::run. A task starts once every task that precedes it has
+// finished, so stages that only depend on nearby slabs of each other can overlap instead of meeting at a barrier.
+class TaskGraph
+{
+public:
+    uint32_t add(std::function<void()> body);
+    // Task after starts only once task before has finished
+    void precede(uint32_t before, uint32_t after);
+    uint32_t size() const { return (uint32_t)tasks.size(); }
+    void clear() { tasks.clear(); }
+
+private:
+    friend class ThreadPool;
+    struct Task
+    {
+        std::function<void()> body;
+        std::vector<uint32_t> successors;
+        uint32_t predecessors = 0;
+    };
+    std::vector<Task> tasks;
+    std::vector<std::atomic<uint32_t>> pending; // per task, predecessors still running, during run
+};
+
+// Persistent worker threads for data-parallel loops over the grid.
+// parallelFor and run are blocking and the calling thread works too; calls made from inside a worker run serially.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(uint32_t threadCount = std::thread::hardware_concurrency());
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    uint32_t size() const { return (uint32_t)workers.size() + 1; }
+
+    // Runs body(begin, end) over [0, count) in chunks of grain items
+    void parallelFor(uint32_t count, uint32_t grain, const std::function<void(uint32_t, uint32_t)> &body);
+
+    // Runs every task of graph in an order its edges allow. Each thread keeps the tasks it made ready in its own
+    // deque and runs the newest first, whose inputs are still in its cache; a thread out of tasks steals the oldest
+    // from the others, and sleeps until a task is made ready when there is none to steal.
+    void run(TaskGraph &graph);
+
+private:
+    struct TaskQueue
+    {
+        std::mutex mutex;
+        std::deque<uint32_t> tasks;
+    };
+
+    void workerLoop(uint32_t index);
+    void runChunks();
+    void runTasks(uint32_t self);
+    void pushTask(uint32_t self, uint32_t task);
+    bool takeTask(uint32_t self, uint32_t &task);
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable jobReady;
+    std::condition_variable jobDone;
+    uint64_t generation = 0;
+    uint32_t busyWorkers = 0;
+    bool stopping = false;
+
+    const std::function<void(uint32_t, uint32_t)> *job = nullptr;
+    uint32_t jobCount = 0;
+    uint32_t jobGrain = 1;
+    std::atomic<uint32_t> nextIndex{0};
+
+    TaskGraph *graph = nullptr;
+    std::unique_ptr<TaskQueue[]> queues; // per thread, the caller's first
+    std::atomic<uint32_t> tasksLeft{0};
+    std::mutex idleMutex;
+    std::condition_variable taskPushed;
+    std::atomic<uint64_t> pushCount{0};     // tasks made ready so far, so an idle thread can tell it missed none
+    std::atomic<uint32_t> idleThreads{0};   // threads waiting on taskPushed, pushTask only notifies when there are
+};
@@ -14,6 +14,10 @@
 #include <memory>
 #include "Vertex.h"
 #include "Grid.h"
+#include "SurfaceMesh.h"
+#include "MeshExporter.h"
+#include "FrameWriter.h"
+#include "FrameGovernor.h"
 
 struct QueueFamilyIndices
 {
@@ -33,10 +37,27 @@ struct SwapChainSupportDetails
     std::vector<VkPresentModeKHR> presentModes;
 };
 
+struct AppOptions
+{
+    std::string restorePath;    // load this checkpoint before the first frame
+    std::string checkpointPath; // where periodic checkpoints are written
+    uint32_t checkpointInterval = 0; // frames between checkpoints, 0 disables
+    std::string capturePath;    // stream narrow-band phi/velocity for every frame to this file
+    float captureBand = 3.0f;   // capture band half-width, in cells
+    std::string meshPrefix;     // write the surface mesh of every frame to <prefix>_<frame>.ply
+    bool headless = false;      // render offscreen without a window, surface or swapchain
+    uint32_t headlessFrames = 300;
+    std::string framePath;      // headless output: *.y4m, *.rgba/*.raw, or a PPM prefix
+    bool raymarch = false;      // draw the surface by raymarching phi uploaded as a 3D texture, instead of meshing it
+    bool pipeline = false;      // run advect with updateSOE, and project with meshing, as task graphs
+    double targetFrameTime = 0.0; // seconds the governor holds frames to by lowering simulation effort, 0 disables it
+    GridOptions grid;           // scene and grid mode
+};
+
 class VulkanApp
 {
 public:
-    VulkanApp() : grid_ptr(std::make_unique<Grid>()) {}
+    VulkanApp(const AppOptions &options = {}) : options(options), grid_ptr(std::make_unique<Grid>(options.grid)) {}
     void run();
 
 private:
@@ -52,6 +73,10 @@ private:
     void createSurface();
     void pickPhysicalDevice();
     void createSwapChain();
+    void createOffscreenTargets();
+    void createReadbackBuffers();
+    void drawFrameOffscreen();
+    void flushReadback(uint32_t slot);
     void cleanupSwapChain();
     void recreateSwapChain();
     void createImageViews();
@@ -68,7 +93,7 @@ private:
     bool hasStencilComponent(VkFormat format);
     VkFormat findSupportedFormat(const std::vector<VkFormat> &candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
     void createVertexBuffer();
-    void createIndexBuffer();
+    void createPhiTexture();
 
     void createUniformBuffers();
     void createDescriptorPool();
@@ -107,6 +132,13 @@ private:
     VkDeviceMemory depthImageMemory;
     VkImageView depthImageView;
     std::vector<VkFramebuffer> swapChainFramebuffers;
+    // headless: swapChainImages is a ring of offscreen images, one per frame in flight
+    std::vector<VkDeviceMemory> offscreenImageMemory;
+    std::vector<VkBuffer> readbackBuffers;
+    std::vector<VkDeviceMemory> readbackMemory;
+    std::vector<void *> readbackMapped;
+    std::vector<bool> readbackPending;
+    std::unique_ptr<FrameWriter> frameWriter;
     VkRenderPass renderPass;
     VkDescriptorSetLayout descriptorSetLayout;
     VkDescriptorPool descriptorPool;
@@ -119,25 +151,36 @@ private:
     std::vector<VkSemaphore> renderFinishedSemaphores;
     std::vector<VkFence> inFlightFences;
     VkBuffer vertexBuffer;
-    VkBuffer indexBuffer;
     VkBuffer stagingVertexBuffer;
-    VkBuffer stagingIndexBuffer;
     VkDeviceMemory vertexBufferMemory;
-    VkDeviceMemory indexBufferMemory;
     VkDeviceMemory stagingVertexMemory;
-    VkDeviceMemory stagingIndexMemory;
 
     std::vector<VkBuffer> uniformBuffers;
     std::vector<VkDeviceMemory> uniformBuffersMemory;
     std::vector<void *> uniformBuffersMapped;
 
-    std::vector<Vertex> vertices;
+    // The surface's vertex array mirrors the staging and vertex buffers slot for slot; only changed ranges are copied
+    std::unique_ptr<SurfaceMesh> surfaceMesh;
+    std::vector<VkBufferCopy> vertexCopies;
+    std::vector<Vertex> vertices; // compacted mesh for the exporter
     std::vector<uint32_t> indices;
 
     void *cpuVertexBuffer;
-    void *cpuIndexBuffer;
 
+    // Raymarch mode: phi is copied whole into this frame's staging buffer and uploaded to one 3D image each frame
+    VkImage phiImage;
+    VkDeviceMemory phiImageMemory;
+    VkImageView phiImageView;
+    VkSampler phiSampler;
+    std::vector<VkBuffer> phiStagingBuffers;
+    std::vector<VkDeviceMemory> phiStagingMemory;
+    std::vector<void *> phiStagingMapped;
+
+    AppOptions options;
     std::unique_ptr<Grid> grid_ptr;
+    std::unique_ptr<FieldSequenceWriter> fieldWriter;
+    std::unique_ptr<MeshExporter> meshExporter;
+    std::unique_ptr<FrameGovernor> governor;
 
     uint32_t currentFrame = 0;
     bool framebufferResized = false;
@@ -1,2 +1,4 @@
 /usr/bin/glslc triangle.vert -o vert.spv
-/usr/bin/glslc triangle.frag -o frag.spv
\ No newline at end of file
+/usr/bin/glslc triangle.frag -o frag.spv
+/usr/bin/glslc raymarch.vert -o raymarch_vert.spv
+/usr/bin/glslc raymarch.frag -o raymarch_frag.spv
\ No newline at end of file
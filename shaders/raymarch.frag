@@ -0,0 +1,100 @@
+#version 450
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+    mat4 inverseViewProj;
+    vec4 eye;
+    vec4 gridOrigin; // world position of phi sample (0, 0, 0), w = 1 / cell width
+    vec4 gridSize;   // phi samples along i, j, k
+} ubo;
+
+// phi with k along x, j along y and i along z, the order the grid stores it in
+layout(binding = 1) uniform sampler3D phiTexture;
+
+layout(location = 0) in vec2 fragNdc;
+
+layout(location = 0) out vec4 outColor;
+
+// Same light and material as the mesh path
+const vec3 lightPos = vec3(0.0, 0.0, -8.0);
+const vec3 surfaceColor = vec3(1.0);
+const float diffuseStrength = 0.3;
+const float ambientStrength = 0.1;
+
+const int MAX_STEPS = 256;
+const float MIN_STEP = 0.05; // in cells, so the march crosses flat regions of the clamped far field
+const float MAX_STEP = 4.0;  // in cells, phi is clamped to the narrow band and only a bound further out
+
+// Sample coordinates (i, j, k) to normalized texture coordinates, hitting texel centres on samples
+vec3 toTexture(vec3 s) {
+    return (s.zyx + 0.5) / ubo.gridSize.zyx;
+}
+
+float phiAt(vec3 s) {
+    return texture(phiTexture, toTexture(s)).r;
+}
+
+void main() {
+    vec4 nearPoint = ubo.inverseViewProj * vec4(fragNdc, 0.0, 1.0);
+    vec4 farPoint = ubo.inverseViewProj * vec4(fragNdc, 1.0, 1.0);
+    float invCell = ubo.gridOrigin.w;
+
+    // march in sample coordinates, where a unit step is one cell
+    vec3 origin = (ubo.eye.xyz - ubo.gridOrigin.xyz) * invCell;
+    vec3 direction = normalize(farPoint.xyz / farPoint.w - nearPoint.xyz / nearPoint.w);
+
+    // clip the ray to the box of samples
+    vec3 lower = vec3(0.0);
+    vec3 upper = ubo.gridSize.xyz - 1.0;
+    vec3 inverseDirection = 1.0 / direction;
+    vec3 t0 = (lower - origin) * inverseDirection;
+    vec3 t1 = (upper - origin) * inverseDirection;
+    vec3 tNear = min(t0, t1);
+    vec3 tFar = max(t0, t1);
+    float t = max(max(max(tNear.x, tNear.y), tNear.z), 0.0);
+    float tExit = min(min(tFar.x, tFar.y), tFar.z);
+    if (t >= tExit) {
+        discard;
+    }
+
+    // sphere trace: phi is a distance in world units, so it is a safe step once scaled to cells
+    float previousT = t;
+    float previousPhi = phiAt(origin + t * direction) * invCell;
+    bool hit = previousPhi < 0.0;
+    for (int n = 0; n < MAX_STEPS && !hit; n++) {
+        t += clamp(previousPhi, MIN_STEP, MAX_STEP);
+        if (t > tExit) {
+            break;
+        }
+        float phi = phiAt(origin + t * direction) * invCell;
+        if (phi < 0.0) {
+            // the surface is between the last two samples, place it where phi crosses zero linearly
+            t = previousT + (t - previousT) * previousPhi / (previousPhi - phi);
+            hit = true;
+        }
+        previousT = t;
+        previousPhi = phi;
+    }
+    if (!hit) {
+        discard;
+    }
+
+    // normal from central differences of the texture, one cell apart
+    vec3 s = origin + t * direction;
+    vec3 gradient = vec3(phiAt(s + vec3(1.0, 0.0, 0.0)) - phiAt(s - vec3(1.0, 0.0, 0.0)),
+                         phiAt(s + vec3(0.0, 1.0, 0.0)) - phiAt(s - vec3(0.0, 1.0, 0.0)),
+                         phiAt(s + vec3(0.0, 0.0, 1.0)) - phiAt(s - vec3(0.0, 0.0, 1.0)));
+    vec3 norm = normalize(gradient + vec3(1e-12));
+    vec3 position = ubo.gridOrigin.xyz + s / invCell;
+    vec3 lightDir = normalize(lightPos - position);
+
+    vec3 ambient = ambientStrength * surfaceColor;
+    float diff = abs(dot(norm, lightDir)); // double-sided, like the mesh's triangles
+    vec3 diffuse = diffuseStrength * diff * surfaceColor;
+    outColor = vec4(ambient + diffuse, 1.0);
+
+    vec4 clip = ubo.proj * ubo.view * vec4(position, 1.0);
+    gl_FragDepth = clip.z / clip.w;
+}
@@ -0,0 +1,11 @@
+#version 450
+
+layout(location = 0) out vec2 fragNdc;
+
+// One triangle that covers the whole viewport, no vertex buffer needed
+const vec2 positions[3] = vec2[](vec2(-1.0, -1.0), vec2(3.0, -1.0), vec2(-1.0, 3.0));
+
+void main() {
+    fragNdc = positions[gl_VertexIndex];
+    gl_Position = vec4(fragNdc, 0.5, 1.0);
+}
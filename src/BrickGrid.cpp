@@ -0,0 +1,187 @@
+#include "BrickGrid.h"
+#include <algorithm>
+#include <cstring>
+
+BrickGrid::BrickGrid(uint32_t nx, uint32_t ny, uint32_t nz, uint32_t channelCount) : dims{nx, ny, nz}
+{
+    for (uint32_t axis = 0; axis < 3; axis++)
+    {
+        brickDims[axis] = (dims[axis] + BRICK_SIZE - 1) / BRICK_SIZE;
+    }
+    root.assign((size_t)brickDims[0] * brickDims[1] * brickDims[2], INVALID_BRICK);
+    pools.resize(channelCount);
+}
+
+uint32_t BrickGrid::allocate(uint32_t bi, uint32_t bj, uint32_t bk)
+{
+    uint32_t &slot = root[rootIndex(bi, bj, bk)];
+    if (slot != INVALID_BRICK)
+    {
+        return slot;
+    }
+
+    uint32_t brick;
+    if (!freeBricks.empty())
+    {
+        brick = freeBricks.back();
+        freeBricks.pop_back();
+        for (std::vector<float> &pool : pools)
+        {
+            std::fill_n(&pool[(size_t)brick * BRICK_CELLS], BRICK_CELLS, 0.0f);
+        }
+    }
+    else
+    {
+        brick = (uint32_t)infos.size();
+        infos.emplace_back();
+        activeSlot.push_back(0);
+        for (std::vector<float> &pool : pools)
+        {
+            pool.resize(pool.size() + BRICK_CELLS, 0.0f);
+        }
+    }
+    slot = brick;
+
+    BrickInfo &brickInfo = infos[brick];
+    brickInfo.bi = bi;
+    brickInfo.bj = bj;
+    brickInfo.bk = bk;
+    brickInfo.neighbors.fill(INVALID_BRICK);
+    link(brick, BRICK_MINUS_I, bi > 0 ? find(bi - 1, bj, bk) : INVALID_BRICK);
+    link(brick, BRICK_PLUS_I, bi + 1 < brickDims[0] ? find(bi + 1, bj, bk) : INVALID_BRICK);
+    link(brick, BRICK_MINUS_J, bj > 0 ? find(bi, bj - 1, bk) : INVALID_BRICK);
+    link(brick, BRICK_PLUS_J, bj + 1 < brickDims[1] ? find(bi, bj + 1, bk) : INVALID_BRICK);
+    link(brick, BRICK_MINUS_K, bk > 0 ? find(bi, bj, bk - 1) : INVALID_BRICK);
+    link(brick, BRICK_PLUS_K, bk + 1 < brickDims[2] ? find(bi, bj, bk + 1) : INVALID_BRICK);
+
+    activeSlot[brick] = (uint32_t)active.size();
+    active.push_back(brick);
+    return brick;
+}
+
+void BrickGrid::release(uint32_t brick)
+{
+    BrickInfo &brickInfo = infos[brick];
+    for (uint32_t face = 0; face < BRICK_FACE_COUNT; face++)
+    {
+        if (brickInfo.neighbors[face] != INVALID_BRICK)
+        {
+            infos[brickInfo.neighbors[face]].neighbors[face ^ 1] = INVALID_BRICK; // faces come in -/+ pairs
+        }
+    }
+    root[rootIndex(brickInfo.bi, brickInfo.bj, brickInfo.bk)] = INVALID_BRICK;
+
+    uint32_t last = active.back();
+    active[activeSlot[brick]] = last;
+    activeSlot[last] = activeSlot[brick];
+    active.pop_back();
+    freeBricks.push_back(brick);
+}
+
+void BrickGrid::link(uint32_t brick, BrickFace face, uint32_t neighbor)
+{
+    infos[brick].neighbors[face] = neighbor;
+    if (neighbor != INVALID_BRICK)
+    {
+        infos[neighbor].neighbors[face ^ 1] = brick;
+    }
+}
+
+void BrickGrid::loadTile(uint32_t channel, uint32_t brick, float *tile) const
+{
+    std::fill_n(tile, BRICK_TILE_CELLS, 0.0f);
+    const float *center = data(channel, brick);
+    for (uint32_t li = 0; li < BRICK_SIZE; li++)
+    {
+        for (uint32_t lj = 0; lj < BRICK_SIZE; lj++)
+        {
+            std::memcpy(&tile[tileCell(li + 1, lj + 1, 1)], &center[brickCell(li, lj, 0)], BRICK_SIZE * sizeof(float));
+        }
+    }
+
+    for (uint32_t face = 0; face < BRICK_FACE_COUNT; face++)
+    {
+        uint32_t neighbor = infos[brick].neighbors[face];
+        if (neighbor == INVALID_BRICK)
+        {
+            continue;
+        }
+        const float *source = data(channel, neighbor);
+        uint32_t axis = face / 2;
+        uint32_t tileLayer = (face & 1) ? BRICK_SIZE + 1 : 0; // halo layer on this side of the tile
+        uint32_t sourceLayer = (face & 1) ? 0 : BRICK_SIZE - 1; // the neighbour's layer touching this brick
+        for (uint32_t a = 0; a < BRICK_SIZE; a++)
+        {
+            for (uint32_t b = 0; b < BRICK_SIZE; b++)
+            {
+                if (axis == 0)
+                {
+                    tile[tileCell(tileLayer, a + 1, b + 1)] = source[brickCell(sourceLayer, a, b)];
+                }
+                else if (axis == 1)
+                {
+                    tile[tileCell(a + 1, tileLayer, b + 1)] = source[brickCell(a, sourceLayer, b)];
+                }
+                else
+                {
+                    tile[tileCell(a + 1, b + 1, tileLayer)] = source[brickCell(a, b, sourceLayer)];
+                }
+            }
+        }
+    }
+}
+
+void BrickGrid::gather(uint32_t channel, float *dense) const
+{
+    std::fill_n(dense, (size_t)dims[0] * dims[1] * dims[2], 0.0f);
+    for (uint32_t brick : active)
+    {
+        const BrickInfo &brickInfo = infos[brick];
+        const float *values = data(channel, brick);
+        for (uint32_t li = 0; li < BRICK_SIZE; li++)
+        {
+            for (uint32_t lj = 0; lj < BRICK_SIZE; lj++)
+            {
+                for (uint32_t lk = 0; lk < BRICK_SIZE; lk++)
+                {
+                    uint32_t i = brickInfo.bi * BRICK_SIZE + li, j = brickInfo.bj * BRICK_SIZE + lj, k = brickInfo.bk * BRICK_SIZE + lk;
+                    if (i < dims[0] && j < dims[1] && k < dims[2])
+                    {
+                        dense[((size_t)i * dims[1] + j) * dims[2] + k] = values[brickCell(li, lj, lk)];
+                    }
+                }
+            }
+        }
+    }
+}
+
+void BrickGrid::scatter(uint32_t channel, const float *dense)
+{
+    for (uint32_t brick : active)
+    {
+        const BrickInfo &brickInfo = infos[brick];
+        float *values = data(channel, brick);
+        for (uint32_t li = 0; li < BRICK_SIZE; li++)
+        {
+            for (uint32_t lj = 0; lj < BRICK_SIZE; lj++)
+            {
+                for (uint32_t lk = 0; lk < BRICK_SIZE; lk++)
+                {
+                    uint32_t i = brickInfo.bi * BRICK_SIZE + li, j = brickInfo.bj * BRICK_SIZE + lj, k = brickInfo.bk * BRICK_SIZE + lk;
+                    bool inside = i < dims[0] && j < dims[1] && k < dims[2];
+                    values[brickCell(li, lj, lk)] = inside ? dense[((size_t)i * dims[1] + j) * dims[2] + k] : 0.0f;
+                }
+            }
+        }
+    }
+}
+
+size_t BrickGrid::memoryBytes() const
+{
+    size_t bytes = root.size() * sizeof(uint32_t) + infos.size() * (sizeof(BrickInfo) + sizeof(uint32_t));
+    for (const std::vector<float> &pool : pools)
+    {
+        bytes += pool.size() * sizeof(float);
+    }
+    return bytes;
+}
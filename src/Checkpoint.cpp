@@ -0,0 +1,191 @@
+#include "Checkpoint.h"
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t alignUp(uint64_t value)
+{
+    return (value + CHECKPOINT_ALIGNMENT - 1) & ~(CHECKPOINT_ALIGNMENT - 1);
+}
+
+void CheckpointImage::reset(uint32_t nx, uint32_t ny, uint32_t nz, double simTime, uint64_t frame, const std::array<int32_t, 3> &windowOrigin,
+                            const std::array<uint64_t, CHECKPOINT_FIELD_COUNT> &counts)
+{
+    CheckpointHeader header{};
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.endianTag = CHECKPOINT_ENDIAN_TAG;
+    header.nx = nx;
+    header.ny = ny;
+    header.nz = nz;
+    header.fieldCount = CHECKPOINT_FIELD_COUNT;
+    header.simTime = simTime;
+    header.frame = frame;
+    for (uint32_t axis = 0; axis < 3; axis++)
+    {
+        header.windowOrigin[axis] = windowOrigin[axis];
+    }
+
+    uint64_t offset = alignUp(sizeof(CheckpointHeader));
+    for (uint32_t field = 0; field < CHECKPOINT_FIELD_COUNT; field++)
+    {
+        header.fields[field].offset = offset;
+        header.fields[field].count = counts[field];
+        offset = alignUp(offset + counts[field] * sizeof(float));
+    }
+
+    // resize() keeps the capacity from earlier checkpoints, so steady-state saves don't allocate
+    bytes.resize(offset);
+    std::memset(bytes.data(), 0, alignUp(sizeof(CheckpointHeader)));
+    std::memcpy(bytes.data(), &header, sizeof(header));
+}
+
+float *CheckpointImage::field(CheckpointField field)
+{
+    const CheckpointHeader *header = reinterpret_cast<const CheckpointHeader *>(bytes.data());
+    return reinterpret_cast<float *>(bytes.data() + header->fields[field].offset);
+}
+
+MappedCheckpoint::MappedCheckpoint(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Could not open checkpoint " + path);
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(CheckpointHeader))
+    {
+        close(fd);
+        throw std::runtime_error("Checkpoint is truncated: " + path);
+    }
+    size = (size_t)info.st_size;
+
+    data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping holds its own reference to the file
+    if (data == MAP_FAILED)
+    {
+        data = nullptr;
+        throw std::runtime_error("Failed to map checkpoint " + path);
+    }
+    // advice values are not flags, each takes its own call; they are hints, so a refusal only costs read-ahead
+    if (madvise(data, size, MADV_SEQUENTIAL) != 0 || madvise(data, size, MADV_WILLNEED) != 0)
+    {
+        std::cerr << "madvise failed on checkpoint " << path << ", reading it without read-ahead hints" << std::endl;
+    }
+
+    const CheckpointHeader &h = header();
+    if (std::memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic)) != 0)
+    {
+        munmap(data, size);
+        throw std::runtime_error("Not a checkpoint file: " + path);
+    }
+    if (h.version < 1 || h.version > CHECKPOINT_VERSION || h.endianTag != CHECKPOINT_ENDIAN_TAG || h.fieldCount != CHECKPOINT_FIELD_COUNT)
+    {
+        munmap(data, size);
+        throw std::runtime_error("Unsupported checkpoint version or byte order: " + path);
+    }
+}
+
+MappedCheckpoint::~MappedCheckpoint()
+{
+    if (data)
+    {
+        munmap(data, size);
+    }
+}
+
+const float *MappedCheckpoint::field(CheckpointField field, uint64_t expectedCount) const
+{
+    const CheckpointFieldEntry &entry = header().fields[field];
+    if (entry.count != expectedCount || entry.offset % alignof(float) != 0 || entry.offset + entry.count * sizeof(float) > size)
+    {
+        throw std::runtime_error("Checkpoint field does not match grid layout");
+    }
+    return reinterpret_cast<const float *>(static_cast<const char *>(data) + entry.offset);
+}
+
+CheckpointWriter::CheckpointWriter() : worker(&CheckpointWriter::run, this) {}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_one();
+    worker.join(); // finishes any checkpoint still in flight
+}
+
+bool CheckpointWriter::busy()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return pending;
+}
+
+bool CheckpointWriter::submit(const std::string &path, CheckpointImage &image)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pending)
+        {
+            return false;
+        }
+        pendingPath = path;
+        std::swap(pendingImage.bytes, image.bytes);
+        pending = true;
+    }
+    cv.notify_one();
+    return true;
+}
+
+void CheckpointWriter::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        cv.wait(lock, [this]
+                { return pending || stopping; });
+        if (!pending)
+        {
+            return;
+        }
+        std::string path = pendingPath;
+        lock.unlock();
+
+        // write to a temporary name and rename, so a crash mid-write never clobbers the last good checkpoint
+        std::string tmpPath = path + ".tmp";
+        int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool ok = fd >= 0;
+        size_t written = 0;
+        while (ok && written < pendingImage.bytes.size())
+        {
+            ssize_t n = write(fd, pendingImage.bytes.data() + written, pendingImage.bytes.size() - written);
+            if (n <= 0)
+            {
+                ok = false;
+                break;
+            }
+            written += (size_t)n;
+        }
+        if (fd >= 0)
+        {
+            ok = fsync(fd) == 0 && ok;
+            close(fd);
+        }
+        ok = ok && rename(tmpPath.c_str(), path.c_str()) == 0;
+        if (!ok)
+        {
+            std::cerr << "Failed to write checkpoint " << path << std::endl;
+        }
+
+        lock.lock();
+        pending = false;
+    }
+}
@@ -0,0 +1,259 @@
+#include "FieldSequenceWriter.h"
+#include "GridConstants.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Values are predicted by linear extrapolation of the previous two bit patterns. Along a row the level set and
+// velocities are smooth, so the residual is small and most of its high bytes are zero.
+void encodeFloats(const float *values, size_t count, std::vector<uint8_t> &out)
+{
+    size_t controlStart = out.size();
+    out.resize(controlStart + (count + 1) / 2, 0);
+    out.reserve(out.size() + count * sizeof(float));
+
+    uint32_t prev1 = 0, prev2 = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &values[i], sizeof(bits));
+        uint32_t residual = bits - (2 * prev1 - prev2);
+        uint32_t zigzag = (residual << 1) ^ (uint32_t)((int32_t)residual >> 31);
+        prev2 = prev1;
+        prev1 = bits;
+
+        uint32_t byteCount = zigzag == 0 ? 0 : zigzag < (1u << 8) ? 1 : zigzag < (1u << 16) ? 2 : zigzag < (1u << 24) ? 3 : 4;
+        out[controlStart + i / 2] |= byteCount << ((i & 1) * 4);
+        for (uint32_t byte = 0; byte < byteCount; byte++)
+        {
+            out.push_back((uint8_t)(zigzag >> (8 * byte)));
+        }
+    }
+}
+
+size_t decodeFloats(const uint8_t *data, size_t size, float *values, size_t count)
+{
+    size_t controlBytes = (count + 1) / 2;
+    if (size < controlBytes)
+    {
+        throw std::runtime_error("Truncated float stream");
+    }
+    size_t cursor = controlBytes;
+
+    uint32_t prev1 = 0, prev2 = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t byteCount = (data[i / 2] >> ((i & 1) * 4)) & 0xF;
+        if (byteCount > 4 || cursor + byteCount > size)
+        {
+            throw std::runtime_error("Corrupt float stream");
+        }
+        uint32_t zigzag = 0;
+        for (uint32_t byte = 0; byte < byteCount; byte++)
+        {
+            zigzag |= (uint32_t)data[cursor++] << (8 * byte);
+        }
+        uint32_t residual = (zigzag >> 1) ^ (0u - (zigzag & 1));
+        uint32_t bits = residual + (2 * prev1 - prev2);
+        prev2 = prev1;
+        prev1 = bits;
+        std::memcpy(&values[i], &bits, sizeof(bits));
+    }
+    return cursor;
+}
+
+void encodeRuns(const std::vector<uint32_t> &runs, std::vector<uint8_t> &out)
+{
+    for (uint32_t value : runs)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back((uint8_t)(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back((uint8_t)value);
+    }
+}
+
+size_t decodeRuns(const uint8_t *data, size_t size, std::vector<uint32_t> &runs)
+{
+    size_t cursor = 0;
+    runs.clear();
+    while (cursor < size)
+    {
+        uint32_t value = 0;
+        uint32_t shift = 0;
+        while (true)
+        {
+            if (cursor >= size || shift > 28)
+            {
+                throw std::runtime_error("Corrupt run list");
+            }
+            uint8_t byte = data[cursor++];
+            value |= (uint32_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+            {
+                break;
+            }
+            shift += 7;
+        }
+        runs.push_back(value);
+    }
+    return cursor;
+}
+
+FieldSequenceWriter::FieldSequenceWriter(const std::string &path, uint32_t maxQueuedFrames)
+{
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Could not open field sequence " + path);
+    }
+
+    FieldSequenceHeader header{};
+    std::memcpy(header.magic, FIELD_SEQUENCE_MAGIC, sizeof(header.magic));
+    header.version = FIELD_SEQUENCE_VERSION;
+    header.nx = Nx;
+    header.ny = Ny;
+    header.nz = Nz;
+    header.fieldCount = FIELD_SEQUENCE_FIELD_COUNT;
+    header.cellWidth = CELL_WIDTH;
+    if (write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header))
+    {
+        close(fd);
+        throw std::runtime_error("Failed to write field sequence header");
+    }
+    bytesWritten = sizeof(header);
+
+    pool.resize(std::max(maxQueuedFrames, 2u));
+    for (FieldFrame &frame : pool)
+    {
+        freeFrames.push_back(&frame);
+    }
+    worker = std::thread(&FieldSequenceWriter::run, this);
+}
+
+FieldSequenceWriter::~FieldSequenceWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    frameQueued.notify_one();
+    worker.join(); // drains every queued frame before closing
+    close(fd);
+    printStats();
+}
+
+FieldFrame &FieldSequenceWriter::acquire()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (freeFrames.empty())
+    {
+        // back-pressure: the disk is behind, wait for the writer rather than growing the queue
+        auto start = std::chrono::high_resolution_clock::now();
+        frameFreed.wait(lock, [this]
+                        { return !freeFrames.empty(); });
+        stallSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+    acquired = freeFrames.front();
+    freeFrames.pop_front();
+    return *acquired;
+}
+
+void FieldSequenceWriter::submit()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queuedFrames.push_back(acquired);
+        acquired = nullptr;
+    }
+    frameQueued.notify_one();
+}
+
+void FieldSequenceWriter::printStats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    double ratio = bytesWritten > 0 ? (double)rawBytes / (double)bytesWritten : 0.0;
+    std::cout << "Field capture: " << framesWritten << " frames, " << bytesWritten / (1024.0 * 1024.0) << " MB, "
+              << ratio << "x vs dense fp32, " << queuedFrames.size() << " queued, " << stallSeconds * 1000.0 << " ms stalled" << std::endl;
+}
+
+void FieldSequenceWriter::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        frameQueued.wait(lock, [this]
+                         { return !queuedFrames.empty() || stopping; });
+        if (queuedFrames.empty())
+        {
+            return;
+        }
+        FieldFrame *frame = queuedFrames.front();
+        lock.unlock();
+
+        writeFrame(*frame);
+
+        lock.lock();
+        queuedFrames.pop_front();
+        freeFrames.push_back(frame);
+        frameFreed.notify_one();
+    }
+}
+
+void FieldSequenceWriter::writeFrame(const FieldFrame &frame)
+{
+    if (failed)
+    {
+        return;
+    }
+
+    runBytes.clear();
+    encodeRuns(frame.runs, runBytes);
+
+    FieldChunkHeader chunk{};
+    chunk.tag = FIELD_SEQUENCE_CHUNK_TAG;
+    chunk.frame = frame.frame;
+    chunk.simTime = frame.simTime;
+    chunk.bandWidth = frame.bandWidth;
+    for (uint32_t axis = 0; axis < 3; axis++)
+    {
+        chunk.windowOrigin[axis] = frame.windowOrigin[axis];
+    }
+    chunk.activeCells = (uint32_t)frame.values[0].size();
+    chunk.runBytes = (uint32_t)runBytes.size();
+    chunk.payloadBytes = chunk.runBytes;
+
+    std::array<iovec, 2 + FIELD_SEQUENCE_FIELD_COUNT> iov;
+    iov[0] = {&chunk, sizeof(chunk)};
+    iov[1] = {runBytes.data(), runBytes.size()};
+    for (uint32_t field = 0; field < FIELD_SEQUENCE_FIELD_COUNT; field++)
+    {
+        fieldBytes[field].clear();
+        encodeFloats(frame.values[field].data(), frame.values[field].size(), fieldBytes[field]);
+        chunk.fieldBytes[field] = (uint32_t)fieldBytes[field].size();
+        chunk.payloadBytes += chunk.fieldBytes[field];
+        iov[2 + field] = {fieldBytes[field].data(), fieldBytes[field].size()};
+    }
+
+    size_t total = sizeof(chunk) + chunk.payloadBytes;
+    ssize_t written = writev(fd, iov.data(), (int)iov.size());
+    if (written != (ssize_t)total)
+    {
+        std::cerr << "Field capture write failed, disabling capture" << std::endl;
+        failed = true;
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    framesWritten++;
+    bytesWritten += total;
+    rawBytes += (uint64_t)FIELD_SEQUENCE_FIELD_COUNT * Nx * NyNz * sizeof(float);
+}
@@ -0,0 +1,63 @@
+#include "FieldSet.h"
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+void FieldSpan::read(float *out) const
+{
+#if defined(FIELD_STORAGE_FP16) || defined(FIELD_STORAGE_BF16)
+    for (size_t index = 0; index < count; index++)
+    {
+        out[index] = decodeField(ptr[index]);
+    }
+#else
+    std::memcpy(out, ptr, count * sizeof(float));
+#endif
+}
+
+void FieldSpan::write(const float *in) const
+{
+#if defined(FIELD_STORAGE_FP16) || defined(FIELD_STORAGE_BF16)
+    for (size_t index = 0; index < count; index++)
+    {
+        ptr[index] = encodeField(in[index]);
+    }
+#else
+    std::memcpy(ptr, in, count * sizeof(float));
+#endif
+}
+
+void FieldSet::AlignedFree::operator()(FieldStorage *p) const
+{
+    std::free(p);
+}
+
+FieldSet::FieldSet(const std::array<size_t, FIELD_COUNT> &sizes) : sizes(sizes)
+{
+    constexpr size_t valuesPerLine = FIELD_ALIGNMENT / sizeof(FieldStorage);
+
+    std::array<size_t, FIELD_COUNT> padded;
+    size_t total = 0;
+    for (uint32_t field = 0; field < FIELD_COUNT; field++)
+    {
+        padded[field] = (sizes[field] + valuesPerLine - 1) / valuesPerLine * valuesPerLine;
+        total += 2 * padded[field];
+    }
+
+    FieldStorage *block = static_cast<FieldStorage *>(std::aligned_alloc(FIELD_ALIGNMENT, total * sizeof(FieldStorage)));
+    if (block == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    std::memset(block, 0, total * sizeof(FieldStorage)); // all-zero bits are +0 in every storage format
+    storage.reset(block);
+
+    for (uint32_t buffer = 0; buffer < 2; buffer++)
+    {
+        for (uint32_t field = 0; field < FIELD_COUNT; field++)
+        {
+            buffers[buffer][field] = block;
+            block += padded[field];
+        }
+    }
+}
@@ -0,0 +1,98 @@
+#include "FrameGovernor.h"
+#include <algorithm>
+#include <iostream>
+
+constexpr uint32_t GOVERNOR_LEVELS = 5;
+constexpr double GOVERNOR_SMOOTHING = 0.2; // weight of the newest frame in the smoothed timings
+constexpr double SLOW_MARGIN = 1.1;        // smoothed frame time over target * this counts as slow
+constexpr double FAST_MARGIN = 0.75;       // and under target * this as fast
+constexpr uint32_t SLOW_FRAMES = 3;        // slow frames in a row before lowering quality
+constexpr uint32_t FAST_FRAMES = 30;       // fast frames in a row before raising it
+constexpr uint32_t HOLD_FRAMES = 10;       // frames after a change before the next, about twice the smoothing's memory
+constexpr double MIN_SOLVE_SHARE = 0.2;    // least part of the target a budgeted solve gets
+
+struct GovernorLevel
+{
+    bool budgeted; // the pressure solve gets the time the other stages leave
+    float solveTolerance;
+    uint32_t reinitInterval;
+    uint32_t meshInterval;
+};
+
+static const GovernorLevel governorLevels[GOVERNOR_LEVELS] = {
+    {false, 1e-6f, 1, 1},
+    {true, 1e-6f, 1, 1},
+    {true, 1e-5f, 2, 1},
+    {true, 1e-4f, 2, 2},
+    {true, 1e-4f, 4, 3},
+};
+
+FrameGovernor::FrameGovernor(double targetSeconds) : target(targetSeconds)
+{
+    applyLevel();
+}
+
+void FrameGovernor::update(const FrameTimings &timings, bool solveCut)
+{
+    if (!primed)
+    {
+        smoothed = timings;
+        primed = true;
+    }
+    else
+    {
+        auto blend = [](double &average, double sample)
+        { average += GOVERNOR_SMOOTHING * (sample - average); };
+        blend(smoothed.advect, timings.advect);
+        blend(smoothed.assemble, timings.assemble);
+        blend(smoothed.solve, timings.solve);
+        blend(smoothed.project, timings.project);
+        blend(smoothed.reinit, timings.reinit);
+        blend(smoothed.mesh, timings.mesh);
+        blend(smoothed.present, timings.present);
+    }
+
+    const double frameTime = smoothed.total();
+    slowFrames = frameTime > SLOW_MARGIN * target ? slowFrames + 1 : 0;
+    fastFrames = frameTime < FAST_MARGIN * target && !solveCut ? fastFrames + 1 : 0;
+    uint32_t next = level;
+    if (holdFrames > 0)
+    {
+        holdFrames--;
+    }
+    else if (slowFrames >= SLOW_FRAMES && level + 1 < GOVERNOR_LEVELS)
+    {
+        next = level + 1;
+    }
+    else if (fastFrames >= FAST_FRAMES && level > 0)
+    {
+        next = level - 1;
+    }
+    if (next != level)
+    {
+        std::cout << "Governor: " << frameTime * 1000.0 << " ms smoothed against a " << target * 1000.0 << " ms target, level " << level << " -> "
+                  << next << ": tolerance " << governorLevels[next].solveTolerance << ", redistance every " << governorLevels[next].reinitInterval
+                  << " steps, mesh every " << governorLevels[next].meshInterval << " frames, solve " << (governorLevels[next].budgeted ? "budgeted" : "unbudgeted")
+                  << std::endl;
+        level = next;
+        slowFrames = 0;
+        fastFrames = 0;
+        holdFrames = HOLD_FRAMES;
+    }
+    applyLevel();
+}
+
+void FrameGovernor::applyLevel()
+{
+    const GovernorLevel &settings = governorLevels[level];
+    gridEffort.solveTolerance = settings.solveTolerance;
+    gridEffort.reinitInterval = settings.reinitInterval;
+    meshInterval = settings.meshInterval;
+    gridEffort.solveBudget = 0.0;
+    if (settings.budgeted)
+    {
+        // everything but solveSOE, projection included, runs at whatever it costs and comes off the target first
+        double others = smoothed.total() - smoothed.solve;
+        gridEffort.solveBudget = std::clamp(target - others, MIN_SOLVE_SHARE * target, target);
+    }
+}
@@ -0,0 +1,123 @@
+#include "FrameWriter.h"
+#include <algorithm>
+#include <stdexcept>
+
+static bool endsWith(const std::string &value, const std::string &suffix)
+{
+    return value.size() >= suffix.size() && value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+FrameWriter::FrameWriter(const std::string &path, uint32_t width, uint32_t height, uint32_t fps) : path(path), width(width), height(height)
+{
+    if (endsWith(path, ".y4m"))
+    {
+        format = FrameFormat::Y4M;
+    }
+    else if (endsWith(path, ".rgba") || endsWith(path, ".raw"))
+    {
+        format = FrameFormat::RAW;
+    }
+    else
+    {
+        format = FrameFormat::PPM;
+    }
+
+    if (format != FrameFormat::PPM)
+    {
+        stream = std::fopen(path.c_str(), "wb");
+        if (!stream)
+        {
+            throw std::runtime_error("Could not open frame output " + path);
+        }
+        std::setvbuf(stream, nullptr, _IOFBF, 1 << 20);
+    }
+    if (format == FrameFormat::Y4M)
+    {
+        if (width % 2 != 0 || height % 2 != 0)
+        {
+            throw std::runtime_error("Y4M output needs an even frame size");
+        }
+        std::fprintf(stream, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg\n", width, height, fps);
+    }
+}
+
+FrameWriter::~FrameWriter()
+{
+    if (stream)
+    {
+        std::fclose(stream);
+    }
+}
+
+void FrameWriter::write(const uint8_t *rgba)
+{
+    size_t pixels = (size_t)width * height;
+    switch (format)
+    {
+    case FrameFormat::RAW:
+        std::fwrite(rgba, 4, pixels, stream);
+        break;
+    case FrameFormat::PPM:
+    {
+        scratch.resize(pixels * 3);
+        for (size_t p = 0; p < pixels; p++)
+        {
+            scratch[p * 3 + 0] = rgba[p * 4 + 0];
+            scratch[p * 3 + 1] = rgba[p * 4 + 1];
+            scratch[p * 3 + 2] = rgba[p * 4 + 2];
+        }
+        char suffix[32];
+        std::snprintf(suffix, sizeof(suffix), "_%06llu.ppm", (unsigned long long)framesWritten);
+        FILE *file = std::fopen((path + suffix).c_str(), "wb");
+        if (!file)
+        {
+            throw std::runtime_error("Could not open frame output " + path + suffix);
+        }
+        std::fprintf(file, "P6\n%u %u\n255\n", width, height);
+        std::fwrite(scratch.data(), 1, scratch.size(), file);
+        std::fclose(file);
+        break;
+    }
+    case FrameFormat::Y4M:
+    {
+        // full-range BT.601, chroma averaged over each 2x2 block
+        size_t chromaSize = pixels / 4;
+        scratch.resize(pixels + 2 * chromaSize);
+        uint8_t *yPlane = scratch.data();
+        uint8_t *uPlane = yPlane + pixels;
+        uint8_t *vPlane = uPlane + chromaSize;
+        for (size_t p = 0; p < pixels; p++)
+        {
+            float r = rgba[p * 4 + 0], g = rgba[p * 4 + 1], b = rgba[p * 4 + 2];
+            yPlane[p] = (uint8_t)std::clamp(0.299f * r + 0.587f * g + 0.114f * b + 0.5f, 0.0f, 255.0f);
+        }
+        for (uint32_t y = 0; y < height; y += 2)
+        {
+            for (uint32_t x = 0; x < width; x += 2)
+            {
+                float r = 0.0f, g = 0.0f, b = 0.0f;
+                for (uint32_t dy = 0; dy < 2; dy++)
+                {
+                    for (uint32_t dx = 0; dx < 2; dx++)
+                    {
+                        const uint8_t *pixel = &rgba[((size_t)(y + dy) * width + x + dx) * 4];
+                        r += pixel[0];
+                        g += pixel[1];
+                        b += pixel[2];
+                    }
+                }
+                r *= 0.25f;
+                g *= 0.25f;
+                b *= 0.25f;
+                size_t c = (size_t)(y / 2) * (width / 2) + x / 2;
+                uPlane[c] = (uint8_t)std::clamp(-0.168736f * r - 0.331264f * g + 0.5f * b + 128.5f, 0.0f, 255.0f);
+                vPlane[c] = (uint8_t)std::clamp(0.5f * r - 0.418688f * g - 0.081312f * b + 128.5f, 0.0f, 255.0f);
+            }
+        }
+        std::fputs("FRAME\n", stream);
+        std::fwrite(scratch.data(), 1, scratch.size(), stream);
+        break;
+    }
+    }
+    framesWritten++;
+}
@@ -2,18 +2,192 @@
 #include <cmath>
 #include <iostream>
 #include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <chrono>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// the checkpoint stores the simulation fields first, in FieldSet order
+static_assert((uint32_t)CHECKPOINT_PHI == FIELD_PHI && (uint32_t)CHECKPOINT_U_MINUS == FIELD_U_MINUS &&
+              (uint32_t)CHECKPOINT_V_MINUS == FIELD_V_MINUS && (uint32_t)CHECKPOINT_W_MINUS == FIELD_W_MINUS);
 
-constexpr uint32_t Nx = 10;
-constexpr uint32_t Ny = 10;
-constexpr uint32_t Nz = 10;
-constexpr uint32_t NyNz = Ny * Nz;
-constexpr float CELL_WIDTH = 10.0f / (float)Nx;
-constexpr float INV_CELL_WIDTH = 1.0f / CELL_WIDTH;
 constexpr glm::vec3 SURFACE_COLOR = {1.0f, 1.0f, 1.0f};
-constexpr glm::vec3 globalOffset = {-(Nx * CELL_WIDTH) / 2.0f, -(Ny *CELL_WIDTH) / 2.0f, -(Nz *CELL_WIDTH) / 2.0f};
 constexpr std::array<float, 4> BODY_FORCES = {0.0f, 0.0f, 0.1f, 0.0f}; // gravity
 constexpr float RHO = 1000.0f;
 constexpr uint32_t MAX_ITERATIONS = 100;
+constexpr uint32_t LANCZOS_ITERATIONS = 8;         // CG steps of a Chebyshev solve that estimate the eigenvalue bounds
+constexpr uint32_t CHEBYSHEV_CHECK_INTERVAL = 8;  // Chebyshev iterations between residual checks
+// The smallest Ritz value after LANCZOS_ITERATIONS steps is well above the smallest eigenvalue of D^-1 A, which
+// falls as 1 / n^2 with the depth of the liquid while the Ritz value does not: in the first frame of the 64^3 pool
+// it is 0.0126 against 0.00029 (found by 170 Lanczos steps). Later frames start warm, and their residual holds
+// little of the slowest modes. 0.05 gave the fewest iterations of the scales tried on the 64^3 pool, see the README,
+// and the 1 / n^2 keeps the same ratio to the smallest eigenvalue at other sizes. A scale that is off costs
+// iterations but cannot make the iteration diverge, and solveChebyshev checks that it does not.
+constexpr double CHEBYSHEV_MIN_SCALE = std::min(1.0, 0.05 * (64.0 * 64.0) / ((double)std::max({Nx, Ny, Nz}) * std::max({Nx, Ny, Nz})));
+constexpr float NARROW_BAND_WIDTH = 5.0f * CELL_WIDTH; // phi is only stored and updated this close to the surface
+constexpr uint32_t BAND_CELL_GRAIN = 256;              // band cells per parallel task
+constexpr uint32_t PHI_BLOCK_LOG2 = 2;                 // cubes along each edge of the finest min/max block
+constexpr uint32_t PHI_SUPER_BRICK_LOG2 = 2;           // surface bricks along each edge of a super-brick
+static_assert(PHI_BLOCK_LOG2 <= SURFACE_BRICK_LOG2, "min/max blocks must tile a surface brick");
+constexpr uint32_t TALL_CELL_MARGIN = 2;              // regular rows kept between the deepest band row and the tall cells
+constexpr uint32_t TALL_CELL_SLACK = BRICK_SIZE / 2;  // extra rows the level moves by, so it does not move every step
+constexpr uint32_t TALL_CELL_MIN_SPAN = 3;            // rows from top to bottom cell, at least two folded rows
+constexpr uint32_t COARSE_SIZE = BRICK_SIZE / 2;      // 2^3-cell aggregates along each edge of a coarse brick
+constexpr uint32_t COARSE_CELLS = COARSE_SIZE * COARSE_SIZE * COARSE_SIZE;
+constexpr uint32_t COARSE_TILE_SIZE = COARSE_SIZE + 2;
+constexpr uint32_t COARSE_TILE_CELLS = COARSE_TILE_SIZE * COARSE_TILE_SIZE * COARSE_TILE_SIZE;
+constexpr uint32_t FINE_BRICK_LOG2 = SURFACE_BRICK_LOG2 + 1;         // fine nodes a refined surface brick holds along each edge
+constexpr uint32_t FINE_BRICK_SIZE = 1u << FINE_BRICK_LOG2;
+constexpr uint32_t FINE_BRICK_VALUES = FINE_BRICK_SIZE * FINE_BRICK_SIZE * FINE_BRICK_SIZE;
+constexpr uint32_t FINE_TILE_SIZE = FINE_BRICK_SIZE + 1; // corners of a surface brick's fine cubes along each edge
+constexpr uint32_t NO_FINE_SLOT = UINT32_MAX;
+constexpr float FINE_BAND_WIDTH = 3.0f * CELL_WIDTH;  // fine phi is only advected and redistanced this close to the surface
+constexpr float FINE_REFINE_WIDTH = 2.0f * CELL_WIDTH; // surface bricks with a sample this close to the surface are refined
+constexpr std::array<uint32_t, 3> FINE_LAST_NODE = {2 * (Nx - 1), 2 * (Ny - 1), 2 * (Nz - 1)};
+constexpr uint32_t WINDOW_MAX_MARGIN = 8; // most cells kept between the liquid and the walls of a moving window
+constexpr uint32_t PARTICLES_PER_CELL = 8;                         // seeded into a liquid cell left with none
+constexpr uint32_t MAX_PARTICLES_PER_CELL = 2 * PARTICLES_PER_CELL; // rebin removes the rest where the flow converges
+constexpr uint32_t PARTICLE_GRAIN = 4096;                          // particles per parallel task
+constexpr float PARTICLE_DROP_PHI = CELL_WIDTH;                    // particles this far outside the liquid are removed
+constexpr float FLIP_BLEND = 0.95f;                                // share of the FLIP update in a FLIP particle's velocity
+
+enum BrickTypesState : uint8_t
+{
+    TYPES_CURRENT = 0,
+    TYPES_STALE, // a cell in the brick or its halo has changed type since the map was built
+    TYPES_UNSET, // the brick was just allocated, its map belongs to nothing
+};
+
+enum ReinitFlag : uint8_t
+{
+    REINIT_FAR = 0, // not in the band list, phi clamped to +-NARROW_BAND_WIDTH
+    REINIT_BAND,
+    REINIT_INTERFACE
+};
+
+// True if a region with these bounds can hold both water and air samples, i.e. can produce triangles
+static inline bool crossesSurface(const PhiRange &range)
+{
+    return range.min < 0.0f && range.max >= 0.0f;
+}
+
+// True if a region with these bounds can hold samples closer to the surface than width
+static inline bool nearSurface(const PhiRange &range, float width)
+{
+    return range.min < width && range.max > -width;
+}
+
+// Semi-Lagrangian back-trace of one cell: lower corner of the source cell and the trilinear weights
+struct BackTrace
+{
+    uint32_t index;
+    float i_beta, j_beta, k_beta;
+};
+
+// Distance in cells that cell (i, j, k) travels over deltaT, at the mean velocity of its faces
+static inline glm::vec3 traceDistance(const FieldSpan &u_minus, const FieldSpan &v_minus, const FieldSpan &w_minus, uint32_t i, uint32_t j, uint32_t k, float deltaT)
+{
+    uint32_t base_index = i * NyNz + j * Nz + k;
+    return {0.5f * deltaT * INV_CELL_WIDTH * (u_minus[base_index] + u_minus[base_index + NyNz]), // u_minus[i,j,k] + u_plus[i,j,k]
+            0.5f * deltaT * INV_CELL_WIDTH * (v_minus[base_index] + v_minus[base_index + Nz]),   // v_minus[i,j,k] + v_plus[i,j,k]
+            0.5f * deltaT * INV_CELL_WIDTH * (w_minus[base_index] + w_minus[base_index + 1])};   // w_minus[i,j,k] + w_plus[i,j,k]
+}
+
+static inline BackTrace traceBack(const FieldSpan &u_minus, const FieldSpan &v_minus, const FieldSpan &w_minus, uint32_t i, uint32_t j, uint32_t k, float deltaT)
+{
+    glm::vec3 distance = traceDistance(u_minus, v_minus, w_minus, i, j, k, deltaT);
+    float i_new_f = std::clamp((float)i - distance.x, 1.0f, (float)(Nx - 2));
+    float j_new_f = std::clamp((float)j - distance.y, 1.0f, (float)(Ny - 2));
+    float k_new_f = std::clamp((float)k - distance.z, 1.0f, (float)(Nz - 2));
+
+    uint32_t i_new = static_cast<uint32_t>(i_new_f);
+    uint32_t j_new = static_cast<uint32_t>(j_new_f);
+    uint32_t k_new = static_cast<uint32_t>(k_new_f);
+
+    return {i_new * NyNz + j_new * Nz + k_new, i_new_f - (float)i_new, j_new_f - (float)j_new, k_new_f - (float)k_new};
+}
+
+// Aggregates of a coarse brick use the first COARSE_CELLS slots of each channel, laid out like brickCell
+static inline uint32_t coarseCell(uint32_t ci, uint32_t cj, uint32_t ck) { return (ci * COARSE_SIZE + cj) * COARSE_SIZE + ck; }
+static inline uint32_t coarseTileCell(uint32_t ti, uint32_t tj, uint32_t tk) { return (ti * COARSE_TILE_SIZE + tj) * COARSE_TILE_SIZE + tk; }
+
+// Fine node (li, lj, lk) of a refined brick's block, k fastest like the grid
+static inline uint32_t fineCell(uint32_t li, uint32_t lj, uint32_t lk) { return (li * FINE_BRICK_SIZE + lj) * FINE_BRICK_SIZE + lk; }
+
+// The samples of phi interpolated at fine node (I, J, K), which lies at sample (I / 2, J / 2, K / 2). Even nodes
+// take their sample's value exactly.
+static inline float interpolateCoarse(const FieldSpan &phi, uint32_t I, uint32_t J, uint32_t K)
+{
+    const size_t index = (size_t)(I >> 1) * NyNz + (J >> 1) * Nz + (K >> 1);
+    const uint32_t di = (I & 1) * NyNz, dj = (J & 1) * Nz, dk = K & 1;
+    return 0.125f * (((phi[index] + phi[index + di]) + (phi[index + dj] + phi[index + di + dj])) +
+                     ((phi[index + dk] + phi[index + di + dk]) + (phi[index + dj + dk] + phi[index + di + dj + dk])));
+}
+
+static inline float sampleTrilinear(const FieldSpan &vals, const BackTrace &trace)
+{
+    uint32_t dest_index = trace.index;
+    float i_alpha = 1.0f - trace.i_beta;
+    float j_alpha = 1.0f - trace.j_beta;
+    float k_alpha = 1.0f - trace.k_beta;
+
+    float param_i0 = (i_alpha * vals[dest_index]) + (trace.i_beta * vals[dest_index + NyNz]);                   // i,j,k <-> i+1,j,k
+    float param_i1 = (i_alpha * vals[dest_index + Nz]) + (trace.i_beta * vals[dest_index + NyNz + Nz]);         // i,j+1,k <-> i+1,j+1,k
+    float param_i2 = (i_alpha * vals[dest_index + 1]) + (trace.i_beta * vals[dest_index + NyNz + 1]);           // i,j,k+1 <-> i+1,j,k+1
+    float param_i3 = (i_alpha * vals[dest_index + Nz + 1]) + (trace.i_beta * vals[dest_index + NyNz + Nz + 1]); // i,j+1,k+1 <-> i+1,j+1,k+1
+
+    float param_ij0 = (j_alpha * param_i0) + (trace.j_beta * param_i1);
+    float param_ij1 = (j_alpha * param_i2) + (trace.j_beta * param_i3);
+
+    return (k_alpha * param_ij0) + (trace.k_beta * param_ij1);
+}
+
+// Lattice cell of a particle and its trilinear weights, clamped like a back-trace
+static inline BackTrace locate(float x, float y, float z)
+{
+    float i_f = std::clamp(x, 1.0f, (float)(Nx - 2));
+    float j_f = std::clamp(y, 1.0f, (float)(Ny - 2));
+    float k_f = std::clamp(z, 1.0f, (float)(Nz - 2));
+
+    uint32_t i = static_cast<uint32_t>(i_f);
+    uint32_t j = static_cast<uint32_t>(j_f);
+    uint32_t k = static_cast<uint32_t>(k_f);
+
+    return {i * NyNz + j * Nz + k, i_f - (float)i, j_f - (float)j, k_f - (float)k};
+}
+
+// Trilinear sample and its gradient in cells, the affine velocity of an APIC particle
+static inline float sampleGradient(const FieldSpan &vals, const BackTrace &trace, float *gradient)
+{
+    const uint32_t index = trace.index;
+    const float c000 = vals[index], c100 = vals[index + NyNz], c010 = vals[index + Nz], c110 = vals[index + NyNz + Nz];
+    const float c001 = vals[index + 1], c101 = vals[index + NyNz + 1], c011 = vals[index + Nz + 1], c111 = vals[index + NyNz + Nz + 1];
+    const float i_alpha = 1.0f - trace.i_beta;
+    const float j_alpha = 1.0f - trace.j_beta;
+    const float k_alpha = 1.0f - trace.k_beta;
+
+    gradient[0] = k_alpha * (j_alpha * (c100 - c000) + trace.j_beta * (c110 - c010)) + trace.k_beta * (j_alpha * (c101 - c001) + trace.j_beta * (c111 - c011));
+    gradient[1] = k_alpha * (i_alpha * (c010 - c000) + trace.i_beta * (c110 - c100)) + trace.k_beta * (i_alpha * (c011 - c001) + trace.i_beta * (c111 - c101));
+    gradient[2] = j_alpha * (i_alpha * (c001 - c000) + trace.i_beta * (c101 - c100)) + trace.j_beta * (i_alpha * (c011 - c010) + trace.i_beta * (c111 - c110));
+    return sampleTrilinear(vals, trace);
+}
+
+// Jitter in [0, 1) for seeding, a hash rather than a generator so seeds do not depend on how slabs were split up
+static inline float seedJitter(uint32_t cell, uint32_t salt)
+{
+    uint32_t h = cell * 0x9E3779B1u ^ (salt + 0x7F4A7C15u) * 0x85EBCA77u;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+    h *= 0x297A2D39u;
+    h ^= h >> 15;
+    return (float)(h >> 8) * (1.0f / 16777216.0f);
+}
 
 #define Triple std::array<uint32_t, 3>
 #define MarchingCube std::vector<Triple>
@@ -277,31 +451,107 @@ const MarchingCube marchingCubeLookup[256] = {
     {}                                                // 255
 };
 
-Grid::Grid()
+// Edges referenced by each case's triangles; only these are interpolated
+static const std::array<uint16_t, 256> marchingCubeEdges = []
+{
+    std::array<uint16_t, 256> edges{};
+    for (uint32_t mask = 0; mask < 256; mask++)
+    {
+        for (const Triple &triangle : marchingCubeLookup[mask])
+        {
+            for (uint32_t edge : triangle)
+            {
+                edges[mask] |= 1u << edge;
+            }
+        }
+    }
+    return edges;
+}();
+
+// Corners joined by each cube edge, lower corner first. Corner bit 0 steps i, bit 1 j and bit 2 k.
+constexpr std::array<std::array<uint8_t, 2>, 12> EDGE_CORNERS = {{{0, 1}, {0, 2}, {1, 3}, {2, 3}, {0, 4}, {1, 5}, {2, 6}, {3, 7}, {4, 5}, {4, 6}, {5, 7}, {6, 7}}};
+
+// Bit n is set if values[n] < 0, for up to 32 consecutive values
+static inline uint32_t signMask(const float *values, uint32_t count)
+{
+    uint32_t mask = 0;
+    uint32_t n = 0;
+#if defined(__AVX__)
+    for (; n + 8 <= count; n += 8)
+    {
+        mask |= (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(values + n), _mm256_setzero_ps(), _CMP_LT_OQ)) << n;
+    }
+#endif
+#if defined(__SSE2__)
+    for (; n + 4 <= count; n += 4)
+    {
+        mask |= (uint32_t)_mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(values + n), _mm_setzero_ps())) << n;
+    }
+#elif defined(__aarch64__)
+    const uint32x4_t weights = {1, 2, 4, 8};
+    for (; n + 4 <= count; n += 4)
+    {
+        mask |= vaddvq_u32(vandq_u32(vcltq_f32(vld1q_f32(values + n), vdupq_n_f32(0.0f)), weights)) << n;
+    }
+#endif
+    for (; n < count; n++)
+    {
+        mask |= (uint32_t)(values[n] < 0.0f) << n;
+    }
+    return mask;
+}
+
+// Bit n is set if phi[first + n] < 0, for up to 32 consecutive samples
+static inline uint32_t signMask(const FieldSpan &phi, size_t first, uint32_t count)
 {
-    for (uint32_t storage_idx = 0; storage_idx < 2; storage_idx++)
+#if !defined(FIELD_STORAGE_FP16) && !defined(FIELD_STORAGE_BF16)
+    return signMask(phi.data() + first, count);
+#else
+    uint32_t mask = 0;
+    for (uint32_t n = 0; n < count; n++)
     {
-        phi_arrays[storage_idx].resize(Nx * Ny * Nz);
-        u_minus_arrays[storage_idx].resize((Nx + 1) * Ny * Nz);
-        v_minus_arrays[storage_idx].resize(Nx * (Ny + 1) * Nz);
-        w_minus_arrays[storage_idx].resize(Nx * Ny * (Nz + 1));
+        mask |= (uint32_t)(phi[first + n] < 0.0f) << n;
     }
-    Adiag.resize(Nx * Ny * Nz);
-    AplusI.resize(Nx * Ny * Nz);
-    AplusJ.resize(Nx * Ny * Nz);
-    AplusK.resize(Nx * Ny * Nz);
-    D.resize(Nx * Ny * Nz);
-    pressures.resize(Nx * Ny * Nz);
+    return mask;
+#endif
+}
 
-    // solver:
-    residuals.resize(Nx * Ny * Nz);
-    conjugates.resize(Nx * Ny * Nz);
+Grid::Grid(const GridOptions &options) : options(options),
+                                        fields({Nx * Ny * Nz, (Nx + 1) * Ny * Nz, Nx * (Ny + 1) * Nz, Nx * Ny * (Nz + 1)}),
+                                        solver(Nx, Ny, Nz, options.pressureSolver == PRESSURE_CHEBYSHEV ? SOLVER_CHANNEL_COUNT : SOLVER_INV_DIAGONAL),
+                                        particles(options.particles == TRANSFER_APIC ? PARTICLE_CHANNEL_COUNT : PARTICLE_AFFINE, options.particles != TRANSFER_NONE ? Nx : 0, NyNz),
+                                        threadPool(options.threads > 0 ? options.threads : std::thread::hardware_concurrency())
+{
+    if (options.movingWindow && options.poolDepth > 0.0f)
+    {
+        throw std::runtime_error("A moving window cannot follow a pool, its water rests on the walls");
+    }
+    effort.solveBudget = options.solveBudget;
+    brickTouched.resize((size_t)solver.bricksX() * solver.bricksY() * solver.bricksZ(), 0);
+    surfaceBricks[0] = (Nx - 1 + SURFACE_BRICK_SIZE - 1) / SURFACE_BRICK_SIZE;
+    surfaceBricks[1] = (Ny - 1 + SURFACE_BRICK_SIZE - 1) / SURFACE_BRICK_SIZE;
+    surfaceBricks[2] = (Nz - 1 + SURFACE_BRICK_SIZE - 1) / SURFACE_BRICK_SIZE;
+    surfaceTouched.resize((size_t)surfaceBricks[0] * surfaceBricks[1] * surfaceBricks[2], 0);
+    phiBlocks[0] = (Nx - 1 + (1u << PHI_BLOCK_LOG2) - 1) >> PHI_BLOCK_LOG2;
+    phiBlocks[1] = (Ny - 1 + (1u << PHI_BLOCK_LOG2) - 1) >> PHI_BLOCK_LOG2;
+    phiBlocks[2] = (Nz - 1 + (1u << PHI_BLOCK_LOG2) - 1) >> PHI_BLOCK_LOG2;
+    phiSuperBricks[0] = (surfaceBricks[0] + (1u << PHI_SUPER_BRICK_LOG2) - 1) >> PHI_SUPER_BRICK_LOG2;
+    phiSuperBricks[1] = (surfaceBricks[1] + (1u << PHI_SUPER_BRICK_LOG2) - 1) >> PHI_SUPER_BRICK_LOG2;
+    phiSuperBricks[2] = (surfaceBricks[2] + (1u << PHI_SUPER_BRICK_LOG2) - 1) >> PHI_SUPER_BRICK_LOG2;
+    blockRanges.resize((size_t)phiBlocks[0] * phiBlocks[1] * phiBlocks[2]);
+    brickRanges.resize(surfaceTouched.size());
+    superBrickRanges.resize((size_t)phiSuperBricks[0] * phiSuperBricks[1] * phiSuperBricks[2]);
+    reinitFlags.resize(Nx * Ny * Nz, REINIT_FAR);
+    if (options.particles != TRANSFER_NONE) // seeded by the first advect
+    {
+        slabSeeds.resize(Nx);
+        transferNodes.resize(Nx * NyNz);
+    }
 
     // add sphere
     float radius = 3.0f;
     float sphereHeight = 5.0f;
     glm::vec3 center = {0.0f, 5.0f - sphereHeight, 0.0f};
-    float poolHeight = 2.0f;
     uint32_t index = 0;
     for (uint32_t i = 0; i < Nx; i++)
     {
@@ -311,665 +561,3680 @@ Grid::Grid()
             {
                 glm::vec3 position = getPosition(i, j, k);
                 float distance = std::sqrt((position.x - center.x) * (position.x - center.x) + (position.y - center.y) * (position.y - center.y) + (position.z - center.z) * (position.z - center.z)) - radius;
-                // float distance2 = (10.0f - poolHeight) - j * CELL_WIDTH;
-                float distance2 = distance;
+                if (options.poolDepth > 0.0f) // union with the pool, +j is down
+                {
+                    distance = std::min(distance, (Ny * CELL_WIDTH - options.poolDepth) - j * CELL_WIDTH);
+                }
 
-                phi_arrays[oldStorage][index] = std::abs(distance) < std::abs(distance2) ? distance : distance2;
-                phi_arrays[newStorage][index] = std::abs(distance) < std::abs(distance2) ? distance : distance2;
+                fields.previous(FIELD_PHI)[index] = distance;
+                fields.current(FIELD_PHI)[index] = distance;
 
                 index += 1;
             }
         }
     }
+    resetBand();
+    updateSolverBricks(true);
+    if (options.refineSurface)
+    {
+        updateFineBricks(true);
+    }
 }
 
 inline glm::vec3 Grid::getPosition(uint32_t x_i, uint32_t y_i, uint32_t z_i)
 {
-    return glm::vec3((float)x_i * CELL_WIDTH, (float)y_i * CELL_WIDTH, (float)z_i * CELL_WIDTH) + globalOffset;
+    return glm::vec3((float)((int32_t)x_i + windowOrigin[0]) * CELL_WIDTH, (float)((int32_t)y_i + windowOrigin[1]) * CELL_WIDTH,
+                     (float)((int32_t)z_i + windowOrigin[2]) * CELL_WIDTH) +
+           globalOffset;
 }
 
-void Grid::advect(float deltaT)
+void Grid::beginStep(float deltaT)
 {
-    flipStorage();
-    const std::vector<float> &phi_old = phi_arrays[oldStorage];
-    const std::vector<float> &u_minus_old = u_minus_arrays[oldStorage];
-    const std::vector<float> &v_minus_old = v_minus_arrays[oldStorage];
-    const std::vector<float> &w_minus_old = w_minus_arrays[oldStorage];
-
-    std::vector<float> &phi_new = phi_arrays[newStorage];
-    std::vector<float> &u_minus_new = u_minus_arrays[newStorage];
-    std::vector<float> &v_minus_new = v_minus_arrays[newStorage];
-    std::vector<float> &w_minus_new = w_minus_arrays[newStorage];
-
-    std::array<const std::vector<float> *, 4> parameters_old = {
-        &phi_old,
-        &u_minus_old,
-        &v_minus_old,
-        &w_minus_old};
-
-    std::array<std::vector<float> *, 4> parameters_new = {
-        &phi_new,
-        &u_minus_new,
-        &v_minus_new,
-        &w_minus_new};
-
-    // advect phi and velocity for each non-solid cell (exclude i/j/k == 0 or N)
-    for (uint32_t i = 1; i < Nx - 1; i++)
+    if (options.movingWindow)
     {
-        for (uint32_t j = 1; j < Ny - 1; j++)
-        {
-            for (uint32_t k = 1; k < Nz - 1; k++)
-            {
-                uint32_t base_index = i * NyNz + j * Nz + k;
-
-                // get distance (# of cells) traversed using current velocities
-                float x = 0.5f * deltaT * INV_CELL_WIDTH * (u_minus_old[base_index] + u_minus_old[base_index + NyNz]); // u_minus[i,j,k] + u_plus[i,j,k]
-                float y = 0.5f * deltaT * INV_CELL_WIDTH * (v_minus_old[base_index] + v_minus_old[base_index + Nz]);   // v_minus[i,j,k] + v_plus[i,j,k]
-                float z = 0.5f * deltaT * INV_CELL_WIDTH * (w_minus_old[base_index] + w_minus_old[base_index + 1]);    // w_minus[i,j,k] + w_plus[i,j,k]
-
-                float i_new_f = std::clamp((float)i - x, 1.0f, (float)(Nx - 2));
-                float j_new_f = std::clamp((float)j - y, 1.0f, (float)(Ny - 2));
-                float k_new_f = std::clamp((float)k - z, 1.0f, (float)(Nz - 2));
-
-                uint32_t i_new = static_cast<uint32_t>(i_new_f);
-                uint32_t j_new = static_cast<uint32_t>(j_new_f);
-                uint32_t k_new = static_cast<uint32_t>(k_new_f);
-
-                uint32_t dest_index = i_new * NyNz + j_new * Nz + k_new;
-
-                float i_beta = i_new_f - (float)i_new; // 5.2362 -> 0.2362
-                float j_beta = j_new_f - (float)j_new;
-                float k_beta = k_new_f - (float)k_new;
-
-                float i_alpha = 1.0f - i_beta;
-                float j_alpha = 1.0f - j_beta;
-                float k_alpha = 1.0f - k_beta;
-
-                // trilinear interpolation
-                for (uint32_t param_idx = 0; param_idx < 4; param_idx++)
-                {
-                    const std::vector<float> &vals = *parameters_old[param_idx];
-                    float param_i0 = (i_alpha * vals[dest_index]) + (i_beta * vals[dest_index + NyNz]);                   // i,j,k <-> i+1,j,k
-                    float param_i1 = (i_alpha * vals[dest_index + Nz]) + (i_beta * vals[dest_index + NyNz + Nz]);         // i,j+1,k <-> i+1,j+1,k
-                    float param_i2 = (i_alpha * vals[dest_index + 1]) + (i_beta * vals[dest_index + NyNz + 1]);           // i,j,k+1 <-> i+1,j,k+1
-                    float param_i3 = (i_alpha * vals[dest_index + Nz + 1]) + (i_beta * vals[dest_index + NyNz + Nz + 1]); // i,j+1,k+1 <-> i+1,j+1,k+1
-
-                    float param_ij0 = (j_alpha * param_i0) + (j_beta * param_i1);
-                    float param_ij1 = (j_alpha * param_i2) + (j_beta * param_i3);
-
-                    float interp_val = (k_alpha * param_ij0) + (k_beta * param_ij1);
-
-                    (*parameters_new[param_idx])[base_index] = interp_val + (BODY_FORCES[param_idx] * deltaT);
-                }
-            }
-        }
+        updateWindow();
     }
+    flipStorage();
+    fineCurrent ^= 1;
+    simTime += deltaT;
+    frame++;
 }
 
-void Grid::updateSOE(float deltaT)
+void Grid::advect(float deltaT)
 {
-    const std::vector<float> &phi = phi_arrays[newStorage];
-    const std::vector<float> &u_minus = u_minus_arrays[newStorage];
-    const std::vector<float> &v_minus = v_minus_arrays[newStorage];
-    const std::vector<float> &w_minus = w_minus_arrays[newStorage];
-
-    const float CONST_FACTOR = RHO * CELL_WIDTH / deltaT;
+    beginStep(deltaT);
 
-    for (uint32_t i = 1; i < Nx - 1; i++)
+    // phi only inside the band, cells outside keep their clamped value in both buffers
+    threadPool.parallelFor((uint32_t)bandCells.size(), BAND_CELL_GRAIN, [&](uint32_t begin, uint32_t end)
+                           { advectPhi(begin, end, deltaT); });
+    if (options.refineSurface)
     {
-        for (uint32_t j = 1; j < Ny - 1; j++)
-        {
-            for (uint32_t k = 1; k < Nz - 1; k++)
-            {
-                uint32_t base_index = i * NyNz + j * Nz + k;
-                if (phi[base_index] >= 0.0f) // only care about fluid cells
-                {
-                    Adiag[base_index] = 0;
-                    D[base_index] = 0.0f;
-                    continue;
-                }
-
-                uint32_t nonSolidNeighbors = 0;
-                float d = 0.0f;
-
-                // left neighbor
-                if (i != 1) // left neighbor is not SOLID
-                {
-                    nonSolidNeighbors++;
-                    uint32_t leftNeighbor = base_index - NyNz;
-                    d -= u_minus[base_index];
-                    AplusI[leftNeighbor] = phi[leftNeighbor] < 0.0f ? -1 : 0; // A(i,j,k)(i-1,j,k) = A(i-1,j,k)(i,j,k) so AplusI(i-1,j,k)
-                }
-                // right neighbor
-                if (i != Nx - 2) // right neighbor is not SOLID
-                {
-                    nonSolidNeighbors++;
-                    uint32_t rightNeighbor = base_index + NyNz;
-                    d += u_minus[rightNeighbor];
-                    AplusI[base_index] = phi[rightNeighbor] < 0.0f ? -1 : 0; // A(i,j,k)(i+1,j,k) so AplusI(i,j,k)
-                }
-                // top neighbor
-                if (j != 1) // top neighbor is not SOLID
-                {
-                    nonSolidNeighbors++;
-                    uint32_t topNeighbor = base_index - Nz;
-                    d -= v_minus[base_index];
-                    AplusJ[topNeighbor] = phi[topNeighbor] < 0.0f ? -1 : 0; // A(i,j,k)(i,j-1,k) = A(i,j-1,k)(i,j,k) so AplusJ(i,j-1,k)
-                }
-                // bottom neighbor
-                if (j != Ny - 2) // bottom neighbor is not SOLID
-                {
-                    nonSolidNeighbors++;
-                    uint32_t bottomNeighbor = base_index + Nz;
-                    d += v_minus[bottomNeighbor];
-                    AplusJ[base_index] = phi[bottomNeighbor] < 0.0f ? -1 : 0; // A(i,j,k)(i,j+1,k) so AplusJ(i,j,k)
-                }
-                // front neighbor
-                if (k != 1) // front neighbor is not SOLID
-                {
-                    nonSolidNeighbors++;
-                    uint32_t frontNeighbor = base_index - 1;
-                    d -= w_minus[base_index];
-                    AplusK[frontNeighbor] = phi[frontNeighbor] < 0.0f ? -1 : 0; // A(i,j,k)(i,j,k-1) = A(i,j,k-1)(i,j,k) so AplusK(i,j,k-1)
-                }
-                // back neighbor
-                if (k != Nz - 2) // back neighbor is not SOLID
-                {
-                    nonSolidNeighbors++;
-                    uint32_t backNeighbor = base_index + 1;
-                    d += w_minus[backNeighbor];
-                    AplusK[base_index] = phi[backNeighbor] < 0.0f ? -1 : 0; // A(i,j,k)(i,j,k+1) so AplusK(i,j,k)
-                }
-
-                Adiag[base_index] = nonSolidNeighbors;
-                D[base_index] = -CONST_FACTOR * d;
-            }
-        }
+        advectFine(deltaT);
     }
-}
-
-void Grid::solveSOE()
-{
-    // Conjugate Gradient Algorithm
-    uint32_t iterations = 0;
-    float r_dot_r = 0.0f;
 
-    std::vector<float> tmp0 = std::vector<float>(Nx * Ny * Nz);
-
-    mulA(pressures, tmp0);
-    sumC(D, tmp0, -1.0f, residuals); // r = D - A*pressure
-
-    r_dot_r = dot(residuals, residuals); // r_dot_r = r*r
-    conjugates = residuals;              // p = r
-    std::cout << "(" << iterations << ") R^2 = " << r_dot_r << std::endl;
-
-    while ((r_dot_r / (Nx * NyNz) > 1e-6) && iterations < MAX_ITERATIONS)
+    // particles are moved against the new phi, which decides the ones that left the liquid
+    const TransferNode *transfer = nullptr;
+    if (options.particles != TRANSFER_NONE)
     {
-        mulA(conjugates, tmp0); // tmp0 = A*p
-
-        float alpha = r_dot_r / dot(conjugates, tmp0); // alpha = r*r / (p*A*p)
-
-        sumC(pressures, conjugates, alpha, pressures); // pressure += alpha*p
-        sumC(residuals, tmp0, -alpha, residuals);      // r -= alpha*Ap
-
-        float new_r_dot_r = dot(residuals, residuals);
-        float beta = new_r_dot_r / r_dot_r;
-        r_dot_r = new_r_dot_r;
-
-        sumC(residuals, conjugates, beta, conjugates);
-
-        iterations++;
-        std::cout << "(" << iterations << ") R^2/cell = " << r_dot_r / (Nx * NyNz) << std::endl;
+        transferParticles(deltaT);
+        transfer = transferNodes.data();
     }
 
-    float max_p = 0.0f;
-    for (uint32_t idx = 0; idx < Nx * NyNz; idx++)
-    {
-        if (pressures[idx] > max_p)
+    // velocities are advected for each non-solid cell (exclude i/j/k == 0 or N), the pressure solve needs them
+    // throughout the liquid. Nodes particles were splatted on take their average instead.
+    threadPool.parallelFor(Nx - 2, 1, [&](uint32_t begin, uint32_t end)
+                           {
+        for (uint32_t i = begin + 1; i < end + 1; i++)
         {
-            max_p = pressures[idx];
-        }
+            advectVelocitySlab(i, deltaT, transfer);
+        } });
+    fillTallVelocities();
+
+    // project also moves the faces on the far walls, which nothing advects. FLIP takes the change it makes from the
+    // pressures, so those faces have to start each step where the last one started rather than build up.
+    if (options.particles == TRANSFER_FLIP)
+    {
+        carryWallFaces();
     }
 }
 
-void Grid::mulA(const std::vector<float> &x, std::vector<float> &result)
+// Seeds, moves and splats the particles, between advecting phi and the velocities
+void Grid::transferParticles(float deltaT)
 {
-    const std::vector<float> &phi = phi_arrays[newStorage];
-    for (uint32_t i = 1; i < Nx - 1; i++)
-    {
-        for (uint32_t j = 1; j < Ny - 1; j++)
-        {
-            for (uint32_t k = 1; k < Nz - 1; k++)
-            {
-                uint32_t base_index = i * NyNz + j * Nz + k;
-                if (phi[base_index] > 0.0f) // row in A matrix is all zeros if non-fluid
-                {
-                    result[base_index] = 0.0f;
-                    continue;
-                }
-                float val = 0.0f;
-                val += Adiag[base_index] * x[base_index];
-                val += AplusI[base_index] * x[base_index + NyNz];
-                val += AplusJ[base_index] * x[base_index + Nz];
-                val += AplusK[base_index] * x[base_index + 1];
-                val += AplusI[base_index - NyNz] * x[base_index - NyNz];
-                val += AplusJ[base_index - Nz] * x[base_index - Nz];
-                val += AplusK[base_index - 1] * x[base_index - 1];
-                if (std::isnan(val) || std::isinf(val) || std::isinf(-val))
-                {
-                    std::cout << "i,j,k: " << i << ", " << j << ", " << k << std::endl;
-                    std::cout << "x[base]: " << x[base_index] << std::endl;
-                    std::cout << "x[base + i]: " << x[base_index + NyNz] << std::endl;
-                    std::cout << "x[base + j]: " << x[base_index + Nz] << std::endl;
-                    std::cout << "x[base + k]: " << x[base_index + 1] << std::endl;
-                    std::cout << "x[base - i]: " << x[base_index - NyNz] << std::endl;
-                    std::cout << "x[base - j]: " << x[base_index - Nz] << std::endl;
-                    std::cout << "x[base - k]: " << x[base_index - 1] << std::endl;
-                    std::cout << "result: " << val << std::endl;
-                    std::abort();
-                }
-                result[base_index] = val;
-            }
-        }
-    }
+    auto start = std::chrono::steady_clock::now();
+    seedParticles();
+    moveParticles(deltaT);
+    splatParticles();
+    particleSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 }
 
-void Grid::sumC(const std::vector<float> &a, const std::vector<float> &b, float C, std::vector<float> &result)
+// Copies the faces on the i/j/k == N - 1 walls of the velocities into the previous buffers, a plane per axis
+void Grid::carryWallFaces()
 {
-    float sum = 0.0f;
-    for (uint32_t i = 0; i < Nx; i++)
+    for (uint32_t field = FIELD_U_MINUS; field <= FIELD_W_MINUS; field++)
     {
-        for (uint32_t j = 0; j < Ny; j++)
+        const FieldStorage *current = fields.current((FieldId)field).data();
+        FieldStorage *previous = fields.previous((FieldId)field).data();
+        std::copy_n(current + (Nx - 1) * NyNz, NyNz, previous + (Nx - 1) * NyNz);
+        for (uint32_t i = 0; i < Nx - 1; i++)
         {
-            for (uint32_t k = 0; k < Nz; k++)
+            std::copy_n(current + i * NyNz + (Ny - 1) * Nz, Nz, previous + i * NyNz + (Ny - 1) * Nz);
+            for (uint32_t j = 0; j < Ny - 1; j++)
             {
-                uint32_t base_index = i * NyNz + j * Nz + k;
-                result[base_index] = a[base_index] + b[base_index] * C;
-                sum += result[base_index];
-                // if (std::isnan(result[base_index]))
-                // {
-                //     std::cout << "{" << i << ", " << j << ", " << k << "}: " << a[base_index] << std::endl;
-                // }
+                previous[i * NyNz + j * Nz + Nz - 1] = current[i * NyNz + j * Nz + Nz - 1];
             }
         }
     }
-    // std::cout << "DEBUG SUMC: " << sum << std::endl;
 }
 
-float Grid::dot(const std::vector<float> &a, const std::vector<float> &b)
+// Band cells [begin, end) of phi
+void Grid::advectPhi(uint32_t begin, uint32_t end, float deltaT)
 {
-    float tmpResult = 0.0f;
-    for (uint32_t i = 0; i < Nx; i++)
+    const FieldSpan phi_old = fields.previous(FIELD_PHI);
+    const FieldSpan u_minus_old = fields.previous(FIELD_U_MINUS);
+    const FieldSpan v_minus_old = fields.previous(FIELD_V_MINUS);
+    const FieldSpan w_minus_old = fields.previous(FIELD_W_MINUS);
+    const FieldSpan phi_new = fields.current(FIELD_PHI);
+    for (uint32_t n = begin; n < end; n++)
     {
-        for (uint32_t j = 0; j < Ny; j++)
-        {
-            for (uint32_t k = 0; k < Nz; k++)
-            {
-                uint32_t base_index = i * NyNz + j * Nz + k;
-                tmpResult += a[base_index] * b[base_index];
-            }
-        }
+        uint32_t base_index = bandCells[n];
+        uint32_t i = base_index / NyNz;
+        uint32_t j = (base_index / Nz) % Ny;
+        uint32_t k = base_index % Nz;
+        BackTrace trace = traceBack(u_minus_old, v_minus_old, w_minus_old, i, j, k, deltaT);
+        phi_new[base_index] = std::clamp(sampleTrilinear(phi_old, trace) + (BODY_FORCES[FIELD_PHI] * deltaT), -NARROW_BAND_WIDTH, NARROW_BAND_WIDTH);
     }
-    return tmpResult;
 }
 
-void Grid::project(float deltaT)
+// Velocities of the interior cells of slab i, reading the previous buffers only
+void Grid::advectVelocitySlab(uint32_t i, float deltaT, const TransferNode *transfer)
 {
-    std::vector<float> &phi = phi_arrays[newStorage];
-    std::vector<float> &u_minus_new = u_minus_arrays[newStorage];
-    std::vector<float> &v_minus_new = v_minus_arrays[newStorage];
-    std::vector<float> &w_minus_new = w_minus_arrays[newStorage];
-
-    float CONST_FACTOR = deltaT / (RHO * CELL_WIDTH);
-    for (uint32_t i = 1; i < Nx; i++)
+    const FieldSpan u_minus_old = fields.previous(FIELD_U_MINUS);
+    const FieldSpan v_minus_old = fields.previous(FIELD_V_MINUS);
+    const FieldSpan w_minus_old = fields.previous(FIELD_W_MINUS);
+    const FieldSpan u_minus_new = fields.current(FIELD_U_MINUS);
+    const FieldSpan v_minus_new = fields.current(FIELD_V_MINUS);
+    const FieldSpan w_minus_new = fields.current(FIELD_W_MINUS);
+    for (uint32_t j = 1; j < Ny - 1; j++)
     {
-        for (uint32_t j = 1; j < Ny; j++)
+        if (j > tallTop + 1 && j < tallBottom) // interpolated by fillTallVelocities
+        {
+            continue;
+        }
+        for (uint32_t k = 1; k < Nz - 1; k++)
         {
-            for (uint32_t k = 1; k < Nz; k++)
+            uint32_t base_index = i * NyNz + j * Nz + k;
+            if (transfer != nullptr && transfer[base_index].weight > 0.0f)
             {
-                uint32_t base_index = i * NyNz + j * Nz + k;
-
-                u_minus_new[base_index] -= CONST_FACTOR * (pressures[base_index] - pressures[base_index - NyNz]);
-                v_minus_new[base_index] -= CONST_FACTOR * (pressures[base_index] - pressures[base_index - Nz]);
-                w_minus_new[base_index] -= CONST_FACTOR * (pressures[base_index] - pressures[base_index - 1]);
+                const TransferNode &node = transfer[base_index];
+                float inverse = 1.0f / node.weight;
+                u_minus_new[base_index] = node.momentum[0] * inverse + (BODY_FORCES[FIELD_U_MINUS] * deltaT);
+                v_minus_new[base_index] = node.momentum[1] * inverse + (BODY_FORCES[FIELD_V_MINUS] * deltaT);
+                w_minus_new[base_index] = node.momentum[2] * inverse + (BODY_FORCES[FIELD_W_MINUS] * deltaT);
+                continue;
             }
+            BackTrace trace = traceBack(u_minus_old, v_minus_old, w_minus_old, i, j, k, deltaT);
+            u_minus_new[base_index] = sampleTrilinear(u_minus_old, trace) + (BODY_FORCES[FIELD_U_MINUS] * deltaT);
+            v_minus_new[base_index] = sampleTrilinear(v_minus_old, trace) + (BODY_FORCES[FIELD_V_MINUS] * deltaT);
+            w_minus_new[base_index] = sampleTrilinear(w_minus_old, trace) + (BODY_FORCES[FIELD_W_MINUS] * deltaT);
         }
     }
 }
 
-void Grid::smoothSurface()
+// Seeds PARTICLES_PER_CELL jittered particles in each liquid cell the last rebin left empty, moving with the grid
+// velocity there. Cells are counted per slab first, so every slab writes its own range of the new particles.
+void Grid::seedParticles()
 {
-    flipStorage();
+    const FieldSpan phi = fields.previous(FIELD_PHI);
+    const std::array<FieldSpan, 3> velocities = {fields.previous(FIELD_U_MINUS), fields.previous(FIELD_V_MINUS), fields.previous(FIELD_W_MINUS)};
+    const uint32_t affineChannels = particles.channels() - PARTICLE_AFFINE;
 
-    std::vector<float> &phi_old = phi_arrays[oldStorage];
-    std::vector<float> &u_minus_old = u_minus_arrays[oldStorage];
-    std::vector<float> &v_minus_old = v_minus_arrays[oldStorage];
-    std::vector<float> &w_minus_old = w_minus_arrays[oldStorage];
-
-    std::vector<float> &phi_new = phi_arrays[newStorage];
-    std::vector<float> &u_minus_new = u_minus_arrays[newStorage];
-    std::vector<float> &v_minus_new = v_minus_arrays[newStorage];
-    std::vector<float> &w_minus_new = w_minus_arrays[newStorage];
-
-    std::array<float, 6> neighbor_phis;
-    for (uint32_t i = 1; i < Nx - 1; i++)
+    // cells whose lattice box is inside [1, N - 2], the part of the grid particles are clamped to
+    auto needsSeeds = [&](uint32_t i, uint32_t j, uint32_t k)
     {
-        for (uint32_t j = 1; j < Ny - 1; j++)
+        uint32_t cell = i * NyNz + j * Nz + k;
+        if (particles.cellStart(cell) != particles.cellStart(cell + 1) || (j > tallTop + 1 && j < tallBottom))
         {
-            for (uint32_t k = 1; k < Nz - 1; k++)
+            return false;
+        }
+        return sampleTrilinear(phi, {cell, 0.5f, 0.5f, 0.5f}) < 0.0f;
+    };
+    threadPool.parallelFor(Nx - 3, 1, [&](uint32_t begin, uint32_t end)
+                           {
+        for (uint32_t i = begin + 1; i < end + 1; i++)
+        {
+            uint32_t cells = 0;
+            for (uint32_t j = 1; j < Ny - 2; j++)
             {
-                uint32_t base_index = i * NyNz + j * Nz + k;
-                float old_phi = phi_old[base_index];
-
-                neighbor_phis[0] = phi_old[base_index - NyNz];
-                neighbor_phis[1] = phi_old[base_index - Nz];
-                neighbor_phis[2] = phi_old[base_index - 1];
-                neighbor_phis[3] = phi_old[base_index + NyNz];
-                neighbor_phis[4] = phi_old[base_index + Nz];
-                neighbor_phis[5] = phi_old[base_index + 1];
-
-                phi_new[base_index] = updatePhi(base_index, old_phi, neighbor_phis);
-
-                if (phi_new[base_index] > 0.0f)
-                {
-                    float max_u = 0, max_v = 0, max_w = 0;
-                    std::array<uint32_t, 3> neighbors = {base_index - NyNz, base_index - Nz, base_index - 1};
-                    for (uint32_t neighbor : neighbors)
-                    {
-                        if (abs(u_minus_new[neighbor]) > abs(max_u))
-                        {
-                            max_u = u_minus_new[neighbor];
-                        }
-                        if (abs(v_minus_new[neighbor]) > abs(max_v))
-                        {
-                            max_v = v_minus_new[neighbor];
-                        }
-                        if (abs(w_minus_new[neighbor]) > abs(max_w))
-                        {
-                            max_w = w_minus_new[neighbor];
-                        }
-                    }
-                    u_minus_new[base_index] = max_u;
-                    v_minus_new[base_index] = max_v;
-                    w_minus_new[base_index] = max_w;
-                }
-                else
+                for (uint32_t k = 1; k < Nz - 2; k++)
                 {
-                    u_minus_new[base_index] = u_minus_old[base_index];
-                    v_minus_new[base_index] = v_minus_old[base_index];
-                    w_minus_new[base_index] = w_minus_old[base_index];
+                    cells += needsSeeds(i, j, k);
                 }
             }
-        }
+            slabSeeds[i] = cells * PARTICLES_PER_CELL;
+        } });
+    uint32_t seeded = 0;
+    for (uint32_t i = 1; i < Nx - 2; i++)
+    {
+        uint32_t inSlab = slabSeeds[i];
+        slabSeeds[i] = seeded;
+        seeded += inSlab;
     }
-
-    flipStorage();
-
-    phi_old = phi_arrays[oldStorage];
-    u_minus_old = u_minus_arrays[oldStorage];
-    v_minus_old = v_minus_arrays[oldStorage];
-    w_minus_old = w_minus_arrays[oldStorage];
-
-    phi_new = phi_arrays[newStorage];
-    u_minus_new = u_minus_arrays[newStorage];
-    v_minus_new = v_minus_arrays[newStorage];
-    w_minus_new = w_minus_arrays[newStorage];
-
-    for (uint32_t i = Nx - 2; i > 0; i--)
+    particlesSeeded = seeded;
+    if (seeded == 0)
     {
-        for (uint32_t j = Ny - 2; j > 0; j--)
+        return;
+    }
+
+    const uint32_t first = particles.append(seeded);
+    threadPool.parallelFor(Nx - 3, 1, [&](uint32_t begin, uint32_t end)
+                           {
+        for (uint32_t i = begin + 1; i < end + 1; i++)
         {
-            for (uint32_t k = Nz - 2; k > 0; k--)
+            uint32_t n = first + slabSeeds[i];
+            for (uint32_t j = 1; j < Ny - 2; j++)
             {
-                uint32_t base_index = i * NyNz + j * Nz + k;
-                float old_phi = phi_old[base_index];
-
-                neighbor_phis[0] = phi_old[base_index - NyNz];
-                neighbor_phis[1] = phi_old[base_index - Nz];
-                neighbor_phis[2] = phi_old[base_index - 1];
-                neighbor_phis[3] = phi_old[base_index + NyNz];
-                neighbor_phis[4] = phi_old[base_index + Nz];
-                neighbor_phis[5] = phi_old[base_index + 1];
-
-                phi_new[base_index] = updatePhi(base_index, old_phi, neighbor_phis);
-
-                if (phi_new[base_index] > 0.0f)
+                for (uint32_t k = 1; k < Nz - 2; k++)
                 {
-                    float max_u = 0, max_v = 0, max_w = 0;
-                    std::array<uint32_t, 3> neighbors = {base_index + NyNz, base_index + Nz, base_index + 1};
-                    for (uint32_t neighbor : neighbors)
+                    if (!needsSeeds(i, j, k))
                     {
-                        if (abs(u_minus_new[neighbor]) > abs(max_u))
-                        {
-                            max_u = u_minus_new[neighbor];
-                        }
-                        if (abs(v_minus_new[neighbor]) > abs(max_v))
+                        continue;
+                    }
+                    uint32_t cell = i * NyNz + j * Nz + k;
+                    for (uint32_t p = 0; p < PARTICLES_PER_CELL; p++, n++)
+                    {
+                        uint32_t salt = (uint32_t)frame * 3 * PARTICLES_PER_CELL + 3 * p;
+                        BackTrace trace = {cell, seedJitter(cell, salt), seedJitter(cell, salt + 1), seedJitter(cell, salt + 2)};
+                        particles.data(PARTICLE_X)[n] = (float)i + trace.i_beta;
+                        particles.data(PARTICLE_Y)[n] = (float)j + trace.j_beta;
+                        particles.data(PARTICLE_Z)[n] = (float)k + trace.k_beta;
+                        for (uint32_t axis = 0; axis < 3; axis++)
                         {
-                            max_v = v_minus_new[neighbor];
+                            particles.data(PARTICLE_U + axis)[n] = sampleTrilinear(velocities[axis], trace);
                         }
-                        if (abs(w_minus_new[neighbor]) > abs(max_w))
+                        for (uint32_t c = 0; c < affineChannels; c++)
                         {
-                            max_w = w_minus_new[neighbor];
+                            particles.data(PARTICLE_AFFINE + c)[n] = 0.0f;
                         }
                     }
-                    u_minus_new[base_index] = max_u;
-                    v_minus_new[base_index] = max_v;
-                    w_minus_new[base_index] = max_w;
-                }
-                else
-                {
-                    u_minus_new[base_index] = u_minus_old[base_index];
-                    v_minus_new[base_index] = v_minus_old[base_index];
-                    w_minus_new[base_index] = w_minus_old[base_index];
                 }
             }
-        }
-    }
-
-    flipStorage();
-
-    phi_old = phi_arrays[oldStorage];
-    u_minus_old = u_minus_arrays[oldStorage];
-    v_minus_old = v_minus_arrays[oldStorage];
-    w_minus_old = w_minus_arrays[oldStorage];
+        } });
+}
 
-    phi_new = phi_arrays[newStorage];
-    u_minus_new = u_minus_arrays[newStorage];
-    v_minus_new = v_minus_arrays[newStorage];
-    w_minus_new = w_minus_arrays[newStorage];
+// Moves the particles through the previous step's velocities with a midpoint step, then rebins them. Particles
+// that left the liquid or ended up in the tall cells are removed.
+void Grid::moveParticles(float deltaT)
+{
+    const FieldSpan phi = fields.current(FIELD_PHI);
+    const std::array<FieldSpan, 3> velocities = {fields.previous(FIELD_U_MINUS), fields.previous(FIELD_V_MINUS), fields.previous(FIELD_W_MINUS)};
+    const float cellsPerVelocity = deltaT * INV_CELL_WIDTH;
+    float *x = particles.data(PARTICLE_X);
+    float *y = particles.data(PARTICLE_Y);
+    float *z = particles.data(PARTICLE_Z);
 
-    for (uint32_t i = Nx - 2; i > 0; i--)
-    {
-        for (uint32_t j = Ny - 2; j > 0; j--)
+    particleKeys.resize(std::max(particleKeys.size(), (size_t)particles.size()));
+    threadPool.parallelFor(particles.size(), PARTICLE_GRAIN, [&](uint32_t begin, uint32_t end)
+                           {
+        for (uint32_t n = begin; n < end; n++)
         {
-            for (uint32_t k = Nz - 2; k > 0; k--)
-            {
-                uint32_t base_index = i * NyNz + j * Nz + k;
-                float old_phi = phi_old[base_index];
+            BackTrace trace = locate(x[n], y[n], z[n]);
+            float half = 0.5f * cellsPerVelocity;
+            BackTrace midpoint = locate(x[n] + half * sampleTrilinear(velocities[0], trace), y[n] + half * sampleTrilinear(velocities[1], trace),
+                                        z[n] + half * sampleTrilinear(velocities[2], trace));
+            x[n] = std::clamp(x[n] + cellsPerVelocity * sampleTrilinear(velocities[0], midpoint), 1.0f, (float)(Nx - 2));
+            y[n] = std::clamp(y[n] + cellsPerVelocity * sampleTrilinear(velocities[1], midpoint), 1.0f, (float)(Ny - 2));
+            z[n] = std::clamp(z[n] + cellsPerVelocity * sampleTrilinear(velocities[2], midpoint), 1.0f, (float)(Nz - 2));
 
-                neighbor_phis[0] = phi_old[base_index - NyNz];
-                neighbor_phis[1] = phi_old[base_index - Nz];
-                neighbor_phis[2] = phi_old[base_index - 1];
-                neighbor_phis[3] = phi_old[base_index + NyNz];
-                neighbor_phis[4] = phi_old[base_index + Nz];
-                neighbor_phis[5] = phi_old[base_index + 1];
+            trace = locate(x[n], y[n], z[n]);
+            uint32_t j = (trace.index / Nz) % Ny;
+            bool removed = (j > tallTop + 1 && j < tallBottom) || sampleTrilinear(phi, trace) > PARTICLE_DROP_PHI;
+            particleKeys[n] = removed ? PARTICLE_DROPPED : trace.index;
+        } });
+    particlesRemoved = particles.rebin(particleKeys.data(), MAX_PARTICLES_PER_CELL, threadPool);
+}
 
-                phi_new[base_index] = updatePhi(base_index, old_phi, neighbor_phis);
+// Particle-to-grid transfer onto the nodes of each particle's lattice cell. A particle in slab i only writes
+// slabs i and i + 1, so the even slabs are splatted in parallel, then the odd ones, and no node is written by
+// two threads at once. APIC particles splat their affine velocity at each node too.
+void Grid::splatParticles()
+{
+    const bool affine = options.particles == TRANSFER_APIC;
+    const float *x = particles.data(PARTICLE_X);
+    const float *y = particles.data(PARTICLE_Y);
+    const float *z = particles.data(PARTICLE_Z);
+    const float *u = particles.data(PARTICLE_U);
+    const float *v = particles.data(PARTICLE_V);
+    const float *w = particles.data(PARTICLE_W);
+    std::array<const float *, 9> particleAffine = {};
+    for (uint32_t c = 0; affine && c < 9; c++)
+    {
+        particleAffine[c] = particles.data(PARTICLE_AFFINE + c);
+    }
+    TransferNode *nodes = transferNodes.data();
+    threadPool.parallelFor(Nx, 1, [&](uint32_t begin, uint32_t end)
+                           { std::fill(nodes + begin * NyNz, nodes + end * NyNz, TransferNode{}); });
 
-                if (phi_new[base_index] > 0.0f)
+    for (uint32_t parity = 0; parity < 2; parity++)
+    {
+        // slabs 1 + parity, 3 + parity, ... up to Nx - 2, the last slab a particle can be in
+        threadPool.parallelFor((Nx - 1 - parity) / 2, 1, [&](uint32_t begin, uint32_t end)
+                               {
+            for (uint32_t slab = begin; slab < end; slab++)
+            {
+                uint32_t i = 1 + parity + 2 * slab;
+                for (uint32_t n = particles.slabStart(i); n < particles.slabStart(i + 1); n++)
                 {
-                    float max_u = 0, max_v = 0, max_w = 0;
-                    std::array<uint32_t, 3> neighbors = {base_index + NyNz, base_index + Nz, base_index + 1};
-                    for (uint32_t neighbor : neighbors)
+                    BackTrace trace = locate(x[n], y[n], z[n]);
+                    const float weightsI[2] = {1.0f - trace.i_beta, trace.i_beta};
+                    const float weightsJ[2] = {1.0f - trace.j_beta, trace.j_beta};
+                    const float weightsK[2] = {1.0f - trace.k_beta, trace.k_beta};
+                    std::array<float, 9> gradient = {};
+                    for (uint32_t c = 0; affine && c < 9; c++)
                     {
-                        if (abs(u_minus_new[neighbor]) > abs(max_u))
-                        {
-                            max_u = u_minus_new[neighbor];
-                        }
-                        if (abs(v_minus_new[neighbor]) > abs(max_v))
-                        {
-                            max_v = v_minus_new[neighbor];
-                        }
-                        if (abs(w_minus_new[neighbor]) > abs(max_w))
+                        gradient[c] = particleAffine[c][n];
+                    }
+                    // the velocity carried to a node is v + C (node - x), or base + C corner with the node's corner offset
+                    std::array<float, 3> base = {u[n], v[n], w[n]};
+                    for (uint32_t axis = 0; axis < 3; axis++)
+                    {
+                        base[axis] -= gradient[3 * axis] * trace.i_beta + gradient[3 * axis + 1] * trace.j_beta + gradient[3 * axis + 2] * trace.k_beta;
+                    }
+                    for (uint32_t ci = 0; ci < 2; ci++)
+                    {
+                        for (uint32_t cj = 0; cj < 2; cj++)
                         {
-                            max_w = w_minus_new[neighbor];
+                            TransferNode *row = nodes + trace.index + ci * NyNz + cj * Nz;
+                            float rowWeight = weightsI[ci] * weightsJ[cj];
+                            for (uint32_t ck = 0; ck < 2; ck++)
+                            {
+                                float weight = rowWeight * weightsK[ck];
+                                row[ck].weight += weight;
+                                for (uint32_t axis = 0; axis < 3; axis++)
+                                {
+                                    float value = base[axis] + gradient[3 * axis] * (float)ci + gradient[3 * axis + 1] * (float)cj + gradient[3 * axis + 2] * (float)ck;
+                                    row[ck].momentum[axis] += weight * value;
+                                }
+                            }
                         }
                     }
-                    u_minus_new[base_index] = max_u;
-                    v_minus_new[base_index] = max_v;
-                    w_minus_new[base_index] = max_w;
-                }
-                else
-                {
-                    u_minus_new[base_index] = u_minus_old[base_index];
-                    v_minus_new[base_index] = v_minus_old[base_index];
-                    w_minus_new[base_index] = w_minus_old[base_index];
                 }
-            }
-        }
+            } });
     }
 }
 
-inline float Grid::updatePhi(uint32_t base_index, float old_phi, const std::array<float, 6> &neighbor_phis)
+// Grid-to-particle transfer after projection. FLIP particles add the change the step made to the grid velocity,
+// with a share of the grid velocity itself to damp noise; APIC particles take the grid velocity and its gradient.
+// Reports the step's particle throughput.
+void Grid::gatherParticles(float deltaT)
 {
-    float a1 = MAXFLOAT, a2 = MAXFLOAT, a3 = MAXFLOAT;
-    if (abs(old_phi) < CELL_WIDTH)
+    auto start = std::chrono::steady_clock::now();
+    const bool affine = options.particles == TRANSFER_APIC;
+    const std::array<FieldSpan, 3> velocities = {fields.current(FIELD_U_MINUS), fields.current(FIELD_V_MINUS), fields.current(FIELD_W_MINUS)};
+    // the velocities before projection already include the body forces, which the particles have not seen yet
+    const std::array<float, 3> forces = {BODY_FORCES[FIELD_U_MINUS] * deltaT, BODY_FORCES[FIELD_V_MINUS] * deltaT, BODY_FORCES[FIELD_W_MINUS] * deltaT};
+    const float *x = particles.data(PARTICLE_X);
+    const float *y = particles.data(PARTICLE_Y);
+    const float *z = particles.data(PARTICLE_Z);
+    const std::array<float *, 3> particleVelocities = {particles.data(PARTICLE_U), particles.data(PARTICLE_V), particles.data(PARTICLE_W)};
+    std::array<float *, 9> particleAffine = {};
+    for (uint32_t c = 0; affine && c < 9; c++)
     {
-        return old_phi;
+        particleAffine[c] = particles.data(PARTICLE_AFFINE + c);
     }
-    bool positive = old_phi > 0.0f;
 
-    for (float neighbor_phi : neighbor_phis)
+    // A FLIP particle adds the change projection made to the grid. That change is rebuilt from the pressures the way
+    // project applied them, so the velocities before projection need not be kept: a face loses CONST_FACTOR times
+    // the pressure difference across it, aggregates spread half their value over their cells and cells without a
+    // brick are air. In the tall cells every v face of a column's span moves by the column's gradient, and u and w
+    // are interpolated between the top and bottom rows like the velocities themselves.
+    const float CONST_FACTOR = deltaT / (RHO * CELL_WIDTH);
+    const float gradientFactor = tallTop == tallBottom ? 0.0f : CONST_FACTOR / (float)(tallBottom - tallTop);
+    auto cellPressure = [&](uint32_t i, uint32_t j, uint32_t k)
     {
-        if (abs(neighbor_phi) < a1)
+        uint32_t brick = solver.find(i >> BRICK_LOG2, j >> BRICK_LOG2, k >> BRICK_LOG2);
+        if (brick == INVALID_BRICK)
         {
-            a3 = a2;
-            a2 = a1;
-            a1 = abs(neighbor_phi);
+            return 0.0f;
         }
-        else if (abs(neighbor_phi) < a2)
+        const float *values = solver.data(SOLVER_PRESSURE, brick);
+        uint32_t li = i & (BRICK_SIZE - 1), lj = j & (BRICK_SIZE - 1), lk = k & (BRICK_SIZE - 1);
+        return isCoarse(brick) ? 0.5f * values[coarseCell(li >> 1, lj >> 1, lk >> 1)] : values[brickCell(li, lj, lk)];
+    };
+    auto faceChange = [&](uint32_t axis, uint32_t i, uint32_t j, uint32_t k)
+    {
+        if (i == 0 || j == 0 || k == 0) // outside the faces project updates
         {
-            a3 = a2;
-            a2 = abs(neighbor_phi);
+            return 0.0f;
         }
-        else if (abs(neighbor_phi) < a3)
+        std::array<uint32_t, 3> minus = {i, j, k};
+        minus[axis]--;
+        return -CONST_FACTOR * (cellPressure(i, j, k) - cellPressure(minus[0], minus[1], minus[2]));
+    };
+    auto projectionChange = [&](uint32_t axis, uint32_t i, uint32_t j, uint32_t k)
+    {
+        if (j <= tallTop || j > tallBottom)
         {
-            a3 = abs(neighbor_phi);
+            return faceChange(axis, i, j, k);
         }
-    }
-
-    float determinant2 = 2 * CELL_WIDTH * CELL_WIDTH - (a1 - a2) * (a1 - a2);
-    float determinant3 = 3 * CELL_WIDTH * CELL_WIDTH - (a1 - a2) * (a1 - a2) - (a1 - a3) * (a1 - a3) - (a2 - a3) * (a2 - a3);
+        if (axis == 1)
+        {
+            bool column = i <= Nx - 2 && k <= Nz - 2; // the wall columns' span is never projected
+            return column ? -gradientFactor * (cellPressure(i, tallBottom, k) - cellPressure(i, tallTop, k)) : 0.0f;
+        }
+        if (j == tallBottom)
+        {
+            return faceChange(axis, i, j, k);
+        }
+        float t = (float)(j - tallTop) / (float)(tallBottom - tallTop);
+        float top = faceChange(axis, i, tallTop, k);
+        return top + t * (faceChange(axis, i, tallBottom, k) - top);
+    };
+
+    // Particles are sorted by cell, so neighbours mostly share a cell and its corner changes are kept until the cell
+    // changes. Away from the walls and the tall cells the corners only need the 3x3x3 block of pressures around the
+    // cell, and the next cell is mostly one further along k, where only the block's new k layer is read.
+    static const std::array<float, BRICK_CELLS> noBrick = {};
+    const uint32_t fineStride[3] = {BRICK_SIZE * BRICK_SIZE, BRICK_SIZE, 1};
+    const uint32_t coarseStride[3] = {COARSE_SIZE * COARSE_SIZE, COARSE_SIZE, 1};
+    threadPool.parallelFor(particles.size(), PARTICLE_GRAIN, [&](uint32_t begin, uint32_t end)
+                           {
+        uint32_t cornersIndex = UINT32_MAX;
+        float corners[3][8];
+        // the block spans at most two bricks along each axis: per axis and block position, which of the two and the
+        // offsets of the cell in a fine and in a coarse brick. Cells without a brick read a zeroed one, aggregates
+        // are scaled to their cells' share.
+        uint32_t blockIndex = UINT32_MAX;
+        uint32_t cell[3];
+        float block[3][3][3];
+        const float *brickValues[8];
+        float brickScale[8];
+        bool brickCoarse[8];
+        uint32_t side[3][3], fineOffset[3][3], coarseOffset[3][3];
+        auto updateAxis = [&](uint32_t axis)
+        {
+            for (uint32_t d = 0; d < 3; d++)
+            {
+                uint32_t c = cell[axis] + d - 1;
+                side[axis][d] = ((c >> BRICK_LOG2) != ((cell[axis] - 1) >> BRICK_LOG2)) << (2 - axis);
+                fineOffset[axis][d] = (c & (BRICK_SIZE - 1)) * fineStride[axis];
+                coarseOffset[axis][d] = ((c & (BRICK_SIZE - 1)) >> 1) * coarseStride[axis];
+            }
+        };
+        auto findBricks = [&]()
+        {
+            for (uint32_t b = 0; b < 8; b++)
+            {
+                uint32_t brick = solver.find((cell[0] + 2 * (b >> 2) - 1) >> BRICK_LOG2, (cell[1] + 2 * ((b >> 1) & 1) - 1) >> BRICK_LOG2,
+                                             (cell[2] + 2 * (b & 1) - 1) >> BRICK_LOG2);
+                brickValues[b] = brick == INVALID_BRICK ? noBrick.data() : solver.data(SOLVER_PRESSURE, brick);
+                brickCoarse[b] = brick != INVALID_BRICK && isCoarse(brick);
+                brickScale[b] = brickCoarse[b] ? 0.5f : 1.0f;
+            }
+        };
+
+        for (uint32_t n = begin; n < end; n++)
+        {
+            BackTrace trace = locate(x[n], y[n], z[n]);
+            if (!affine && trace.index != cornersIndex)
+            {
+                cornersIndex = trace.index;
+                uint32_t firstK = 0;
+                if (blockIndex + 1 == trace.index)
+                {
+                    // k stays inside the row and away from the walls, as the cell before was in the block path
+                    cell[2]++;
+                    updateAxis(2);
+                    if (((cell[2] + 1) & (BRICK_SIZE - 1)) == 0 || ((cell[2] - 1) & (BRICK_SIZE - 1)) == 0) // k + 1 or k - 1 entered a brick
+                    {
+                        findBricks();
+                    }
+                    for (uint32_t bi = 0; bi < 3; bi++)
+                    {
+                        for (uint32_t bj = 0; bj < 3; bj++)
+                        {
+                            block[bi][bj][0] = block[bi][bj][1];
+                            block[bi][bj][1] = block[bi][bj][2];
+                        }
+                    }
+                    firstK = 2;
+                }
+                else
+                {
+                    uint32_t i = trace.index / NyNz;
+                    uint32_t j = (trace.index / Nz) % Ny;
+                    uint32_t k = trace.index % Nz;
+                    if (i == 0 || j == 0 || k == 0 || (j + 1 > tallTop && j <= tallBottom && tallTop != tallBottom))
+                    {
+                        for (uint32_t axis = 0; axis < 3; axis++)
+                        {
+                            for (uint32_t c = 0; c < 8; c++)
+                            {
+                                corners[axis][c] = projectionChange(axis, i + (c >> 2), j + ((c >> 1) & 1), k + (c & 1));
+                            }
+                        }
+                        blockIndex = UINT32_MAX;
+                        firstK = 3;
+                    }
+                    else
+                    {
+                        cell[0] = i;
+                        cell[1] = j;
+                        cell[2] = k;
+                        for (uint32_t axis = 0; axis < 3; axis++)
+                        {
+                            updateAxis(axis);
+                        }
+                        findBricks();
+                    }
+                }
+                if (firstK < 3)
+                {
+                    blockIndex = trace.index;
+                    for (uint32_t bi = 0; bi < 3; bi++)
+                    {
+                        for (uint32_t bj = 0; bj < 3; bj++)
+                        {
+                            for (uint32_t bk = firstK; bk < 3; bk++)
+                            {
+                                uint32_t b = side[0][bi] | side[1][bj] | side[2][bk];
+                                uint32_t offset = brickCoarse[b] ? coarseOffset[0][bi] + coarseOffset[1][bj] + coarseOffset[2][bk]
+                                                                 : fineOffset[0][bi] + fineOffset[1][bj] + fineOffset[2][bk];
+                                block[bi][bj][bk] = brickScale[b] * brickValues[b][offset];
+                            }
+                        }
+                    }
+                    for (uint32_t c = 0; c < 8; c++)
+                    {
+                        uint32_t ci = 1 + (c >> 2), cj = 1 + ((c >> 1) & 1), ck = 1 + (c & 1);
+                        float here = block[ci][cj][ck];
+                        corners[0][c] = -CONST_FACTOR * (here - block[ci - 1][cj][ck]);
+                        corners[1][c] = -CONST_FACTOR * (here - block[ci][cj - 1][ck]);
+                        corners[2][c] = -CONST_FACTOR * (here - block[ci][cj][ck - 1]);
+                    }
+                }
+            }
+            for (uint32_t axis = 0; axis < 3; axis++)
+            {
+                float *velocity = particleVelocities[axis];
+                if (affine)
+                {
+                    float gradient[3];
+                    velocity[n] = sampleGradient(velocities[axis], trace, gradient);
+                    particleAffine[3 * axis][n] = gradient[0];
+                    particleAffine[3 * axis + 1][n] = gradient[1];
+                    particleAffine[3 * axis + 2][n] = gradient[2];
+                    continue;
+                }
+                const float *corner = corners[axis];
+                float i_alpha = 1.0f - trace.i_beta;
+                float j_alpha = 1.0f - trace.j_beta;
+                float k_alpha = 1.0f - trace.k_beta;
+                float change = k_alpha * (j_alpha * (i_alpha * corner[0] + trace.i_beta * corner[4]) + trace.j_beta * (i_alpha * corner[2] + trace.i_beta * corner[6])) +
+                               trace.k_beta * (j_alpha * (i_alpha * corner[1] + trace.i_beta * corner[5]) + trace.j_beta * (i_alpha * corner[3] + trace.i_beta * corner[7]));
+                float pic = sampleTrilinear(velocities[axis], trace);
+                float flip = velocity[n] + forces[axis] + change;
+                velocity[n] = FLIP_BLEND * flip + (1.0f - FLIP_BLEND) * pic;
+            }
+        } });
+
+    particleSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Particles: " << particles.size() << " (" << particlesSeeded << " seeded, " << particlesRemoved << " removed), "
+              << particles.size() / particleSeconds * 1e-6 << " M particles/s" << std::endl;
+}
+
+// Moves the window along each axis where the liquid in the band has come within the margin of a wall, far
+// enough to centre it. Re-centring rather than stepping keeps moves rare, each one copies every field.
+void Grid::updateWindow()
+{
+    const FieldSpan phi = fields.current(FIELD_PHI);
+    const std::array<uint32_t, 3> dims = {Nx, Ny, Nz};
+    std::array<uint32_t, 3> low = {Nx, Ny, Nz};
+    std::array<uint32_t, 3> high = {0, 0, 0};
+    for (uint32_t base_index : bandCells)
+    {
+        if (phi[base_index] >= 0.0f)
+        {
+            continue;
+        }
+        std::array<uint32_t, 3> cell = {base_index / NyNz, (base_index / Nz) % Ny, base_index % Nz};
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            low[axis] = std::min(low[axis], cell[axis]);
+            high[axis] = std::max(high[axis], cell[axis]);
+        }
+    }
+    if (low[0] > high[0]) // no liquid left in the band
+    {
+        return;
+    }
+
+    std::array<int32_t, 3> shift = {0, 0, 0};
+    for (uint32_t axis = 0; axis < 3; axis++)
+    {
+        // a quarter of the axis at most, or a small grid would never have the liquid far enough from its walls
+        const uint32_t margin = std::min(WINDOW_MAX_MARGIN, dims[axis] / 4);
+        if (low[axis] < margin || high[axis] + margin >= dims[axis])
+        {
+            shift[axis] = ((int32_t)(low[axis] + high[axis]) - (int32_t)(dims[axis] - 1)) / 2;
+        }
+    }
+    if (shift[0] != 0 || shift[1] != 0 || shift[2] != 0)
+    {
+        scrollWindow(shift);
+    }
+}
+
+// Translates the grid by shift cells: cell (i, j, k) takes the state of cell (i, j, k) + shift. Cells shifted in from
+// outside are air, moving with the velocities of the interior layer along the old edge, as the air there would have
+// without the walls. Every loop indexes the fields from cell (0, 0, 0), so a move copies every field whatever the
+// shift. They are shifted in place, one i slab at a time: the slab is built in scratch from the slabs it reads and
+// written to both buffers, so they agree as after loading a checkpoint. Pressures go along as the warm start of the
+// next solve.
+void Grid::scrollWindow(const std::array<int32_t, 3> &shift)
+{
+    auto start = std::chrono::steady_clock::now();
+    windowPressures.resize((size_t)Nx * NyNz);
+    windowShifted.resize((size_t)Nx * NyNz);
+    gatherPressure(windowPressures.data());
+
+    // Every field is indexed like the cells, the faces past the last cell along their axis are the tail of the
+    // array: a whole i slab for u, and the few values after the last cell for v and w, which only walls touch.
+    // shiftSlab writes slab i of an array of size values to out, reading source slabs through source(slab, edge).
+    // Sources outside the grid take the fill value, or with clampToEdge the nearest interior cell's value; edge is
+    // set when that moved the source to slab 1 or Nx - 2.
+    const int32_t k0 = std::clamp(-shift[2], 0, (int32_t)Nz);
+    const int32_t k1 = std::max(k0, std::clamp((int32_t)Nz - shift[2], 0, (int32_t)Nz));
+    auto shiftSlab = [&](uint32_t i, size_t size, bool clampToEdge, auto &&source, auto *out, auto &&fill)
+    {
+        for (uint32_t j = 0; j < Ny; j++)
+        {
+            size_t row = (size_t)i * NyNz + j * Nz;
+            if (row >= size)
+            {
+                break;
+            }
+            auto *outRow = out + j * Nz;
+            if (size - row < Nz)
+            {
+                fill(outRow, (uint32_t)(size - row));
+                continue;
+            }
+            int32_t fromI = (int32_t)i + shift[0];
+            int32_t fromJ = (int32_t)j + shift[1];
+            bool outside = fromI < 0 || fromJ < 0 || fromJ >= (int32_t)Ny || (size_t)fromI * NyNz + (size_t)fromJ * Nz + Nz > size;
+            if (outside && !clampToEdge)
+            {
+                fill(outRow, Nz);
+                continue;
+            }
+            bool edge = false;
+            if (outside)
+            {
+                int32_t clampedI = std::clamp(fromI, 1, (int32_t)Nx - 2);
+                edge = clampedI != fromI;
+                fromI = clampedI;
+                fromJ = std::clamp(fromJ, 1, (int32_t)Ny - 2);
+            }
+            const auto *fromRow = source((uint32_t)fromI, edge) + (size_t)fromJ * Nz;
+            if (k1 > k0)
+            {
+                std::copy(fromRow + k0 + shift[2], fromRow + k1 + shift[2], outRow + k0);
+            }
+            for (uint32_t k = 0; k < Nz; k++)
+            {
+                if (k >= (uint32_t)k0 && k < (uint32_t)k1)
+                {
+                    continue;
+                }
+                if (clampToEdge)
+                {
+                    outRow[k] = fromRow[std::clamp((int32_t)k + shift[2], 1, (int32_t)Nz - 2)];
+                }
+                else
+                {
+                    fill(outRow + k, 1);
+                }
+            }
+        }
+    };
+
+    // Writing slab i in place loses the old slab, which slab i - shift[0] reads. Slabs go in waves of |shift[0]|,
+    // in the direction of the shift, so every slab a wave reads belongs to the next one. Reads moved to an edge slab
+    // do not follow that order and use a copy taken before the first wave.
+    for (uint32_t field = 0; field < FIELD_COUNT; field++)
+    {
+        FieldStorage *current = fields.current((FieldId)field).data();
+        FieldStorage *previous = fields.previous((FieldId)field).data();
+        const size_t size = fields.size((FieldId)field);
+        const uint32_t slabs = (uint32_t)((size + NyNz - 1) / NyNz);
+        const bool clampToEdge = field != FIELD_PHI;
+        FieldStorage air;
+        FieldSpan(&air, 1)[0] = field == FIELD_PHI ? NARROW_BAND_WIDTH : 0.0f;
+        if (clampToEdge)
+        {
+            windowEdges.resize(2 * NyNz);
+            std::copy_n(current + NyNz, NyNz, windowEdges.data());
+            std::copy_n(current + (size_t)(Nx - 2) * NyNz, NyNz, windowEdges.data() + NyNz);
+        }
+        auto source = [&](uint32_t slab, bool edge)
+        { return edge ? windowEdges.data() + (slab == 1 ? 0 : NyNz) : current + (size_t)slab * NyNz; };
+        auto fill = [&](FieldStorage *first, uint32_t count)
+        { std::fill_n(first, count, air); };
+
+        const uint32_t width = shift[0] == 0 ? slabs : (uint32_t)std::abs(shift[0]);
+        for (uint32_t wave = 0; wave < slabs; wave += width)
+        {
+            threadPool.parallelFor(std::min(width, slabs - wave), 1, [&](uint32_t begin, uint32_t end)
+                                   {
+                static thread_local std::vector<FieldStorage> scratch;
+                scratch.resize(NyNz);
+                for (uint32_t n = wave + begin; n < wave + end; n++)
+                {
+                    uint32_t i = shift[0] < 0 ? slabs - 1 - n : n;
+                    shiftSlab(i, size, clampToEdge, source, scratch.data(), fill);
+                    size_t first = (size_t)i * NyNz;
+                    size_t count = std::min((size_t)NyNz, size - first);
+                    std::copy_n(scratch.data(), count, current + first);
+                    std::copy_n(scratch.data(), count, previous + first);
+                } });
+        }
+    }
+    threadPool.parallelFor(Nx, 1, [&](uint32_t begin, uint32_t end)
+                           {
+        for (uint32_t i = begin; i < end; i++)
+        {
+            shiftSlab(
+                i, windowPressures.size(), false, [&](uint32_t slab, bool) { return windowPressures.data() + (size_t)slab * NyNz; },
+                windowShifted.data() + (size_t)i * NyNz, [](float *first, uint32_t count) { std::fill_n(first, count, 0.0f); });
+        } });
+
+    for (uint32_t axis = 0; axis < 3; axis++)
+    {
+        windowOrigin[axis] += shift[axis];
+    }
+    if (options.particles != TRANSFER_NONE)
+    {
+        // particles keep their place in the world, those the window left behind are removed
+        std::array<float *, 3> positions = {particles.data(PARTICLE_X), particles.data(PARTICLE_Y), particles.data(PARTICLE_Z)};
+        const std::array<uint32_t, 3> dims = {Nx, Ny, Nz};
+        particleKeys.resize(std::max(particleKeys.size(), (size_t)particles.size()));
+        threadPool.parallelFor(particles.size(), PARTICLE_GRAIN, [&](uint32_t begin, uint32_t end)
+                               {
+            for (uint32_t n = begin; n < end; n++)
+            {
+                bool outside = false;
+                for (uint32_t axis = 0; axis < 3; axis++)
+                {
+                    positions[axis][n] -= (float)shift[axis];
+                    outside = outside || positions[axis][n] < 1.0f || positions[axis][n] > (float)(dims[axis] - 2);
+                }
+                particleKeys[n] = outside ? PARTICLE_DROPPED : locate(positions[0][n], positions[1][n], positions[2][n]).index;
+            } });
+        particles.rebin(particleKeys.data(), MAX_PARTICLES_PER_CELL, threadPool);
+    }
+    resetDerivedState();
+    solver.scatter(SOLVER_PRESSURE, windowShifted.data());
+    std::cout << "Window moved by (" << shift[0] << ", " << shift[1] << ", " << shift[2] << ") cells to (" << windowOrigin[0] << ", "
+              << windowOrigin[1] << ", " << windowOrigin[2] << ") in "
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000.0 << " ms" << std::endl;
+}
+
+// Allocates solver bricks where there is liquid and frees them where it has gone. Only bricks holding band cells,
+// or rows the tall cells just moved over, can change state between steps, so unless full is set the others are
+// left alone. A full refresh also reclassifies every cell for updateSOE.
+void Grid::updateSolverBricks(bool full)
+{
+    const FieldSpan phi = fields.current(FIELD_PHI);
+
+    auto refresh = [&](uint32_t bi, uint32_t bj, uint32_t bk)
+    {
+        bool liquid = false;
+        for (uint32_t i = std::max(bi * BRICK_SIZE, 1u); i < std::min((bi + 1) * BRICK_SIZE, Nx - 1) && !liquid; i++)
+        {
+            for (uint32_t j = std::max(bj * BRICK_SIZE, 1u); j < std::min((bj + 1) * BRICK_SIZE, Ny - 1) && !liquid; j++)
+            {
+                for (uint32_t k = std::max(bk * BRICK_SIZE, 1u); k < std::min((bk + 1) * BRICK_SIZE, Nz - 1) && !liquid; k++)
+                {
+                    liquid = phi[i * NyNz + j * Nz + k] < 0.0f && !inTallCell(j);
+                }
+            }
+        }
+
+        uint32_t brick = solver.find(bi, bj, bk);
+        if (liquid && brick == INVALID_BRICK)
+        {
+            brick = solver.allocate(bi, bj, bk);
+            typesState.resize(solver.capacity());
+            typesState[brick] = TYPES_UNSET;
+            if (brick < brickCoarse.size())
+            {
+                brickCoarse[brick] = 0;
+            }
+        }
+        else if (!liquid && brick != INVALID_BRICK)
+        {
+            solver.release(brick);
+        }
+    };
+
+    if (full)
+    {
+        for (uint32_t bi = 0; bi < solver.bricksX(); bi++)
+        {
+            for (uint32_t bj = 0; bj < solver.bricksY(); bj++)
+            {
+                for (uint32_t bk = 0; bk < solver.bricksZ(); bk++)
+                {
+                    refresh(bi, bj, bk);
+                }
+            }
+        }
+        typesState.assign(solver.capacity(), TYPES_UNSET);
+
+        fluidCells.assign(((size_t)Nx * NyNz + 63) / 64, 0);
+        for (uint32_t i = 1; i < Nx - 1; i++)
+        {
+            for (uint32_t j = 1; j < Ny - 1; j++)
+            {
+                for (uint32_t k = 1; k < Nz - 1; k++)
+                {
+                    uint32_t base_index = i * NyNz + j * Nz + k;
+                    fluidCells[base_index >> 6] |= (uint64_t)(phi[base_index] < 0.0f) << (base_index & 63);
+                }
+            }
+        }
+        return;
+    }
+
+    touchedBricks.clear();
+    for (uint32_t base_index : bandCells)
+    {
+        uint32_t bi = (base_index / NyNz) >> BRICK_LOG2;
+        uint32_t bj = ((base_index / Nz) % Ny) >> BRICK_LOG2;
+        uint32_t bk = (base_index % Nz) >> BRICK_LOG2;
+        uint32_t rootIndex = (bi * solver.bricksY() + bj) * solver.bricksZ() + bk;
+        if (!brickTouched[rootIndex])
+        {
+            brickTouched[rootIndex] = 1;
+            touchedBricks.push_back(rootIndex);
+        }
+    }
+    for (uint32_t rootIndex : touchedBricks)
+    {
+        brickTouched[rootIndex] = 0;
+        refresh(rootIndex / (solver.bricksY() * solver.bricksZ()), (rootIndex / solver.bricksZ()) % solver.bricksY(), rootIndex % solver.bricksZ());
+    }
+
+    // rows that joined or left the tall cells, and the bricks holding them in their halo
+    if (tallRefresh[0] > tallRefresh[1])
+    {
+        return;
+    }
+    uint32_t firstRow = (tallRefresh[0] - 1) >> BRICK_LOG2;
+    uint32_t lastRow = std::min((tallRefresh[1] + 1) >> BRICK_LOG2, solver.bricksY() - 1);
+    for (uint32_t bi = 0; bi < solver.bricksX(); bi++)
+    {
+        for (uint32_t bj = firstRow; bj <= lastRow; bj++)
+        {
+            for (uint32_t bk = 0; bk < solver.bricksZ(); bk++)
+            {
+                refresh(bi, bj, bk);
+                uint32_t brick = solver.find(bi, bj, bk);
+                if (brick != INVALID_BRICK && typesState[brick] == TYPES_CURRENT)
+                {
+                    typesState[brick] = TYPES_STALE;
+                }
+            }
+        }
+    }
+}
+
+// Places the tall cells below the band. Nothing below the deepest band row is near the surface, so those interior
+// cells all have one sign and the rows can be folded if it is water. The level follows the band down at once and
+// moves back up only once it can gain TALL_CELL_SLACK rows, so the bricks along it are not rebuilt every step.
+void Grid::updateTallCells()
+{
+    tallRefresh[0] = 1;
+    tallRefresh[1] = 0;
+    if (!options.tallCells)
+    {
+        return;
+    }
+
+    const FieldSpan phi = fields.current(FIELD_PHI);
+    uint32_t deepestBand = 0;
+    for (uint32_t base_index : bandCells)
+    {
+        deepestBand = std::max(deepestBand, (base_index / Nz) % Ny);
+    }
+    const uint32_t bottom = Ny - 2;
+    const uint32_t lowest = deepestBand + TALL_CELL_MARGIN;
+    bool deepWater = lowest + TALL_CELL_MIN_SPAN <= bottom && phi[1 * NyNz + bottom * Nz + 1] < 0.0f;
+
+    uint32_t top = tallTop;
+    if (!deepWater)
+    {
+        top = bottom;
+    }
+    else if (tallTop == tallBottom || lowest > tallTop || lowest + 2 * TALL_CELL_SLACK <= tallTop)
+    {
+        top = std::min(lowest + TALL_CELL_SLACK, bottom - TALL_CELL_MIN_SPAN);
+    }
+    if (top == tallTop)
+    {
+        return;
+    }
+
+    bool folding = top < tallTop; // rows that were regular become part of the tall cells
+    tallRefresh[0] = std::min(top, tallTop) + 1;
+    tallRefresh[1] = std::max(top, tallTop);
+    tallTop = top;
+    tallBottom = bottom;
+
+    // Galerkin weights of the linear profile t = (j - tallTop) / span over the folded rows: sum (1 - t)^2 = sum t^2,
+    // and sum t (1 - t)
+    float span = (float)(tallBottom - tallTop);
+    tallSame = (span - 1.0f) * (2.0f * span - 1.0f) / (6.0f * span);
+    tallCross = (span - 1.0f) * (span + 1.0f) / (6.0f * span);
+    if (folding)
+    {
+        fillTallVelocities();
+    }
+}
+
+// Replaces the velocities of the folded rows by the linear profile between the top and bottom cells. u and w
+// interpolate between the faces on the top and bottom rows, v between the first and last face inside the span.
+void Grid::fillTallVelocities()
+{
+    if (tallTop == tallBottom)
+    {
+        return;
+    }
+
+    // faces of the wall cells on the + sides too, project updates those like any other
+    threadPool.parallelFor(Nx - 1, 1, [&](uint32_t begin, uint32_t end)
+                           {
+        for (uint32_t i = begin + 1; i < end + 1; i++)
+        {
+            fillTallSlab(i);
+        } });
+}
+
+void Grid::fillTallSlab(uint32_t i)
+{
+    const FieldSpan u_minus = fields.current(FIELD_U_MINUS);
+    const FieldSpan v_minus = fields.current(FIELD_V_MINUS);
+    const FieldSpan w_minus = fields.current(FIELD_W_MINUS);
+    const uint32_t span = tallBottom - tallTop;
+    uint32_t top = i * NyNz + tallTop * Nz;
+    uint32_t bottom = i * NyNz + tallBottom * Nz;
+    for (uint32_t j = tallTop + 1; j < tallBottom; j++)
+    {
+        uint32_t row = i * NyNz + j * Nz;
+        float t = (float)(j - tallTop) / (float)span;
+        float s = (float)(j - tallTop - 1) / (float)(span - 1);
+        for (uint32_t k = 1; k < Nz; k++)
+        {
+            u_minus[row + k] = u_minus[top + k] + t * (u_minus[bottom + k] - u_minus[top + k]);
+            w_minus[row + k] = w_minus[top + k] + t * (w_minus[bottom + k] - w_minus[top + k]);
+            if (j > tallTop + 1)
+            {
+                v_minus[row + k] = v_minus[top + Nz + k] + s * (v_minus[bottom + k] - v_minus[top + Nz + k]);
+            }
+        }
+    }
+}
+
+void Grid::updateSOE(float deltaT)
+{
+    prepareSOE();
+    const std::vector<uint32_t> &bricks = solver.activeBricks();
+    threadPool.parallelFor((uint32_t)bricks.size(), 1, [&](uint32_t begin, uint32_t end)
+                           {
+        for (uint32_t n = begin; n < end; n++)
+        {
+            assembleBrick(n, deltaT);
+        } });
+    finishSOE(deltaT);
+}
+
+// advect and updateSOE as one task graph, with the same results as running them in turn. Each slab's phi and
+// velocities are separate tasks, the serial part of the assembly waits for phi alone, and the bricks of each
+// (bi, bj) column are assembled as soon as the velocity slabs they read are done, so the stages overlap instead of
+// meeting at barriers. Folding tall cells rewrites velocities, so then the serial part waits for those too.
+// Particles are moved between the phi and velocity passes and take the two stages in turn.
+void Grid::advectAndAssemble(float deltaT)
+{
+    beginStep(deltaT);
+
+    // particles move against the new phi and splat onto the nodes the velocity slabs read, and the fine phi of a
+    // refined surface overwrites band samples, so with either phi and those passes run ahead of the graph, each
+    // spread over the pool on its own
+    const bool particlesOn = options.particles != TRANSFER_NONE;
+    const bool phiAhead = particlesOn || options.refineSurface;
+    if (phiAhead)
+    {
+        threadPool.parallelFor((uint32_t)bandCells.size(), BAND_CELL_GRAIN, [&](uint32_t begin, uint32_t end)
+                               { advectPhi(begin, end, deltaT); });
+    }
+    if (options.refineSurface)
+    {
+        advectFine(deltaT);
+    }
+    if (particlesOn)
+    {
+        transferParticles(deltaT);
+    }
+    const TransferNode *transfer = particlesOn ? transferNodes.data() : nullptr;
+
+    const uint32_t columns = solver.bricksX() * solver.bricksY();
+    const bool tall = tallTop != tallBottom;
+    stepGraph.clear();
+    const uint32_t prepare = stepGraph.add([this, columns]
+                                           {
+        prepareSOE();
+        // the active bricks by (bi, bj) column, in activeBricks order within each
+        const std::vector<uint32_t> &bricks = solver.activeBricks();
+        columnStarts.assign(columns + 1, 0);
+        for (uint32_t brick : bricks)
+        {
+            columnStarts[solver.info(brick).bi * solver.bricksY() + solver.info(brick).bj + 1]++;
+        }
+        for (uint32_t column = 0; column < columns; column++)
+        {
+            columnStarts[column + 1] += columnStarts[column];
+        }
+        columnCursors.assign(columnStarts.begin(), columnStarts.end() - 1);
+        columnBricks.resize(bricks.size());
+        for (uint32_t n = 0; n < bricks.size(); n++)
+        {
+            columnBricks[columnCursors[solver.info(bricks[n]).bi * solver.bricksY() + solver.info(bricks[n]).bj]++] = n;
+        } });
+
+    // band cells are grouped by i slab
+    for (uint32_t i = 1; !phiAhead && i < Nx - 1; i++)
+    {
+        uint32_t begin = (uint32_t)(std::lower_bound(bandCells.begin(), bandCells.end(), i * NyNz) - bandCells.begin());
+        uint32_t end = (uint32_t)(std::lower_bound(bandCells.begin(), bandCells.end(), (i + 1) * NyNz) - bandCells.begin());
+        stepGraph.precede(stepGraph.add([this, begin, end, deltaT]
+                                        { advectPhi(begin, end, deltaT); }),
+                          prepare);
+    }
+
+    // slab Nx - 1 is a wall, only its faces in the tall cells are filled
+    velocityTasks.assign(Nx, 0);
+    for (uint32_t i = 1; i < Nx; i++)
+    {
+        velocityTasks[i] = stepGraph.add([this, i, tall, deltaT, transfer]
+                                         {
+            if (i < Nx - 1)
+            {
+                advectVelocitySlab(i, deltaT, transfer);
+            }
+            if (tall)
+            {
+                fillTallSlab(i);
+            } });
+        if (options.tallCells)
+        {
+            stepGraph.precede(velocityTasks[i], prepare);
+        }
+    }
+
+    // a brick's divergence reads the velocities of its own slabs and the first face of the next brick
+    for (uint32_t column = 0; column < columns; column++)
+    {
+        uint32_t assemble = stepGraph.add([this, column, deltaT]
+                                          {
+            for (uint32_t n = columnStarts[column]; n < columnStarts[column + 1]; n++)
+            {
+                assembleBrick(columnBricks[n], deltaT);
+            } });
+        stepGraph.precede(prepare, assemble);
+        uint32_t bi = column / solver.bricksY();
+        for (uint32_t i = std::max(bi * BRICK_SIZE, 1u); i <= std::min((bi + 1) * BRICK_SIZE, Nx - 1); i++)
+        {
+            stepGraph.precede(velocityTasks[i], assemble);
+        }
+    }
+
+    threadPool.run(stepGraph);
+    if (options.particles == TRANSFER_FLIP)
+    {
+        carryWallFaces(); // after the velocity slabs, which read the previous buffers
+    }
+    finishSOE(deltaT);
+}
+
+void Grid::projectAndMesh(float deltaT, SurfaceMesh *mesh)
+{
+    if (mesh != nullptr)
+    {
+        prepareSurface(*mesh);
+    }
+    const uint32_t columns = solver.bricksX() * solver.bricksY();
+    stepGraph.clear();
+
+    // the active bricks are those advectAndAssemble grouped into columns, and each face belongs to one brick
+    columnTasks.assign(columns, 0);
+    for (uint32_t column = 0; column < columns; column++)
+    {
+        columnTasks[column] = stepGraph.add([this, column, deltaT]
+                                            {
+            const std::vector<uint32_t> &bricks = solver.activeBricks();
+            for (uint32_t n = columnStarts[column]; n < columnStarts[column + 1]; n++)
+            {
+                projectBrick(bricks[columnBricks[n]], deltaT);
+            } });
+    }
+
+    // a slab's folded rows are interpolated from faces that its own bricks update, and for u also the bricks of
+    // the slab before
+    for (uint32_t i = 1; tallTop != tallBottom && i < Nx; i++)
+    {
+        uint32_t slab = stepGraph.add([this, i, deltaT]
+                                      {
+            if (i < Nx - 1)
+            {
+                projectTallSlab(i, deltaT);
+            }
+            fillTallSlab(i); });
+        uint32_t firstBi = (i - 1) >> BRICK_LOG2, lastBi = i >> BRICK_LOG2;
+        for (uint32_t bi = firstBi; bi <= lastBi; bi++)
+        {
+            for (uint32_t bj = 0; bj < solver.bricksY(); bj++)
+            {
+                stepGraph.precede(columnTasks[bi * solver.bricksY() + bj], slab);
+            }
+        }
+    }
+
+    // meshing reads phi only, so its slabs need not wait for any projection task; their commits follow each
+    // other in slab order
+    uint32_t previousCommit = UINT32_MAX;
+    for (uint32_t bi = 0; mesh != nullptr && bi < surfaceBricks[0]; bi++)
+    {
+        uint32_t march = stepGraph.add([this, bi, mesh]
+                                       { meshSurfaceSlab(bi, *mesh); });
+        uint32_t commit = stepGraph.add([this, bi, mesh]
+                                        { commitSurfaceSlab(bi, *mesh); });
+        stepGraph.precede(march, commit);
+        if (previousCommit != UINT32_MAX)
+        {
+            stepGraph.precede(previousCommit, commit);
+        }
+        previousCommit = commit;
+    }
+
+    threadPool.run(stepGraph);
+    if (options.particles != TRANSFER_NONE)
+    {
+        gatherParticles(deltaT);
+    }
+    if (mesh != nullptr)
+    {
+        finishSurface(*mesh);
+    }
+}
+
+// The serial part of the assembly, ahead of the per-brick pass: tall cells, the bricks to solve on, and which of
+// them have stale cell types. Reads phi but no velocities unless tall cells are folded.
+void Grid::prepareSOE()
+{
+    const FieldSpan phi = fields.current(FIELD_PHI);
+
+    updateTallCells();
+    updateSolverBricks(false);
+    updateCoarseBricks();
+    cellTypes.resize(solver.capacity());
+
+    // Outside the band phi does not change, so only band cells can have changed between air and fluid. Each one
+    // that did makes its brick, and the bricks holding it in their halo, stale.
+    const std::array<uint32_t, 3> brickCounts = {solver.bricksX(), solver.bricksY(), solver.bricksZ()};
+    auto markStale = [&](const std::array<uint32_t, 3> &b)
+    {
+        uint32_t brick = solver.find(b[0], b[1], b[2]);
+        if (brick != INVALID_BRICK && typesState[brick] == TYPES_CURRENT)
+        {
+            typesState[brick] = TYPES_STALE;
+        }
+    };
+    flippedCells = 0;
+    for (uint32_t base_index : bandCells)
+    {
+        uint64_t bit = 1ull << (base_index & 63);
+        bool fluid = phi[base_index] < 0.0f;
+        if (fluid == ((fluidCells[base_index >> 6] & bit) != 0))
+        {
+            continue;
+        }
+        fluidCells[base_index >> 6] ^= bit;
+        flippedCells++;
+
+        std::array<uint32_t, 3> cell = {base_index / NyNz, (base_index / Nz) % Ny, base_index % Nz};
+        std::array<uint32_t, 3> b = {cell[0] >> BRICK_LOG2, cell[1] >> BRICK_LOG2, cell[2] >> BRICK_LOG2};
+        markStale(b);
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            uint32_t local = cell[axis] & (BRICK_SIZE - 1);
+            std::array<uint32_t, 3> across = b;
+            if (local == 0 && b[axis] > 0)
+            {
+                across[axis]--;
+                markStale(across);
+            }
+            else if (local == BRICK_SIZE - 1 && b[axis] + 1 < brickCounts[axis])
+            {
+                across[axis]++;
+                markStale(across);
+            }
+        }
+    }
+
+    brickRowsRebuilt.resize(solver.activeBricks().size());
+    brickRowsChanged.resize(solver.activeBricks().size());
+}
+
+// Reports the assembly, and adds the divergence of the folded cells to the tall cells' top and bottom rows
+void Grid::finishSOE(float deltaT)
+{
+    const FieldSpan u_minus = fields.current(FIELD_U_MINUS);
+    const FieldSpan v_minus = fields.current(FIELD_V_MINUS);
+    const FieldSpan w_minus = fields.current(FIELD_W_MINUS);
+    const float CONST_FACTOR = RHO * CELL_WIDTH / deltaT;
+    const std::vector<uint32_t> &bricks = solver.activeBricks();
+
+    uint64_t rowsRebuilt = 0, rowsChanged = 0;
+    for (uint32_t n = 0; n < bricks.size(); n++)
+    {
+        rowsRebuilt += brickRowsRebuilt[n];
+        rowsChanged += brickRowsChanged[n];
+    }
+    uint64_t rows = (uint64_t)bricks.size() * BRICK_CELLS;
+    std::cout << "SOE assembly: " << flippedCells << " cells changed type, " << rowsChanged << " of " << rows << " rows changed ("
+              << (rows > 0 ? 100.0 * rowsChanged / rows : 0.0) << "%), " << rowsRebuilt << " reclassified" << std::endl;
+
+    if (tallTop == tallBottom)
+    {
+        return;
+    }
+
+    // The top and bottom cell of each column take the divergence of the folded cells, weighted by the linear
+    // pressure profile (1 - t and t). Velocities are linear over the span too, so the weighted sums reduce to the
+    // top and bottom rows; each folded cell's v difference is the same (vBottom - vTop) / (span - 1) and both
+    // weights sum to (span - 1) / 2. The brick pass above left out the face into the span, it is added here.
+    const uint32_t columnsZ = Nz - 2;
+    const float invSpan = 1.0f / (float)(tallBottom - tallTop);
+    tallSlots.resize(2 * (Nx - 2) * columnsZ);
+    tallJacobi.resize(tallSlots.size());
+    threadPool.parallelFor(Nx - 2, 1, [&](uint32_t begin, uint32_t end)
+                           {
+        auto slot = [&](uint32_t i, uint32_t j, uint32_t k)
+        {
+            uint32_t brick = solver.find(i >> BRICK_LOG2, j >> BRICK_LOG2, k >> BRICK_LOG2);
+            return brick * BRICK_CELLS + brickCell(i & (BRICK_SIZE - 1), j & (BRICK_SIZE - 1), k & (BRICK_SIZE - 1));
+        };
+        float *D = solver.data(SOLVER_D, 0);
+        for (uint32_t i = begin + 1; i < end + 1; i++)
+        {
+            for (uint32_t k = 1; k < Nz - 1; k++)
+            {
+                uint32_t column = (i - 1) * columnsZ + k - 1;
+                uint32_t topSlot = tallSlots[2 * column] = slot(i, tallTop, k);
+                uint32_t bottomSlot = tallSlots[2 * column + 1] = slot(i, tallBottom, k);
+
+                // the brick stencil sees the span (and the floor under the bottom cell) as solid
+                uint32_t walls = (i == 1) + (i == Nx - 2) + (k == 1) + (k == Nz - 2);
+                float coupling = tallSame * (float)(4 - walls) + invSpan;
+                tallJacobi[2 * column] = 6.0f / ((float)(5 - walls) + coupling);
+                tallJacobi[2 * column + 1] = 6.0f / ((float)(4 - walls) + coupling);
+
+                auto horizontal = [&](uint32_t base_index)
+                {
+                    float d = 0.0f;
+                    if (i > 1)
+                    {
+                        d -= u_minus[base_index];
+                    }
+                    if (i < Nx - 2)
+                    {
+                        d += u_minus[base_index + NyNz];
+                    }
+                    if (k > 1)
+                    {
+                        d -= w_minus[base_index];
+                    }
+                    if (k < Nz - 2)
+                    {
+                        d += w_minus[base_index + 1];
+                    }
+                    return d;
+                };
+                uint32_t top = i * NyNz + tallTop * Nz + k;
+                uint32_t bottom = i * NyNz + tallBottom * Nz + k;
+                float hTop = horizontal(top);
+                float hBottom = horizontal(bottom);
+                float vTop = v_minus[top + Nz];
+                float vBottom = v_minus[bottom];
+                float vertical = 0.5f * (vBottom - vTop);
+                D[topSlot] -= CONST_FACTOR * (vTop + tallSame * hTop + tallCross * hBottom + vertical);
+                D[bottomSlot] -= CONST_FACTOR * (-vBottom + tallCross * hTop + tallSame * hBottom + vertical);
+            }
+        } });
+
+    // the slots again with a ring of ghost columns, each repeating the interior column next to it
+    tallHalo.resize(2 * Nx * Nz);
+    for (uint32_t i = 0; i < Nx; i++)
+    {
+        for (uint32_t k = 0; k < Nz; k++)
+        {
+            uint32_t column = (std::clamp(i, 1u, Nx - 2) - 1) * columnsZ + std::clamp(k, 1u, Nz - 2) - 1;
+            tallHalo[2 * (i * Nz + k)] = tallSlots[2 * column];
+            tallHalo[2 * (i * Nz + k) + 1] = tallSlots[2 * column + 1];
+        }
+    }
+
+    uint64_t folded = (uint64_t)(tallBottom - tallTop - 1) * (Nx - 2) * columnsZ;
+    uint64_t interior = (uint64_t)(Nx - 2) * (Ny - 2) * columnsZ;
+    std::cout << "Tall cells: rows " << tallTop + 1 << "-" << tallBottom - 1 << " folded, " << folded << " of " << interior
+              << " interior cells (" << 100.0 * folded / interior << "%)" << std::endl;
+}
+
+// Row n of the active bricks: cell types where stale, and the divergence of every fluid cell
+void Grid::assembleBrick(uint32_t n, float deltaT)
+{
+    const float CONST_FACTOR = RHO * CELL_WIDTH / deltaT;
+    constexpr uint32_t BRICK_ROW = ((1u << BRICK_SIZE) - 1) << 1; // bits of a tile row that are inside the brick
+    const FieldSpan phi = fields.current(FIELD_PHI);
+    const FieldSpan u_minus = fields.current(FIELD_U_MINUS);
+    const FieldSpan v_minus = fields.current(FIELD_V_MINUS);
+    const FieldSpan w_minus = fields.current(FIELD_W_MINUS);
+    const std::vector<uint32_t> &bricks = solver.activeBricks();
+    uint32_t brick = bricks[n];
+    const BrickInfo &brickInfo = solver.info(brick);
+    float *D = solver.data(SOLVER_D, brick);
+    float *pressures = solver.data(SOLVER_PRESSURE, brick);
+
+    if (isCoarse(brick))
+    {
+        // an aggregate's row sums the rows of its cells: the net outflow through its 24 boundary faces,
+        // halved like its pressure
+        brickRowsRebuilt[n] = 0;
+        brickRowsChanged[n] = 0;
+        for (uint32_t ci = 0; ci < COARSE_SIZE; ci++)
+        {
+            for (uint32_t cj = 0; cj < COARSE_SIZE; cj++)
+            {
+                for (uint32_t ck = 0; ck < COARSE_SIZE; ck++)
+                {
+                    uint32_t i = brickInfo.bi * BRICK_SIZE + 2 * ci;
+                    uint32_t j = brickInfo.bj * BRICK_SIZE + 2 * cj;
+                    uint32_t k = brickInfo.bk * BRICK_SIZE + 2 * ck;
+                    float d = 0.0f;
+                    for (uint32_t a = 0; a < 2; a++)
+                    {
+                        for (uint32_t b = 0; b < 2; b++)
+                        {
+                            d += u_minus[(i + 2) * NyNz + (j + a) * Nz + k + b] - u_minus[i * NyNz + (j + a) * Nz + k + b];
+                            d += v_minus[(i + a) * NyNz + (j + 2) * Nz + k + b] - v_minus[(i + a) * NyNz + j * Nz + k + b];
+                            d += w_minus[(i + a) * NyNz + (j + b) * Nz + k + 2] - w_minus[(i + a) * NyNz + (j + b) * Nz + k];
+                        }
+                    }
+                    D[coarseCell(ci, cj, ck)] = -0.5f * CONST_FACTOR * d;
+                }
+            }
+        }
+        return;
+    }
+
+    // walls are the outermost layer of cells, fluid is any other cell with phi < 0. Away from the band the
+    // classification cannot change, so only stale bricks are reclassified.
+    BrickCellTypes &types = cellTypes[brick];
+    brickRowsRebuilt[n] = 0;
+    brickRowsChanged[n] = 0;
+    if (typesState[brick] != TYPES_CURRENT)
+    {
+        bool unset = typesState[brick] == TYPES_UNSET;
+        typesState[brick] = TYPES_CURRENT;
+        BrickCellTypes previous = types;
+        types.fluid.fill(0);
+        types.solid.fill(0);
+        for (uint32_t ti = 0; ti < BRICK_TILE_SIZE; ti++)
+        {
+            for (uint32_t tj = 0; tj < BRICK_TILE_SIZE; tj++)
+            {
+                for (uint32_t tk = 0; tk < BRICK_TILE_SIZE; tk++)
+                {
+                    // unsigned wrap puts the halo below cell 0 out of range as well
+                    uint32_t i = brickInfo.bi * BRICK_SIZE + ti - 1;
+                    uint32_t j = brickInfo.bj * BRICK_SIZE + tj - 1;
+                    uint32_t k = brickInfo.bk * BRICK_SIZE + tk - 1;
+                    uint32_t row = ti * BRICK_TILE_SIZE + tj;
+                    bool interior = i >= 1 && i <= Nx - 2 && j >= 1 && j <= Ny - 2 && k >= 1 && k <= Nz - 2;
+                    if (!interior || inTallCell(j))
+                    {
+                        types.solid[row] |= 1u << tk;
+                    }
+                    else if (phi[i * NyNz + j * Nz + k] < 0.0f)
+                    {
+                        types.fluid[row] |= 1u << tk;
+                    }
+                }
+            }
+        }
+
+        // a row of A changes when its own cell type or any neighbour's does
+        brickRowsRebuilt[n] = BRICK_CELLS;
+        brickRowsChanged[n] = BRICK_CELLS;
+        if (!unset)
+        {
+            std::array<uint32_t, BRICK_TILE_SIZE * BRICK_TILE_SIZE> changed;
+            for (uint32_t row = 0; row < changed.size(); row++)
+            {
+                changed[row] = (previous.fluid[row] ^ types.fluid[row]) | (previous.solid[row] ^ types.solid[row]);
+            }
+            brickRowsChanged[n] = 0;
+            for (uint32_t ti = 1; ti <= BRICK_SIZE; ti++)
+            {
+                for (uint32_t tj = 1; tj <= BRICK_SIZE; tj++)
+                {
+                    uint32_t row = ti * BRICK_TILE_SIZE + tj;
+                    uint32_t stencil = changed[row] | (changed[row] << 1) | (changed[row] >> 1) | changed[row - 1] | changed[row + 1] |
+                                       changed[row - BRICK_TILE_SIZE] | changed[row + BRICK_TILE_SIZE];
+                    brickRowsChanged[n] += __builtin_popcount(stencil & BRICK_ROW);
+                }
+            }
+        }
+    }
+
+    // A face into a solid cell carries no flow. Its term is weighted by the face's open bit rather than skipped, so
+    // each row is one straight loop; the tile's halo holds the neighbours' types, the wall layer included.
+    const uint32_t kEnd = std::min(BRICK_SIZE, Nz - 1 - brickInfo.bk * BRICK_SIZE); // cells from Nz - 1 on are never fluid
+    for (uint32_t li = 0; li < BRICK_SIZE; li++)
+    {
+        for (uint32_t lj = 0; lj < BRICK_SIZE; lj++)
+        {
+            uint32_t row = (li + 1) * BRICK_TILE_SIZE + lj + 1;
+            uint32_t fluid = types.fluid[row];
+            float *dRow = D + brickCell(li, lj, 0);
+            float *pressureRow = pressures + brickCell(li, lj, 0);
+            if ((fluid & BRICK_ROW) == 0) // only care about fluid cells, air pressure is zero
+            {
+                std::fill_n(dRow, BRICK_SIZE, 0.0f);
+                std::fill_n(pressureRow, BRICK_SIZE, 0.0f);
+                continue;
+            }
+            uint32_t solid = types.solid[row];
+            uint32_t solidI[2] = {types.solid[row - BRICK_TILE_SIZE], types.solid[row + BRICK_TILE_SIZE]};
+            uint32_t solidJ[2] = {types.solid[row - 1], types.solid[row + 1]};
+            uint32_t base_index = (brickInfo.bi * BRICK_SIZE + li) * NyNz + (brickInfo.bj * BRICK_SIZE + lj) * Nz + brickInfo.bk * BRICK_SIZE;
+            for (uint32_t lk = 0; lk < kEnd; lk++)
+            {
+                uint32_t b = lk + 1;
+                uint32_t cell = base_index + lk;
+                float d = 0.0f;
+                d -= (float)((~solidI[0] >> b) & 1) * u_minus[cell];        // left
+                d += (float)((~solidI[1] >> b) & 1) * u_minus[cell + NyNz]; // right
+                d -= (float)((~solidJ[0] >> b) & 1) * v_minus[cell];        // top
+                d += (float)((~solidJ[1] >> b) & 1) * v_minus[cell + Nz];   // bottom
+                d -= (float)((~solid >> (b - 1)) & 1) * w_minus[cell];      // front
+                d += (float)((~solid >> (b + 1)) & 1) * w_minus[cell + 1];  // back
+                bool isFluid = (fluid >> b) & 1;
+                dRow[lk] = isFluid ? -CONST_FACTOR * d : 0.0f;
+                pressureRow[lk] = isFluid ? pressureRow[lk] : 0.0f;
+            }
+            std::fill(dRow + kEnd, dRow + BRICK_SIZE, 0.0f);
+            std::fill(pressureRow + kEnd, pressureRow + BRICK_SIZE, 0.0f);
+        }
+    }
+}
+
+// Runs the statements over every active brick in one pass: each brick binds them, then evaluate walks its cells.
+// The sums are added in brick order, so the total does not depend on the thread count.
+template <typename... Statements>
+float Grid::solverPass(const Statements &...statements)
+{
+    const std::vector<uint32_t> &bricks = solver.activeBricks();
+    brickPartials.resize(bricks.size());
+    threadPool.parallelFor((uint32_t)bricks.size(), std::min({Statements::GRAIN...}), [&](uint32_t begin, uint32_t end)
+                           {
+        std::tuple<Statements...> bound(statements...); // binding rewrites the channels' pointers
+        std::apply([&](auto &...statement)
+                   {
+            for (uint32_t n = begin; n < end; n++)
+            {
+                (statement.begin(solver, bricks[n]), ...);
+                brickPartials[n] = evaluate(solverCells(bricks[n]), statement...);
+            } }, bound); });
+
+    float total = 0.0f;
+    for (float partial : brickPartials)
+    {
+        total += partial;
+    }
+    return total;
+}
+
+void Grid::solveSOE()
+{
+    solveStart = std::chrono::steady_clock::now();
+    solveCut = false;
+    if (options.pressureSolver == PRESSURE_CHEBYSHEV)
+    {
+        solveChebyshev();
+        return;
+    }
+
+    // Conjugate Gradient Algorithm. The rows of tall cells are Jacobi-preconditioned, z = r everywhere else, so
+    // without tall cells this is plain CG.
+    const Channel pressure(SOLVER_PRESSURE), d(SOLVER_D), r(SOLVER_RESIDUAL), p(SOLVER_CONJUGATE), ap(SOLVER_AP);
+    uint32_t iterations = 0;
+    float r_dot_r = 0.0f;
+    float r_dot_z = 0.0f;
+
+    mulA(SOLVER_PRESSURE, SOLVER_AP);
+    r_dot_r = solverPass(r = d - ap, p = r, sum(r * r)); // r = D - A*pressure, p = z, r_dot_r = r*r
+    r_dot_z = r_dot_r + tallResidual(SOLVER_RESIDUAL);   // r_dot_z = r*z
+    tallPrecondition(SOLVER_RESIDUAL, SOLVER_CONJUGATE);
+    std::cout << "(" << iterations << ") R^2 = " << r_dot_r << std::endl;
+
+    while ((r_dot_r / (Nx * NyNz) > effort.solveTolerance) && iterations < MAX_ITERATIONS)
+    {
+        if (solveOverBudget(iterations))
+        {
+            stopAtDeadline(iterations, r_dot_r); // the latest iterate has the smallest error in the A-norm so far
+            return;
+        }
+        // three passes per iteration: Ap with p*Ap, the pressure and residual updates with r*r, and p
+        float pAp = tallProduct(SOLVER_CONJUGATE, SOLVER_AP, solverPass(product(p, ap), sum(p * ap)));
+        float alpha = r_dot_z / pAp;
+        r_dot_r = solverPass(pressure += alpha * p, r -= alpha * ap, sum(r * r));
+        float new_r_dot_z = r_dot_r + tallResidual(SOLVER_RESIDUAL);
+        float beta = new_r_dot_z / r_dot_z;
+        r_dot_z = new_r_dot_z;
+
+        solverPass(p = r + beta * p); // p = z + beta*p
+        tallPrecondition(SOLVER_RESIDUAL, SOLVER_CONJUGATE);
+
+        iterations++;
+        std::cout << "(" << iterations << ") R^2/cell = " << r_dot_r / (Nx * NyNz) << std::endl;
+    }
+}
+
+// One clock read per iteration, next to a product over every solver cell
+bool Grid::solveOverBudget(uint32_t iterations) const
+{
+    if (effort.solveBudget <= 0.0 || iterations == 0)
+    {
+        return false;
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - solveStart).count();
+    return elapsed * (iterations + 1) / iterations > effort.solveBudget;
+}
+
+void Grid::stopAtDeadline(uint32_t iterations, float r_dot_r)
+{
+    solveCut = true;
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - solveStart).count();
+    std::cout << "Solve deadline: stopped after " << iterations << " iterations in " << elapsed * 1000.0 << " ms, R^2/cell = " << r_dot_r / (Nx * NyNz)
+              << std::endl;
+}
+
+// Eigenvalue of a symmetric tridiagonal matrix by bisection, index 0 being the smallest. The number of eigenvalues
+// below x is the number of negative pivots of T - xI (Sturm count).
+static double tridiagonalEigenvalue(const std::vector<double> &diagonal, const std::vector<double> &offDiagonal, uint32_t index)
+{
+    const size_t n = diagonal.size();
+    double lower = diagonal[0];
+    double upper = diagonal[0];
+    for (size_t row = 0; row < n; row++)
+    {
+        double radius = (row > 0 ? std::abs(offDiagonal[row - 1]) : 0.0) + (row + 1 < n ? std::abs(offDiagonal[row]) : 0.0);
+        lower = std::min(lower, diagonal[row] - radius);
+        upper = std::max(upper, diagonal[row] + radius);
+    }
+    for (uint32_t step = 0; step < 64; step++)
+    {
+        double x = 0.5 * (lower + upper);
+        uint32_t below = 0;
+        double pivot = 1.0;
+        for (size_t row = 0; row < n; row++)
+        {
+            pivot = diagonal[row] - x - (row > 0 ? offDiagonal[row - 1] * offDiagonal[row - 1] / pivot : 0.0);
+            if (pivot == 0.0)
+            {
+                pivot = 1e-300;
+            }
+            below += pivot < 0.0;
+        }
+        if (below > index)
+        {
+            upper = x;
+        }
+        else
+        {
+            lower = x;
+        }
+    }
+    return 0.5 * (lower + upper);
+}
+
+// Chebyshev iteration on the Jacobi-preconditioned system. Its only global sums are in the CG steps that start it,
+// whose coefficients are the Lanczos tridiagonal of D^-1 A; the extreme Ritz values bound the spectrum the
+// iteration damps. It then costs one product and one fused update per iteration, and the residual is only
+// summed every CHEBYSHEV_CHECK_INTERVAL iterations.
+void Grid::solveChebyshev()
+{
+    double lambdaMax = updateInverseDiagonal();
+    const float tolerance = effort.solveTolerance * (float)(Nx * NyNz);
+    const Channel pressure(SOLVER_PRESSURE), d(SOLVER_D), r(SOLVER_RESIDUAL), p(SOLVER_CONJUGATE), ap(SOLVER_AP);
+    const Channel inverse(SOLVER_INV_DIAGONAL);
+
+    uint32_t iterations = 0;
+    float r_dot_r = 0.0f;
+    float r_dot_z = 0.0f;
+    // r = D - A*pressure, p = D^-1 r
+    auto restart = [&]()
+    {
+        mulA(SOLVER_PRESSURE, SOLVER_AP);
+        r_dot_r = solverPass(r = d - ap, sum(r * r));
+        r_dot_z = solverPass(p = inverse * r, sum(r * r * inverse));
+    };
+    // Jacobi-preconditioned CG until the tolerance or limit iterations, passing each step's alpha and beta to
+    // record. Returns false if it stopped at the deadline.
+    auto conjugateGradient = [&](uint32_t limit, auto &&record)
+    {
+        while (r_dot_r > tolerance && iterations < limit)
+        {
+            if (solveOverBudget(iterations))
+            {
+                stopAtDeadline(iterations, r_dot_r);
+                return false;
+            }
+            float pAp = tallProduct(SOLVER_CONJUGATE, SOLVER_AP, solverPass(product(p, ap), sum(p * ap)));
+            if (!(pAp > 0.0f))
+            {
+                break;
+            }
+            float alpha = r_dot_z / pAp;
+            r_dot_r = solverPass(pressure += alpha * p, r -= alpha * ap, sum(r * r));
+            float new_r_dot_z = solverPass(sum(r * r * inverse));
+            float beta = new_r_dot_z / r_dot_z;
+            r_dot_z = new_r_dot_z;
+            solverPass(p = inverse * r + beta * p);
+            record(alpha, beta);
+            iterations++;
+            std::cout << "(" << iterations << ") R^2/cell = " << r_dot_r / (Nx * NyNz) << std::endl;
+        }
+        return true;
+    };
+
+    restart();
+    std::cout << "(0) R^2 = " << r_dot_r << std::endl;
+
+    // the first CG steps record the Lanczos coefficients
+    std::vector<double> lanczosDiagonal;
+    std::vector<double> lanczosOffDiagonal;
+    double previousAlpha = 1.0;
+    double previousBeta = 0.0;
+    bool inTime = conjugateGradient(LANCZOS_ITERATIONS, [&](float alpha, float beta)
+                                    {
+        lanczosDiagonal.push_back(1.0 / alpha + previousBeta / previousAlpha);
+        lanczosOffDiagonal.push_back(std::sqrt(std::max((double)beta, 0.0)) / alpha);
+        previousAlpha = alpha;
+        previousBeta = beta; });
+    if (!inTime || r_dot_r <= tolerance || lanczosDiagonal.empty())
+    {
+        return;
+    }
+
+    // An upper bound below the largest eigenvalue makes the iteration diverge, so it comes from Gershgorin rather
+    // than the Ritz values, which approach it from below and miss the tall rows' modes. The lower bound is the
+    // smallest Ritz value scaled by CHEBYSHEV_MIN_SCALE, see there.
+    lanczosOffDiagonal.pop_back();
+    double lambdaMin = std::clamp(CHEBYSHEV_MIN_SCALE * tridiagonalEigenvalue(lanczosDiagonal, lanczosOffDiagonal, 0), 1e-6 * lambdaMax, 0.5 * lambdaMax);
+    double theta = 0.5 * (lambdaMax + lambdaMin);
+    double delta = 0.5 * (lambdaMax - lambdaMin);
+    double sigma = theta / delta;
+    double rho = 1.0 / sigma;
+    std::cout << "Chebyshev: eigenvalues in [" << lambdaMin << ", " << lambdaMax << "] after " << iterations << " CG steps" << std::endl;
+
+    // With the whole spectrum below lambdaMax, whatever lambdaMin is, every step shrinks the residual in the D^-1
+    // norm, r * D^-1 r. Checked against where the CG steps left it, a larger value means the bounds do not hold for
+    // this system, and CG finishes the solve from the current pressure.
+    const float startNorm = r_dot_z;
+    solverPass(p = (float)(1.0 / theta) * inverse * r); // the first step, D^-1 r / theta, is kept in p
+    uint32_t sinceCheck = 0;
+    while (iterations < MAX_ITERATIONS)
+    {
+        if (solveOverBudget(iterations))
+        {
+            stopAtDeadline(iterations, sinceCheck > 0 ? solverPass(sum(r * r)) : r_dot_r);
+            return;
+        }
+        mulA(SOLVER_CONJUGATE, SOLVER_AP);
+        double nextRho = 1.0 / (2.0 * sigma - rho);
+        float gamma = (float)(2.0 * nextRho / delta);
+        float beta = (float)(nextRho * rho);
+        // one pass between two products: the step is added to the pressure before it is replaced
+        solverPass(pressure += p, r -= ap, p = gamma * inverse * r + beta * p);
+        rho = nextRho;
+        iterations++;
+        if (++sinceCheck == CHEBYSHEV_CHECK_INTERVAL || iterations == MAX_ITERATIONS)
+        {
+            sinceCheck = 0;
+            r_dot_r = solverPass(sum(r * r));
+            std::cout << "(" << iterations << ") R^2/cell = " << r_dot_r / (Nx * NyNz) << std::endl;
+            if (r_dot_r <= tolerance)
+            {
+                break;
+            }
+            float norm = solverPass(sum(r * r * inverse));
+            if (!(norm <= startNorm))
+            {
+                std::cout << "Chebyshev: residual grew from " << startNorm << " to " << norm << " in the D^-1 norm, continuing with CG" << std::endl;
+                restart();
+                conjugateGradient(MAX_ITERATIONS, [](float, float) {});
+                return;
+            }
+        }
+    }
+}
+
+// 1 / the diagonal of A, 0 on rows that are all zeros. Coarse aggregates have the plain Laplacian's 6, tall
+// slots the diagonal their Jacobi weights were made from. Returns a Gershgorin bound on the eigenvalues of D^-1 A,
+// the largest 1 + (sum of |off-diagonal|) / diagonal over the rows.
+double Grid::updateInverseDiagonal()
+{
+    const std::vector<uint32_t> &bricks = solver.activeBricks();
+    brickPartials.resize(bricks.size());
+    threadPool.parallelFor((uint32_t)bricks.size(), 4, [&](uint32_t begin, uint32_t end)
+                           {
+        for (uint32_t n = begin; n < end; n++)
+        {
+            uint32_t brick = bricks[n];
+            float *inverse = solver.data(SOLVER_INV_DIAGONAL, brick);
+            brickPartials[n] = 2.0f; // a fine row's neighbours weigh at most its diagonal
+            if (isCoarse(brick))
+            {
+                // across a face with fine cells an aggregate couples to four of them at 1/2 each, and an aggregate
+                // touches one face per axis at most
+                uint32_t fineAxes = 0;
+                const BrickInfo &brickInfo = solver.info(brick);
+                for (uint32_t axis = 0; axis < 3; axis++)
+                {
+                    bool fine = false;
+                    for (uint32_t side = 0; side < 2; side++)
+                    {
+                        uint32_t neighbor = brickInfo.neighbors[2 * axis + side];
+                        fine = fine || (neighbor != INVALID_BRICK && !isCoarse(neighbor));
+                    }
+                    fineAxes += fine;
+                }
+                std::fill_n(inverse, COARSE_CELLS, 1.0f / 6.0f);
+                brickPartials[n] = 1.0f + (6.0f + (float)fineAxes) / 6.0f;
+                continue;
+            }
+            const BrickCellTypes &types = cellTypes[brick];
+            for (uint32_t li = 0; li < BRICK_SIZE; li++)
+            {
+                for (uint32_t lj = 0; lj < BRICK_SIZE; lj++)
+                {
+                    uint32_t row = (li + 1) * BRICK_TILE_SIZE + lj + 1;
+                    uint32_t fluid = types.fluid[row];
+                    uint32_t solid = types.solid[row];
+                    uint32_t solidI[2] = {types.solid[row - BRICK_TILE_SIZE], types.solid[row + BRICK_TILE_SIZE]};
+                    uint32_t solidJ[2] = {types.solid[row - 1], types.solid[row + 1]};
+                    float *inverseRow = inverse + brickCell(li, lj, 0);
+                    for (uint32_t lk = 0; lk < BRICK_SIZE; lk++)
+                    {
+                        uint32_t b = lk + 1;
+                        uint32_t solidNeighbors = ((solidI[1] >> b) & 1) + ((solidI[0] >> b) & 1) + ((solidJ[1] >> b) & 1) +
+                                                  ((solidJ[0] >> b) & 1) + ((solid >> (b + 1)) & 1) + ((solid >> (b - 1)) & 1);
+                        inverseRow[lk] = ((fluid >> b) & 1) ? 1.0f / (float)(6 - solidNeighbors) : 0.0f;
+                    }
+                }
+            }
+        } });
+
+    double bound = 2.0;
+    for (float partial : brickPartials)
+    {
+        bound = std::max(bound, (double)partial);
+    }
+    if (tallTop == tallBottom)
+    {
+        return bound;
+    }
+
+    // a tall row couples to its brick neighbours, to both cells of each neighbouring column, and to the other
+    // cell of its own column by tallCross per neighbouring column less the span's vertical term
+    const uint32_t columnsZ = Nz - 2;
+    const float invSpan = 1.0f / (float)(tallBottom - tallTop);
+    float *inverse = solver.data(SOLVER_INV_DIAGONAL, 0);
+    for (uint32_t n = 0; n < tallSlots.size(); n++)
+    {
+        inverse[tallSlots[n]] = tallJacobi[n] / 6.0f;
+        uint32_t i = n / 2 / columnsZ + 1;
+        uint32_t k = n / 2 % columnsZ + 1;
+        float columns = (float)(4 - (i == 1) - (i == Nx - 2) - (k == 1) - (k == Nz - 2));
+        float diagonal = 6.0f / tallJacobi[n];
+        float coupling = tallSame * columns + invSpan;
+        float offDiagonal = (diagonal - coupling) + (tallSame + tallCross) * columns + std::abs(tallCross * columns - invSpan);
+        bound = std::max(bound, 1.0 + offDiagonal / diagonal);
+    }
+    return bound;
+}
+
+// The tall rows of A carry the folded cells' couplings, about span / 3 per neighbour column, and would dominate
+// the spectrum unscaled. z = jacobi * r on their slots is applied as a correction to z = r.
+float Grid::tallResidual(uint32_t r)
+{
+    if (tallTop == tallBottom)
+    {
+        return 0.0f;
+    }
+    const float *rValues = solver.data(r, 0);
+    float sum = 0.0f;
+    for (uint32_t n = 0; n < tallSlots.size(); n++)
+    {
+        float value = rValues[tallSlots[n]];
+        sum += (tallJacobi[n] - 1.0f) * value * value;
+    }
+    return sum;
+}
+
+uint32_t Grid::solverCells(uint32_t brick) const
+{
+    return isCoarse(brick) ? COARSE_CELLS : BRICK_CELLS;
+}
+
+// Decides which liquid bricks are coarse. A brick without band cells has one sign throughout, so a liquid brick
+// with none in it or its face neighbours is water with water on every side. Bricks along the walls and above the
+// tall cells stay fine, the aggregates' stencil has no solid faces. Switching converts the pressure, which warm
+// starts the next solve; the other channels are rewritten before they are read.
+void Grid::updateCoarseBricks()
+{
+    if (!options.coarseBricks)
+    {
+        return;
+    }
+    const FieldSpan phi = fields.current(FIELD_PHI);
+    const std::array<uint32_t, 3> brickCounts = {solver.bricksX(), solver.bricksY(), solver.bricksZ()};
+    brickCoarse.resize(solver.capacity(), 0);
+    brickNearBand.resize((size_t)brickCounts[0] * brickCounts[1] * brickCounts[2], 0);
+
+    nearBandBricks.clear();
+    auto mark = [&](const std::array<uint32_t, 3> &b)
+    {
+        uint32_t rootIndex = (b[0] * brickCounts[1] + b[1]) * brickCounts[2] + b[2];
+        if (!brickNearBand[rootIndex])
+        {
+            brickNearBand[rootIndex] = 1;
+            nearBandBricks.push_back(rootIndex);
+        }
+    };
+    for (uint32_t base_index : bandCells)
+    {
+        mark({(base_index / NyNz) >> BRICK_LOG2, ((base_index / Nz) % Ny) >> BRICK_LOG2, (base_index % Nz) >> BRICK_LOG2});
+    }
+    size_t banded = nearBandBricks.size();
+    for (size_t n = 0; n < banded; n++)
+    {
+        uint32_t rootIndex = nearBandBricks[n];
+        std::array<uint32_t, 3> b = {rootIndex / (brickCounts[1] * brickCounts[2]), (rootIndex / brickCounts[2]) % brickCounts[1], rootIndex % brickCounts[2]};
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            std::array<uint32_t, 3> across = b;
+            if (b[axis] > 0)
+            {
+                across[axis] = b[axis] - 1;
+                mark(across);
+            }
+            if (b[axis] + 1 < brickCounts[axis])
+            {
+                across[axis] = b[axis] + 1;
+                mark(across);
+            }
+        }
+    }
+
+    uint32_t coarseBricks = 0;
+    std::array<float, BRICK_CELLS> values;
+    for (uint32_t brick : solver.activeBricks())
+    {
+        const BrickInfo &brickInfo = solver.info(brick);
+        std::array<uint32_t, 3> b = {brickInfo.bi, brickInfo.bj, brickInfo.bk};
+        bool coarse = !brickNearBand[(b[0] * brickCounts[1] + b[1]) * brickCounts[2] + b[2]] && (b[1] + 1) * BRICK_SIZE <= tallTop &&
+                      phi[b[0] * BRICK_SIZE * NyNz + b[1] * BRICK_SIZE * Nz + b[2] * BRICK_SIZE] < 0.0f;
+        for (uint32_t axis = 0; axis < 3; axis++)
+        {
+            coarse = coarse && b[axis] >= 1 && b[axis] + 2 <= brickCounts[axis];
+        }
+        coarseBricks += coarse;
+        if (coarse == (brickCoarse[brick] != 0))
+        {
+            continue;
+        }
+
+        brickCoarse[brick] = coarse;
+        float *pressures = solver.data(SOLVER_PRESSURE, brick);
+        std::copy_n(pressures, BRICK_CELLS, values.data());
+        if (coarse)
+        {
+            std::fill_n(pressures, COARSE_CELLS, 0.0f);
+            for (uint32_t li = 0; li < BRICK_SIZE; li++)
+            {
+                for (uint32_t lj = 0; lj < BRICK_SIZE; lj++)
+                {
+                    for (uint32_t lk = 0; lk < BRICK_SIZE; lk++)
+                    {
+                        pressures[coarseCell(li >> 1, lj >> 1, lk >> 1)] += 0.25f * values[brickCell(li, lj, lk)]; // twice the mean
+                    }
+                }
+            }
+        }
+        else
+        {
+            for (uint32_t li = 0; li < BRICK_SIZE; li++)
+            {
+                for (uint32_t lj = 0; lj < BRICK_SIZE; lj++)
+                {
+                    for (uint32_t lk = 0; lk < BRICK_SIZE; lk++)
+                    {
+                        pressures[brickCell(li, lj, lk)] = 0.5f * values[coarseCell(li >> 1, lj >> 1, lk >> 1)];
+                    }
+                }
+            }
+            typesState[brick] = TYPES_UNSET; // not kept up to date while coarse
+        }
+    }
+    for (uint32_t rootIndex : nearBandBricks)
+    {
+        brickNearBand[rootIndex] = 0;
+    }
+
+    uint64_t cells = (uint64_t)coarseBricks * COARSE_CELLS + (uint64_t)(solver.activeBricks().size() - coarseBricks) * BRICK_CELLS;
+    std::cout << "Coarse bricks: " << coarseBricks << " of " << solver.activeBricks().size() << ", " << cells << " solver cells for "
+              << (uint64_t)solver.activeBricks().size() * BRICK_CELLS << std::endl;
+}
+
+// Overwrites the halo faces a fine brick shares with coarse bricks by the pressure of the aggregate each halo
+// cell lies in
+void Grid::patchCoarseHalo(uint32_t channel, uint32_t brick, float *tile) const
+{
+    if (brickCoarse.empty())
+    {
+        return;
+    }
+    const BrickInfo &brickInfo = solver.info(brick);
+    for (uint32_t face = 0; face < BRICK_FACE_COUNT; face++)
+    {
+        uint32_t neighbor = brickInfo.neighbors[face];
+        if (!isCoarse(neighbor))
+        {
+            continue;
+        }
+        const float *source = solver.data(channel, neighbor);
+        uint32_t axis = face / 2;
+        uint32_t tileLayer = (face & 1) ? BRICK_SIZE + 1 : 0;
+        uint32_t sourceLayer = (face & 1) ? 0 : COARSE_SIZE - 1;
+        for (uint32_t a = 0; a < BRICK_SIZE; a++)
+        {
+            for (uint32_t b = 0; b < BRICK_SIZE; b++)
+            {
+                if (axis == 0)
+                {
+                    tile[tileCell(tileLayer, a + 1, b + 1)] = 0.5f * source[coarseCell(sourceLayer, a >> 1, b >> 1)];
+                }
+                else if (axis == 1)
+                {
+                    tile[tileCell(a + 1, tileLayer, b + 1)] = 0.5f * source[coarseCell(a >> 1, sourceLayer, b >> 1)];
+                }
+                else
+                {
+                    tile[tileCell(a + 1, b + 1, tileLayer)] = 0.5f * source[coarseCell(a >> 1, b >> 1, sourceLayer)];
+                }
+            }
+        }
+    }
+}
+
+// Stages a coarse brick's aggregates with a one-aggregate halo. Across a face with fine cells, a halo aggregate
+// holds half the sum of the four cells touching it, which is what the Galerkin coupling weighs them by.
+void Grid::loadCoarseTile(uint32_t channel, uint32_t brick, float *tile) const
+{
+    std::fill_n(tile, COARSE_TILE_CELLS, 0.0f);
+    const float *center = solver.data(channel, brick);
+    for (uint32_t ci = 0; ci < COARSE_SIZE; ci++)
+    {
+        for (uint32_t cj = 0; cj < COARSE_SIZE; cj++)
+        {
+            std::copy_n(&center[coarseCell(ci, cj, 0)], COARSE_SIZE, &tile[coarseTileCell(ci + 1, cj + 1, 1)]);
+        }
+    }
+
+    const BrickInfo &brickInfo = solver.info(brick);
+    for (uint32_t face = 0; face < BRICK_FACE_COUNT; face++)
+    {
+        uint32_t neighbor = brickInfo.neighbors[face];
+        if (neighbor == INVALID_BRICK)
+        {
+            continue;
+        }
+        const float *source = solver.data(channel, neighbor);
+        bool coarse = isCoarse(neighbor);
+        uint32_t axis = face / 2;
+        uint32_t tileLayer = (face & 1) ? COARSE_SIZE + 1 : 0;
+        uint32_t sourceLayer = (face & 1) ? 0 : (coarse ? COARSE_SIZE - 1 : BRICK_SIZE - 1);
+        for (uint32_t a = 0; a < COARSE_SIZE; a++)
+        {
+            for (uint32_t b = 0; b < COARSE_SIZE; b++)
+            {
+                std::array<uint32_t, 3> at;
+                at[axis] = tileLayer;
+                at[axis == 0 ? 1 : 0] = a + 1;
+                at[axis == 2 ? 1 : 2] = b + 1;
+                float value = 0.0f;
+                if (coarse)
+                {
+                    std::array<uint32_t, 3> c;
+                    c[axis] = sourceLayer;
+                    c[axis == 0 ? 1 : 0] = a;
+                    c[axis == 2 ? 1 : 2] = b;
+                    value = source[coarseCell(c[0], c[1], c[2])];
+                }
+                else
+                {
+                    for (uint32_t da = 0; da < 2; da++)
+                    {
+                        for (uint32_t db = 0; db < 2; db++)
+                        {
+                            std::array<uint32_t, 3> l;
+                            l[axis] = sourceLayer;
+                            l[axis == 0 ? 1 : 0] = 2 * a + da;
+                            l[axis == 2 ? 1 : 2] = 2 * b + db;
+                            value += 0.5f * source[brickCell(l[0], l[1], l[2])];
+                        }
+                    }
+                }
+                tile[coarseTileCell(at[0], at[1], at[2])] = value;
+            }
+        }
+    }
+}
+
+// Adds the preconditioner's correction on the tall slots to p, which was just set from r
+void Grid::tallPrecondition(uint32_t r, uint32_t p)
+{
+    if (tallTop == tallBottom)
+    {
+        return;
+    }
+    const float *rValues = solver.data(r, 0);
+    float *pValues = solver.data(p, 0);
+    for (uint32_t n = 0; n < tallSlots.size(); n++)
+    {
+        pValues[tallSlots[n]] += (tallJacobi[n] - 1.0f) * rValues[tallSlots[n]];
+    }
+}
+
+// result = A * x
+void Grid::mulA(uint32_t x, uint32_t result)
+{
+    solverPass(product(Channel(x), Channel(result)));
+    tallProduct(x, result, 0.0f);
+}
+
+// Matrix-free 7-point product over one brick. A fluid row has the number of non-solid neighbours on the diagonal
+// and -1 for each fluid neighbour; other rows are zero. The stencil comes from the brick's cell types, and x is
+// staged in a haloed tile, so neighbours in other bricks need no special cases. Tall cells add a column term
+// afterwards, see tallProduct.
+void Grid::mulBrick(uint32_t x, uint32_t result, uint32_t brick)
+{
+    constexpr uint32_t STRIDE_I = BRICK_TILE_SIZE * BRICK_TILE_SIZE;
+    constexpr uint32_t STRIDE_J = BRICK_TILE_SIZE;
+    constexpr uint32_t BRICK_ROW = ((1u << BRICK_SIZE) - 1) << 1; // bits of a tile row that are inside the brick
+    constexpr uint32_t TILE_ROW = (1u << BRICK_TILE_SIZE) - 1;
+    static thread_local std::array<float, BRICK_TILE_CELLS> xTile;
+    static thread_local std::array<float, COARSE_TILE_CELLS> coarseTile;
+    float *out = solver.data(result, brick);
+    if (isCoarse(brick))
+    {
+        // aggregates are water on every side, scaled so the stencil is the plain Laplacian
+        loadCoarseTile(x, brick, coarseTile.data());
+        constexpr uint32_t COARSE_STRIDE_I = COARSE_TILE_SIZE * COARSE_TILE_SIZE;
+        for (uint32_t ci = 0; ci < COARSE_SIZE; ci++)
+        {
+            for (uint32_t cj = 0; cj < COARSE_SIZE; cj++)
+            {
+                for (uint32_t ck = 0; ck < COARSE_SIZE; ck++)
+                {
+                    const float *xCell = coarseTile.data() + coarseTileCell(ci + 1, cj + 1, ck + 1);
+                    out[coarseCell(ci, cj, ck)] = 6.0f * xCell[0] - xCell[COARSE_STRIDE_I] - xCell[-(int)COARSE_STRIDE_I] -
+                                                  xCell[COARSE_TILE_SIZE] - xCell[-(int)COARSE_TILE_SIZE] - xCell[1] - xCell[-1];
+                }
+            }
+        }
+        return;
+    }
+    solver.loadTile(x, brick, xTile.data());
+    patchCoarseHalo(x, brick, xTile.data());
+    const BrickCellTypes &types = cellTypes[brick];
+
+    for (uint32_t li = 0; li < BRICK_SIZE; li++)
+    {
+        for (uint32_t lj = 0; lj < BRICK_SIZE; lj++)
+        {
+            // the k neighbours are the adjacent bits of the same row word
+            uint32_t row = (li + 1) * BRICK_TILE_SIZE + lj + 1;
+            uint32_t fluid = types.fluid[row];
+            uint32_t fluidI[2] = {types.fluid[row - BRICK_TILE_SIZE], types.fluid[row + BRICK_TILE_SIZE]};
+            uint32_t fluidJ[2] = {types.fluid[row - 1], types.fluid[row + 1]};
+            uint32_t solid = types.solid[row];
+            uint32_t solidI[2] = {types.solid[row - BRICK_TILE_SIZE], types.solid[row + BRICK_TILE_SIZE]};
+            uint32_t solidJ[2] = {types.solid[row - 1], types.solid[row + 1]};
+            float *outRow = out + brickCell(li, lj, 0);
+            const float *xRow = xTile.data() + tileCell(li + 1, lj + 1, 1);
+            const float *xMinusI = xRow - STRIDE_I;
+            const float *xPlusI = xRow + STRIDE_I;
+            const float *xMinusJ = xRow - STRIDE_J;
+            const float *xPlusJ = xRow + STRIDE_J;
+            const float *xMinusK = xRow - 1;
+            const float *xPlusK = xRow + 1;
+
+            if ((fluid & BRICK_ROW) == 0)
+            {
+                std::fill_n(outRow, BRICK_SIZE, 0.0f);
+                continue;
+            }
+            if ((fluid & TILE_ROW) == TILE_ROW && (fluidI[0] & fluidI[1] & fluidJ[0] & fluidJ[1] & BRICK_ROW) == BRICK_ROW)
+            {
+                // fluid all round: the stencil is the plain Laplacian
+                for (uint32_t lk = 0; lk < BRICK_SIZE; lk++)
+                {
+                    float val = 6.0f * xRow[lk];
+                    val -= xPlusI[lk];
+                    val -= xPlusJ[lk];
+                    val -= xPlusK[lk];
+                    val -= xMinusI[lk];
+                    val -= xMinusJ[lk];
+                    val -= xMinusK[lk];
+                    outRow[lk] = val;
+                }
+            }
+            else
+            {
+                for (uint32_t lk = 0; lk < BRICK_SIZE; lk++)
+                {
+                    uint32_t b = lk + 1;
+                    uint32_t solidNeighbors = ((solidI[1] >> b) & 1) + ((solidI[0] >> b) & 1) + ((solidJ[1] >> b) & 1) +
+                                              ((solidJ[0] >> b) & 1) + ((solid >> (b + 1)) & 1) + ((solid >> (b - 1)) & 1);
+                    float val = (float)(6 - solidNeighbors) * xRow[lk];
+                    val -= (float)((fluidI[1] >> b) & 1) * xPlusI[lk];
+                    val -= (float)((fluidJ[1] >> b) & 1) * xPlusJ[lk];
+                    val -= (float)((fluid >> (b + 1)) & 1) * xPlusK[lk];
+                    val -= (float)((fluidI[0] >> b) & 1) * xMinusI[lk];
+                    val -= (float)((fluidJ[0] >> b) & 1) * xMinusJ[lk];
+                    val -= (float)((fluid >> (b - 1)) & 1) * xMinusK[lk];
+                    outRow[lk] = ((fluid >> b) & 1) ? val : 0.0f; // rows of non-fluid cells are all zeros
+                }
+            }
+
+#ifndef NDEBUG
+            // debug builds (make DEBUG=1) stop at the first product that is not finite
+            for (uint32_t lk = 0; lk < BRICK_SIZE; lk++)
+            {
+                if (std::isnan(outRow[lk]) || std::isinf(outRow[lk]))
+                {
+                    const BrickInfo &brickInfo = solver.info(brick);
+                    std::cout << "i,j,k: " << brickInfo.bi * BRICK_SIZE + li << ", " << brickInfo.bj * BRICK_SIZE + lj << ", " << brickInfo.bk * BRICK_SIZE + lk << std::endl;
+                    std::cout << "x[base]: " << xRow[lk] << std::endl;
+                    std::cout << "x[base + i]: " << xPlusI[lk] << std::endl;
+                    std::cout << "x[base + j]: " << xPlusJ[lk] << std::endl;
+                    std::cout << "x[base + k]: " << xPlusK[lk] << std::endl;
+                    std::cout << "x[base - i]: " << xMinusI[lk] << std::endl;
+                    std::cout << "x[base - j]: " << xMinusJ[lk] << std::endl;
+                    std::cout << "x[base - k]: " << xMinusK[lk] << std::endl;
+                    std::cout << "result: " << outRow[lk] << std::endl;
+                    std::abort();
+                }
+            }
+#endif
+        }
+    }
+}
+
+// Column term of the tall cells: the Galerkin product of the folded cells' Laplacian with the linear profile.
+// The horizontal faces of the folded rows couple top and bottom cells of neighbouring columns, the span's
+// vertical faces couple a column's top and bottom cell with weight 1 / span. Returns total plus x * (the term),
+// added slab by slab in slab order.
+float Grid::tallProduct(uint32_t x, uint32_t result, float total)
+{
+    if (tallTop == tallBottom)
+    {
+        return total;
+    }
+    const float invSpan = 1.0f / (float)(tallBottom - tallTop);
+    slabPartials.assign(Nx - 2, 0.0f);
+    threadPool.parallelFor(Nx - 2, 1, [&](uint32_t begin, uint32_t end)
+                           {
+        const float *xValues = solver.data(x, 0);
+        float *out = solver.data(result, 0);
+        const uint32_t *slots = tallHalo.data();
+        for (uint32_t i = begin + 1; i < end + 1; i++)
+        {
+            float partial = 0.0f;
+            for (uint32_t k = 1; k < Nz - 1; k++)
+            {
+                // a ghost column's x is the column's own, so the wall terms vanish without a branch
+                uint32_t slot = 2 * (i * Nz + k);
+                const uint32_t neighbors[4] = {slot - 2 * Nz, slot + 2 * Nz, slot - 2, slot + 2};
+                float xTop = xValues[slots[slot]];
+                float xBottom = xValues[slots[slot + 1]];
+                float gradTop = 0.0f;
+                float gradBottom = 0.0f;
+                for (uint32_t neighbor : neighbors)
+                {
+                    gradTop += xTop - xValues[slots[neighbor]];
+                    gradBottom += xBottom - xValues[slots[neighbor + 1]];
+                }
+                float vertical = (xTop - xBottom) * invSpan;
+                float addTop = tallSame * gradTop + tallCross * gradBottom + vertical;
+                float addBottom = tallCross * gradTop + tallSame * gradBottom - vertical;
+                out[slots[slot]] += addTop;
+                out[slots[slot + 1]] += addBottom;
+                partial += xTop * addTop + xBottom * addBottom;
+            }
+            slabPartials[i - 1] = partial;
+        } });
+    for (float partial : slabPartials)
+    {
+        total += partial;
+    }
+    return total;
+}
+
+void Grid::project(float deltaT)
+{
+    const std::vector<uint32_t> &bricks = solver.activeBricks();
+    threadPool.parallelFor((uint32_t)bricks.size(), 1, [&](uint32_t begin, uint32_t end)
+                           {
+        for (uint32_t n = begin; n < end; n++)
+        {
+            projectBrick(bricks[n], deltaT);
+        } });
+
+    if (tallTop != tallBottom)
+    {
+        projectTallCells(deltaT);
+    }
+    if (options.particles != TRANSFER_NONE)
+    {
+        gatherParticles(deltaT);
+    }
+}
+
+// Faces are updated by the brick of the cell on their + side, or by the brick on their - side when that cell has
+// no brick or is in a coarse brick, so each face belongs to one brick; faces with air on both sides see no pressure
+// gradient. v faces inside the tall cells are left to the column pass.
+void Grid::projectBrick(uint32_t brick, float deltaT)
+{
+    const FieldSpan u_minus_new = fields.current(FIELD_U_MINUS);
+    const FieldSpan v_minus_new = fields.current(FIELD_V_MINUS);
+    const FieldSpan w_minus_new = fields.current(FIELD_W_MINUS);
+    const float CONST_FACTOR = deltaT / (RHO * CELL_WIDTH);
+    constexpr uint32_t STRIDE_I = BRICK_TILE_SIZE * BRICK_TILE_SIZE;
+    constexpr uint32_t STRIDE_J = BRICK_TILE_SIZE;
+    static thread_local std::array<float, BRICK_TILE_CELLS> pressures;
+
+    const BrickInfo &brickInfo = solver.info(brick);
+    if (isCoarse(brick))
+    {
+        // faces between two aggregates; the faces inside one see no gradient
+        const float *coarse = solver.data(SOLVER_PRESSURE, brick);
+        const std::array<FieldSpan, 3> faces = {u_minus_new, v_minus_new, w_minus_new};
+        for (uint32_t li = 0; li < BRICK_SIZE; li++)
+        {
+            for (uint32_t lj = 0; lj < BRICK_SIZE; lj++)
+            {
+                for (uint32_t lk = 0; lk < BRICK_SIZE; lk++)
+                {
+                    uint32_t base_index = (brickInfo.bi * BRICK_SIZE + li) * NyNz + (brickInfo.bj * BRICK_SIZE + lj) * Nz + brickInfo.bk * BRICK_SIZE + lk;
+                    std::array<uint32_t, 3> local = {li, lj, lk};
+                    std::array<uint32_t, 3> c = {li >> 1, lj >> 1, lk >> 1};
+                    float here = coarse[coarseCell(c[0], c[1], c[2])];
+                    for (uint32_t axis = 0; axis < 3; axis++)
+                    {
+                        if (local[axis] & 1)
+                        {
+                            continue;
+                        }
+                        std::array<uint32_t, 3> across = c;
+                        const float *source = coarse;
+                        if (local[axis] == 0)
+                        {
+                            uint32_t neighbor = brickInfo.neighbors[2 * axis];
+                            if (!isCoarse(neighbor)) // fine cell on the - side, its brick has the face
+                            {
+                                continue;
+                            }
+                            source = solver.data(SOLVER_PRESSURE, neighbor);
+                            across[axis] = COARSE_SIZE - 1;
+                        }
+                        else
+                        {
+                            across[axis]--;
+                        }
+                        float other = source[coarseCell(across[0], across[1], across[2])];
+                        faces[axis][base_index] -= 0.5f * CONST_FACTOR * (here - other);
+                    }
+                }
+            }
+        }
+        return;
+    }
+    solver.loadTile(SOLVER_PRESSURE, brick, pressures.data());
+    patchCoarseHalo(SOLVER_PRESSURE, brick, pressures.data());
+    bool openI = brickInfo.neighbors[BRICK_PLUS_I] == INVALID_BRICK || isCoarse(brickInfo.neighbors[BRICK_PLUS_I]);
+    bool openJ = brickInfo.neighbors[BRICK_PLUS_J] == INVALID_BRICK || isCoarse(brickInfo.neighbors[BRICK_PLUS_J]);
+    bool openK = brickInfo.neighbors[BRICK_PLUS_K] == INVALID_BRICK || isCoarse(brickInfo.neighbors[BRICK_PLUS_K]);
+
+    // each row of cells updates the faces on its - side as one expression over k, the faces past the brick's last
+    // row, column and cell follow when no fine brick beyond has them
+    const uint32_t kFirst = std::max(brickInfo.bk * BRICK_SIZE, 1u);
+    const uint32_t kEnd = std::min(brickInfo.bk * BRICK_SIZE + BRICK_SIZE, Nz);
+    const uint32_t count = kEnd - kFirst;
+    for (uint32_t li = 0; li < BRICK_SIZE; li++)
+    {
+        uint32_t i = brickInfo.bi * BRICK_SIZE + li;
+        if (i < 1 || i >= Nx)
+        {
+            continue;
+        }
+        for (uint32_t lj = 0; lj < BRICK_SIZE; lj++)
+        {
+            uint32_t j = brickInfo.bj * BRICK_SIZE + lj;
+            if (j < 1 || j >= Ny)
+            {
+                continue;
+            }
+            uint32_t base_index = i * NyNz + j * Nz + kFirst;
+            const float *row = pressures.data() + tileCell(li + 1, lj + 1, kFirst - brickInfo.bk * BRICK_SIZE + 1);
+            const Values p(row);
+            const FieldRow u(u_minus_new, base_index), v(v_minus_new, base_index), w(w_minus_new, base_index);
+            if (j <= tallTop || j > tallBottom)
+            {
+                evaluate(count, u -= CONST_FACTOR * (p - Values(row - STRIDE_I)), v -= CONST_FACTOR * (p - Values(row - STRIDE_J)),
+                         w -= CONST_FACTOR * (p - Values(row - 1)));
+            }
+            else
+            {
+                evaluate(count, u -= CONST_FACTOR * (p - Values(row - STRIDE_I)), w -= CONST_FACTOR * (p - Values(row - 1)));
+            }
+
+            if (openI && li == BRICK_SIZE - 1 && i + 1 < Nx)
+            {
+                evaluate(count, FieldRow(u_minus_new, base_index + NyNz) -= CONST_FACTOR * (Values(row + STRIDE_I) - p));
+            }
+            if (openJ && lj == BRICK_SIZE - 1 && j + 1 < Ny && (j + 1 <= tallTop || j + 1 > tallBottom))
+            {
+                evaluate(count, FieldRow(v_minus_new, base_index + Nz) -= CONST_FACTOR * (Values(row + STRIDE_J) - p));
+            }
+            if (openK && kEnd == brickInfo.bk * BRICK_SIZE + BRICK_SIZE && kEnd < Nz)
+            {
+                const Values last(row + count - 1);
+                evaluate(1, FieldRow(w_minus_new, base_index + count) -= CONST_FACTOR * (Values(row + count) - last));
+            }
+        }
+    }
+}
+
+// The linear pressure profile has the same gradient across every v face in the span, and shifts the u and w
+// faces of the folded rows linearly between the top and bottom rows, so only the span's end faces are
+// updated and the rest re-interpolated.
+void Grid::projectTallCells(float deltaT)
+{
+    threadPool.parallelFor(Nx - 2, 1, [&](uint32_t begin, uint32_t end)
+                           {
+        for (uint32_t i = begin + 1; i < end + 1; i++)
+        {
+            projectTallSlab(i, deltaT);
+        } });
+    fillTallVelocities();
+}
+
+// The span's end v faces of slab i's columns
+void Grid::projectTallSlab(uint32_t i, float deltaT)
+{
+    const FieldSpan v_minus_new = fields.current(FIELD_V_MINUS);
+    const float CONST_FACTOR = deltaT / (RHO * CELL_WIDTH);
+    const uint32_t columnsZ = Nz - 2;
+    const float *pressures = solver.data(SOLVER_PRESSURE, 0);
+    const float gradientFactor = CONST_FACTOR / (float)(tallBottom - tallTop);
+    for (uint32_t k = 1; k < Nz - 1; k++)
+    {
+        uint32_t column = (i - 1) * columnsZ + k - 1;
+        float gradient = gradientFactor * (pressures[tallSlots[2 * column + 1]] - pressures[tallSlots[2 * column]]);
+        v_minus_new[i * NyNz + (tallTop + 1) * Nz + k] -= gradient;
+        v_minus_new[i * NyNz + tallBottom * Nz + k] -= gradient;
+    }
+}
+
+// Godunov upwind solution of |grad phi| = 1 given the closest neighbour distance along each axis, width apart
+static inline float solveEikonal(float a, float b, float c, float width)
+{
+    // sorting network so a <= b <= c without the data-dependent selection branches
+    float t = std::min(a, b);
+    b = std::max(a, b);
+    a = t;
+    t = std::min(b, c);
+    c = std::max(b, c);
+    b = t;
+    t = std::min(a, b);
+    b = std::max(a, b);
+    a = t;
+
+    float x = a + width;
+    if (x > b)
+    {
+        float determinant2 = 2.0f * width * width - (a - b) * (a - b);
+        x = 0.5f * (a + b + std::sqrt(std::max(determinant2, 0.0f)));
+        if (x > c)
+        {
+            float sum = a + b + c;
+            float determinant3 = sum * sum - 3.0f * (a * a + b * b + c * c - width * width);
+            x = (sum + std::sqrt(std::max(determinant3, 0.0f))) / 3.0f;
+        }
+    }
+    return x;
+}
+
+// Fast sweeping reinitialisation of phi to a signed distance, restricted to the band list.
+// Cells next to a sign change keep their value and seed the sweeps; the 8 sweep orderings each propagate
+// distance along one diagonal octant. Within a sweep, cells on the same i+j+k hyperplane never neighbour
+// each other, so each hyperplane is updated in parallel and the result matches a serial Gauss-Seidel sweep.
+// Between the steps effort.reinitInterval picks, phi is only advected and the two sweeps that extrapolate
+// velocities run alone.
+void Grid::smoothSurface()
+{
+    const FieldSpan phi = fields.current(FIELD_PHI);
+    const uint32_t bandSize = (uint32_t)bandCells.size();
+    const bool redistance = frame % std::max(effort.reinitInterval, 1u) == 0;
+
+    threadPool.parallelFor(bandSize, BAND_CELL_GRAIN, [&](uint32_t begin, uint32_t end)
+                           {
+        for (uint32_t n = begin; n < end; n++)
+        {
+            uint32_t base_index = bandCells[n];
+            bool negative = phi[base_index] < 0.0f;
+            bool interface = (phi[base_index - NyNz] < 0.0f) != negative || (phi[base_index + NyNz] < 0.0f) != negative ||
+                             (phi[base_index - Nz] < 0.0f) != negative || (phi[base_index + Nz] < 0.0f) != negative ||
+                             (phi[base_index - 1] < 0.0f) != negative || (phi[base_index + 1] < 0.0f) != negative;
+            reinitFlags[base_index] = interface ? REINIT_INTERFACE : REINIT_BAND;
+        } });
+
+    // everything but the interface is reset to the band width and recomputed by the sweeps
+    if (redistance)
+    {
+        threadPool.parallelFor(bandSize, BAND_CELL_GRAIN, [&](uint32_t begin, uint32_t end)
+                               {
+            for (uint32_t n = begin; n < end; n++)
+            {
+                uint32_t base_index = bandCells[n];
+                if (reinitFlags[base_index] == REINIT_BAND)
+                {
+                    phi[base_index] = std::copysign(NARROW_BAND_WIDTH, phi[base_index]);
+                }
+            } });
+    }
+
+    // both extrapolating sweeps use ordering 0
+    sortSweepOrders(redistance ? 4 : 1);
+
+    for (uint32_t sweep = 0; sweep < 8; sweep++)
+    {
+        if (!redistance && sweep != 0 && sweep != 7)
+        {
+            continue;
+        }
+        // opposite octants visit the same hyperplanes in reverse
+        const uint32_t order = sweep < 4 ? sweep : 7 - sweep;
+        const bool reverse = sweep >= 4;
+        // the all-forward and all-backward sweeps also carry velocities out into the air
+        const int extrapolate = sweep == 0 ? 1 : sweep == 7 ? -1 : 0;
+
+        const uint32_t planeCount = (uint32_t)planeStarts[order].size() - 1;
+        for (uint32_t p = 0; p < planeCount; p++)
+        {
+            uint32_t plane = reverse ? planeCount - 1 - p : p;
+            uint32_t first = planeStarts[order][plane];
+            uint32_t count = planeStarts[order][plane + 1] - first;
+            const uint32_t *cells = sweepOrders[order].data() + first;
+            threadPool.parallelFor(count, BAND_CELL_GRAIN, [&](uint32_t begin, uint32_t end)
+                                   {
+                for (uint32_t n = begin; n < end; n++)
+                {
+                    uint32_t base_index = cells[n];
+                    if (redistance && reinitFlags[base_index] == REINIT_BAND)
+                    {
+                        float x = solveEikonal(std::min(std::abs(phi[base_index - NyNz]), std::abs(phi[base_index + NyNz])),
+                                               std::min(std::abs(phi[base_index - Nz]), std::abs(phi[base_index + Nz])),
+                                               std::min(std::abs(phi[base_index - 1]), std::abs(phi[base_index + 1])), CELL_WIDTH);
+                        if (x < std::abs(phi[base_index]))
+                        {
+                            phi[base_index] = std::copysign(x, phi[base_index]);
+                        }
+                    }
+                    if (extrapolate != 0 && phi[base_index] > 0.0f)
+                    {
+                        extrapolateVelocity(base_index, extrapolate);
+                    }
+                } });
+        }
+    }
+
+    updateBand();
+    if (options.refineSurface)
+    {
+        redistanceFine();
+        updateFineBricks(false);
+    }
+}
+
+// Buckets the band cells by i+j+k hyperplane for the first orderCount of the four sweep orderings that start
+// from a different corner. Order bits 0 and 1 reverse i and j; k always runs forward here, and the four octants
+// with k reversed sweep the same plane list backwards.
+void Grid::sortSweepOrders(uint32_t orderCount)
+{
+    const uint32_t planeCount = (Nx - 2) + (Ny - 2) + (Nz - 2) - 2;
+    threadPool.parallelFor(orderCount, 1, [&](uint32_t begin, uint32_t end)
+                           {
+        for (uint32_t order = begin; order < end; order++)
+        {
+            auto planeOf = [order](uint32_t base_index)
+            {
+                uint32_t i = base_index / NyNz;
+                uint32_t j = (base_index / Nz) % Ny;
+                uint32_t k = base_index % Nz;
+                uint32_t a = (order & 1) ? Nx - 2 - i : i - 1;
+                uint32_t b = (order & 2) ? Ny - 2 - j : j - 1;
+                return a + b + k - 1;
+            };
+
+            // counting sort, each hyperplane keeps the band list's order
+            std::vector<uint32_t> &cellPlanes = sweepPlanes[order];
+            std::vector<uint32_t> &starts = planeStarts[order];
+            cellPlanes.resize(bandCells.size());
+            starts.assign(planeCount + 1, 0);
+            for (uint32_t n = 0; n < bandCells.size(); n++)
+            {
+                cellPlanes[n] = planeOf(bandCells[n]);
+                starts[cellPlanes[n] + 1]++;
+            }
+            for (uint32_t plane = 0; plane < planeCount; plane++)
+            {
+                starts[plane + 1] += starts[plane];
+            }
+
+            std::vector<uint32_t> cursor(starts.begin(), starts.end() - 1);
+            sweepOrders[order].resize(bandCells.size());
+            for (uint32_t n = 0; n < bandCells.size(); n++)
+            {
+                sweepOrders[order][cursor[cellPlanes[n]]++] = bandCells[n];
+            }
+        } });
+}
+
+// Rebuilds the band list: cells closer than NARROW_BAND_WIDTH plus a one-cell halo that the surface can move into
+// during the next step. Cells that drop out are clamped in both buffers so advect never has to touch them again.
+void Grid::updateBand()
+{
+    const FieldSpan phi = fields.current(FIELD_PHI);
+    const FieldSpan phi_previous = fields.previous(FIELD_PHI);
+
+    bandCore.clear();
+    for (uint32_t base_index : bandCells)
+    {
+        if (reinitFlags[base_index] == REINIT_INTERFACE || std::abs(phi[base_index]) < NARROW_BAND_WIDTH)
+        {
+            bandCore.push_back(base_index);
+        }
+        else
+        {
+            phi[base_index] = std::copysign(NARROW_BAND_WIDTH, phi[base_index]);
+            phi_previous[base_index] = phi[base_index];
+        }
+        reinitFlags[base_index] = REINIT_FAR;
+    }
+
+    // the core is in index order, so its neighbours come out nearly sorted; bucketing them by i slab
+    // is enough to keep advect and the sweeps walking memory forwards, without a full sort
+    bandUnsorted.clear();
+    slabStarts.assign(Nx + 1, 0);
+    for (uint32_t base_index : bandCore)
+    {
+        uint32_t i = base_index / NyNz;
+        uint32_t j = (base_index / Nz) % Ny;
+        uint32_t k = base_index % Nz;
+        std::array<uint32_t, 7> candidates = {i > 1 ? base_index - NyNz : base_index,
+                                              j > 1 ? base_index - Nz : base_index,
+                                              k > 1 ? base_index - 1 : base_index,
+                                              base_index,
+                                              k < Nz - 2 ? base_index + 1 : base_index,
+                                              j < Ny - 2 ? base_index + Nz : base_index,
+                                              i < Nx - 2 ? base_index + NyNz : base_index};
+        for (uint32_t candidate : candidates)
+        {
+            if (reinitFlags[candidate] == REINIT_FAR)
+            {
+                reinitFlags[candidate] = REINIT_BAND;
+                bandUnsorted.push_back(candidate);
+                slabStarts[candidate / NyNz + 1]++;
+            }
+        }
+    }
+    for (uint32_t i = 0; i < Nx; i++)
+    {
+        slabStarts[i + 1] += slabStarts[i];
+    }
+    bandCells.resize(bandUnsorted.size());
+    for (uint32_t base_index : bandUnsorted)
+    {
+        bandCells[slabStarts[base_index / NyNz]++] = base_index;
+    }
+}
+
+// Starts the band from scratch, for a freshly initialised or restored phi. Blocks the min/max pyramid puts
+// entirely outside the band are clamped directly instead of going through the band list.
+void Grid::resetBand()
+{
+    const FieldSpan phi = fields.current(FIELD_PHI);
+    const FieldSpan phi_previous = fields.previous(FIELD_PHI);
+
+    rebuildPhiRanges();
+    std::fill(reinitFlags.begin(), reinitFlags.end(), REINIT_FAR);
+    bandCells.clear();
+    for (uint32_t i = 1; i < Nx - 1; i++)
+    {
+        for (uint32_t j = 1; j < Ny - 1; j++)
+        {
+            const uint32_t superRow = ((i >> (SURFACE_BRICK_LOG2 + PHI_SUPER_BRICK_LOG2)) * phiSuperBricks[1] + (j >> (SURFACE_BRICK_LOG2 + PHI_SUPER_BRICK_LOG2))) * phiSuperBricks[2];
+            const uint32_t blockRow = ((i >> PHI_BLOCK_LOG2) * phiBlocks[1] + (j >> PHI_BLOCK_LOG2)) * phiBlocks[2];
+            for (uint32_t k = 1; k < Nz - 1;)
+            {
+                uint32_t kEnd = std::min(((k >> PHI_BLOCK_LOG2) + 1) << PHI_BLOCK_LOG2, Nz - 1);
+                bool near = nearSurface(superBrickRanges[superRow + (k >> (SURFACE_BRICK_LOG2 + PHI_SUPER_BRICK_LOG2))], NARROW_BAND_WIDTH) &&
+                            nearSurface(blockRanges[blockRow + (k >> PHI_BLOCK_LOG2)], NARROW_BAND_WIDTH);
+                for (; k < kEnd; k++)
+                {
+                    uint32_t base_index = i * NyNz + j * Nz + k;
+                    if (near)
+                    {
+                        bandCells.push_back(base_index);
+                        reinitFlags[base_index] = REINIT_BAND;
+                    }
+                    else
+                    {
+                        phi[base_index] = std::copysign(NARROW_BAND_WIDTH, phi[base_index]);
+                        phi_previous[base_index] = phi[base_index];
+                    }
+                }
+            }
+        }
+    }
+    updateBand();
+}
+
+// Phi at fine node (I, J, K) of the fine values fine: the node's own value in a refined brick, elsewhere the
+// samples of phi interpolated
+float Grid::fineNode(const float *fine, const FieldSpan &phi, uint32_t I, uint32_t J, uint32_t K) const
+{
+    const uint32_t bi = I >> FINE_BRICK_LOG2, bj = J >> FINE_BRICK_LOG2, bk = K >> FINE_BRICK_LOG2;
+    if (bi < surfaceBricks[0] && bj < surfaceBricks[1] && bk < surfaceBricks[2])
+    {
+        const uint32_t slot = fineSlots[(bi * surfaceBricks[1] + bj) * surfaceBricks[2] + bk];
+        if (slot != NO_FINE_SLOT)
+        {
+            constexpr uint32_t mask = FINE_BRICK_SIZE - 1;
+            return fine[(size_t)slot * FINE_BRICK_VALUES + fineCell(I & mask, J & mask, K & mask)];
+        }
+    }
+    return interpolateCoarse(phi, I, J, K);
+}
+
+// count fine nodes from (I, J, K) on along k, as fineNode gives them. Nodes past the lattice repeat its last node.
+void Grid::fineRow(const float *fine, const FieldSpan &phi, uint32_t I, uint32_t J, uint32_t K, uint32_t count, float *out) const
+{
+    constexpr uint32_t mask = FINE_BRICK_SIZE - 1;
+    const uint32_t bi = I >> FINE_BRICK_LOG2, bj = J >> FINE_BRICK_LOG2;
+    const bool inside = bi < surfaceBricks[0] && bj < surfaceBricks[1];
+    while (count > 0)
+    {
+        // the nodes of one brick at a time
+        const uint32_t bk = K >> FINE_BRICK_LOG2;
+        const uint32_t run = std::min(count, FINE_BRICK_SIZE - (K & mask));
+        const uint32_t slot = inside && bk < surfaceBricks[2] ? fineSlots[(bi * surfaceBricks[1] + bj) * surfaceBricks[2] + bk] : NO_FINE_SLOT;
+        if (slot != NO_FINE_SLOT)
+        {
+            std::copy_n(fine + (size_t)slot * FINE_BRICK_VALUES + fineCell(I & mask, J & mask, K & mask), run, out);
+        }
+        else
+        {
+            for (uint32_t n = 0; n < run; n++)
+            {
+                out[n] = interpolateCoarse(phi, I, J, std::min(K + n, FINE_LAST_NODE[2]));
+            }
+        }
+        K += run;
+        out += run;
+        count -= run;
+    }
+}
+
+// Trilinear sample of fine phi at (x, y, z) in fine nodes, reading the block directly when the eight nodes are in
+// one refined brick
+float Grid::sampleFine(const float *fine, const FieldSpan &phi, float x, float y, float z) const
+{
+    const uint32_t I = static_cast<uint32_t>(x), J = static_cast<uint32_t>(y), K = static_cast<uint32_t>(z);
+    const float i_beta = x - (float)I, j_beta = y - (float)J, k_beta = z - (float)K;
+    constexpr uint32_t mask = FINE_BRICK_SIZE - 1;
+    const uint32_t bi = I >> FINE_BRICK_LOG2, bj = J >> FINE_BRICK_LOG2, bk = K >> FINE_BRICK_LOG2;
+    uint32_t slot = NO_FINE_SLOT;
+    if ((I & mask) < mask && (J & mask) < mask && (K & mask) < mask && bi < surfaceBricks[0] && bj < surfaceBricks[1] && bk < surfaceBricks[2])
+    {
+        slot = fineSlots[(bi * surfaceBricks[1] + bj) * surfaceBricks[2] + bk];
+    }
+
+    // corner bit 0 steps i, bit 1 j and bit 2 k
+    std::array<float, 8> c;
+    if (slot != NO_FINE_SLOT)
+    {
+        constexpr uint32_t S = FINE_BRICK_SIZE;
+        const float *v = fine + (size_t)slot * FINE_BRICK_VALUES + fineCell(I & mask, J & mask, K & mask);
+        c = {v[0], v[S * S], v[S], v[S * S + S], v[1], v[S * S + 1], v[S + 1], v[S * S + S + 1]};
+    }
+    else
+    {
+        for (uint32_t corner = 0; corner < 8; corner++)
+        {
+            c[corner] = fineNode(fine, phi, I + (corner & 1), J + ((corner >> 1) & 1), K + (corner >> 2));
+        }
+    }
+    const float i_alpha = 1.0f - i_beta, j_alpha = 1.0f - j_beta, k_alpha = 1.0f - k_beta;
+    const float param_ij0 = j_alpha * (i_alpha * c[0] + i_beta * c[1]) + j_beta * (i_alpha * c[2] + i_beta * c[3]);
+    const float param_ij1 = j_alpha * (i_alpha * c[4] + i_beta * c[5]) + j_beta * (i_alpha * c[6] + i_beta * c[7]);
+    return k_alpha * param_ij0 + k_beta * param_ij1;
+}
+
+// Fine nodes of the refined bricks, traced back through the previous velocities like advectPhi. A node travels
+// the distance of the samples around it interpolated, so even nodes move exactly as their samples do. Nodes on or
+// next to the walls, where the band never goes, take the coarse samples. Each brick's band samples then take the
+// value of the fine node they sit on, which is what the pressure solve reads.
+void Grid::advectFine(float deltaT)
+{
+    const FieldSpan phi_old = fields.previous(FIELD_PHI);
+    const FieldSpan u_minus_old = fields.previous(FIELD_U_MINUS);
+    const FieldSpan v_minus_old = fields.previous(FIELD_V_MINUS);
+    const FieldSpan w_minus_old = fields.previous(FIELD_W_MINUS);
+    const FieldSpan phi_new = fields.current(FIELD_PHI);
+    const float *fineOld = fineValues[fineCurrent ^ 1].data();
+    float *fineNew = fineValues[fineCurrent].data();
+    threadPool.parallelFor((uint32_t)fineBricks.size(), 1, [&](uint32_t begin, uint32_t end)
+                           {
+        // distances of the samples at the brick's nodes, SURFACE_BRICK_SIZE + 1 along each edge
+        constexpr uint32_t SAMPLES = SURFACE_BRICK_SIZE + 1;
+        std::array<glm::vec3, SAMPLES * SAMPLES * SAMPLES> distances;
+        for (uint32_t n = begin; n < end; n++)
+        {
+            const uint32_t brick = fineBricks[n];
+            const uint32_t bi = brick / (surfaceBricks[1] * surfaceBricks[2]), bj = (brick / surfaceBricks[2]) % surfaceBricks[1], bk = brick % surfaceBricks[2];
+            const uint32_t i0 = bi * SURFACE_BRICK_SIZE, j0 = bj * SURFACE_BRICK_SIZE, k0 = bk * SURFACE_BRICK_SIZE;
+            for (uint32_t si = 0; si < SAMPLES; si++)
+            {
+                for (uint32_t sj = 0; sj < SAMPLES; sj++)
+                {
+                    for (uint32_t sk = 0; sk < SAMPLES; sk++)
+                    {
+                        uint32_t i = i0 + si, j = j0 + sj, k = k0 + sk;
+                        if (i >= 1 && i <= Nx - 2 && j >= 1 && j <= Ny - 2 && k >= 1 && k <= Nz - 2)
+                        {
+                            distances[(si * SAMPLES + sj) * SAMPLES + sk] = traceDistance(u_minus_old, v_minus_old, w_minus_old, i, j, k, deltaT);
+                        }
+                    }
+                }
+            }
+
+            float *values = fineNew + (size_t)fineSlots[brick] * FINE_BRICK_VALUES;
+            for (uint32_t li = 0; li < FINE_BRICK_SIZE; li++)
+            {
+                for (uint32_t lj = 0; lj < FINE_BRICK_SIZE; lj++)
+                {
+                    for (uint32_t lk = 0; lk < FINE_BRICK_SIZE; lk++)
+                    {
+                        const uint32_t I = 2 * i0 + li, J = 2 * j0 + lj, K = 2 * k0 + lk;
+                        float &value = values[fineCell(li, lj, lk)];
+                        if (I < 2 || I > 2 * (Nx - 2) || J < 2 || J > 2 * (Ny - 2) || K < 2 || K > 2 * (Nz - 2))
+                        {
+                            value = interpolateCoarse(phi_old, std::min(I, FINE_LAST_NODE[0]), std::min(J, FINE_LAST_NODE[1]), std::min(K, FINE_LAST_NODE[2]));
+                            continue;
+                        }
+                        // a node this far from the surface keeps its sign through the step, redistanceFine updates it
+                        const float old = fineOld[(size_t)fineSlots[brick] * FINE_BRICK_VALUES + fineCell(li, lj, lk)];
+                        if (std::abs(old) >= FINE_BAND_WIDTH)
+                        {
+                            value = std::copysign(FINE_BAND_WIDTH, old);
+                            continue;
+                        }
+                        glm::vec3 distance(0.0f);
+                        float corners = 0.0f;
+                        for (uint32_t corner = 0; corner < 8; corner++)
+                        {
+                            uint32_t di = corner & 1, dj = (corner >> 1) & 1, dk = corner >> 2;
+                            if (di > (I & 1) || dj > (J & 1) || dk > (K & 1))
+                            {
+                                continue;
+                            }
+                            distance += distances[(((li >> 1) + di) * SAMPLES + (lj >> 1) + dj) * SAMPLES + (lk >> 1) + dk];
+                            corners += 1.0f;
+                        }
+                        distance = distance / corners;
+                        float x = 2.0f * std::clamp(0.5f * (float)I - distance.x, 1.0f, (float)(Nx - 2));
+                        float y = 2.0f * std::clamp(0.5f * (float)J - distance.y, 1.0f, (float)(Ny - 2));
+                        float z = 2.0f * std::clamp(0.5f * (float)K - distance.z, 1.0f, (float)(Nz - 2));
+                        value = std::clamp(sampleFine(fineOld, phi_old, x, y, z) + (BODY_FORCES[FIELD_PHI] * deltaT), -FINE_BAND_WIDTH, FINE_BAND_WIDTH);
+                    }
+                }
+            }
+
+            // the band samples of this brick, where the fine band holds them
+            for (uint32_t i = i0; i < std::min(i0 + SURFACE_BRICK_SIZE, Nx - 1); i++)
+            {
+                for (uint32_t j = j0; j < std::min(j0 + SURFACE_BRICK_SIZE, Ny - 1); j++)
+                {
+                    for (uint32_t k = k0; k < std::min(k0 + SURFACE_BRICK_SIZE, Nz - 1); k++)
+                    {
+                        uint32_t base_index = i * NyNz + j * Nz + k;
+                        const float value = values[fineCell(2 * (i - i0), 2 * (j - j0), 2 * (k - k0))];
+                        if (reinitFlags[base_index] != REINIT_FAR && std::abs(value) < FINE_BAND_WIDTH)
+                        {
+                            phi_new[base_index] = value;
+                        }
+                    }
+                }
+            }
+        } });
+}
+
+// Fast sweeping redistancing of each refined brick on its own, over the brick and a one-node halo read from its
+// neighbours. As for the grid, nodes next to a sign change keep their value; the rest of the brick is reset to
+// FINE_BAND_WIDTH and swept in the 8 orderings. Bricks write the other buffer, so none reads a neighbour that was
+// already redistanced, and the buffers then swap. Runs every step: advectFine holds the nodes at the edge of the
+// fine band, and relies on this to move them as the surface comes closer.
+void Grid::redistanceFine()
+{
+    const FieldSpan phi = fields.current(FIELD_PHI);
+    const float *fine = fineValues[fineCurrent].data();
+    float *redistanced = fineValues[fineCurrent ^ 1].data();
+    threadPool.parallelFor((uint32_t)fineBricks.size(), 1, [&](uint32_t begin, uint32_t end)
+                           {
+        constexpr uint32_t T = FINE_BRICK_SIZE + 2; // tile nodes along each edge
+        static thread_local std::vector<float> tile;
+        static thread_local std::vector<uint8_t> sweepable;
+        tile.resize(T * T * T);
+        sweepable.resize(T * T * T);
+        auto at = [](uint32_t ti, uint32_t tj, uint32_t tk) { return (ti * T + tj) * T + tk; };
+        for (uint32_t n = begin; n < end; n++)
+        {
+            const uint32_t brick = fineBricks[n];
+            const uint32_t bi = brick / (surfaceBricks[1] * surfaceBricks[2]), bj = (brick / surfaceBricks[2]) % surfaceBricks[1], bk = brick % surfaceBricks[2];
+            const uint32_t I0 = bi * FINE_BRICK_SIZE, J0 = bj * FINE_BRICK_SIZE, K0 = bk * FINE_BRICK_SIZE;
+            // halo nodes past the lattice repeat its last node
+            auto node = [](uint32_t origin, uint32_t t, uint32_t last) { return std::min(origin + t > 0 ? origin + t - 1 : 0, last); };
+            for (uint32_t ti = 0; ti < T; ti++)
+            {
+                for (uint32_t tj = 0; tj < T; tj++)
+                {
+                    const uint32_t I = node(I0, ti, FINE_LAST_NODE[0]), J = node(J0, tj, FINE_LAST_NODE[1]);
+                    tile[at(ti, tj, 0)] = fineNode(fine, phi, I, J, node(K0, 0, FINE_LAST_NODE[2]));
+                    fineRow(fine, phi, I, J, K0, T - 1, &tile[at(ti, tj, 1)]);
+                }
+            }
+
+            // the brick's own nodes away from the walls and the surface are recomputed
+            for (uint32_t ti = 1; ti < T - 1; ti++)
+            {
+                for (uint32_t tj = 1; tj < T - 1; tj++)
+                {
+                    for (uint32_t tk = 1; tk < T - 1; tk++)
+                    {
+                        const uint32_t I = I0 + ti - 1, J = J0 + tj - 1, K = K0 + tk - 1;
+                        const uint32_t c = at(ti, tj, tk);
+                        const bool negative = tile[c] < 0.0f;
+                        const bool interface = (tile[c - T * T] < 0.0f) != negative || (tile[c + T * T] < 0.0f) != negative ||
+                                               (tile[c - T] < 0.0f) != negative || (tile[c + T] < 0.0f) != negative ||
+                                               (tile[c - 1] < 0.0f) != negative || (tile[c + 1] < 0.0f) != negative;
+                        sweepable[c] = !interface && I >= 2 && I <= 2 * (Nx - 2) && J >= 2 && J <= 2 * (Ny - 2) && K >= 2 && K <= 2 * (Nz - 2);
+                    }
+                }
+            }
+            for (uint32_t ti = 1; ti < T - 1; ti++)
+            {
+                for (uint32_t tj = 1; tj < T - 1; tj++)
+                {
+                    for (uint32_t tk = 1; tk < T - 1; tk++)
+                    {
+                        const uint32_t c = at(ti, tj, tk);
+                        if (sweepable[c])
+                        {
+                            tile[c] = std::copysign(FINE_BAND_WIDTH, tile[c]);
+                        }
+                    }
+                }
+            }
+
+            // sweep bit 0 reverses i, bit 1 j and bit 2 k
+            for (uint32_t sweep = 0; sweep < 8; sweep++)
+            {
+                for (uint32_t si = 1; si < T - 1; si++)
+                {
+                    const uint32_t ti = (sweep & 1) ? T - 1 - si : si;
+                    for (uint32_t sj = 1; sj < T - 1; sj++)
+                    {
+                        const uint32_t tj = (sweep & 2) ? T - 1 - sj : sj;
+                        for (uint32_t sk = 1; sk < T - 1; sk++)
+                        {
+                            const uint32_t tk = (sweep & 4) ? T - 1 - sk : sk;
+                            const uint32_t c = at(ti, tj, tk);
+                            if (!sweepable[c])
+                            {
+                                continue;
+                            }
+                            const float a = std::min(std::abs(tile[c - T * T]), std::abs(tile[c + T * T]));
+                            const float b = std::min(std::abs(tile[c - T]), std::abs(tile[c + T]));
+                            const float d = std::min(std::abs(tile[c - 1]), std::abs(tile[c + 1]));
+                            if (std::min({a, b, d}) >= FINE_BAND_WIDTH) // outside the fine band
+                            {
+                                continue;
+                            }
+                            float x = solveEikonal(a, b, d, 0.5f * CELL_WIDTH);
+                            if (x < std::abs(tile[c]))
+                            {
+                                tile[c] = std::copysign(x, tile[c]);
+                            }
+                        }
+                    }
+                }
+            }
 
-    float resultant2 = determinant2 > 0.f ? std::sqrt(determinant2) : 0.f;
-    float resultant3 = determinant3 > 0.f ? std::sqrt(determinant3) : 0.f;
+            float *values = redistanced + (size_t)fineSlots[brick] * FINE_BRICK_VALUES;
+            for (uint32_t li = 0; li < FINE_BRICK_SIZE; li++)
+            {
+                for (uint32_t lj = 0; lj < FINE_BRICK_SIZE; lj++)
+                {
+                    std::copy_n(&tile[at(li + 1, lj + 1, 1)], FINE_BRICK_SIZE, values + fineCell(li, lj, 0));
+                }
+            }
+        } });
+    fineCurrent ^= 1;
+}
 
-    float s1 = a1 + CELL_WIDTH;
-    float s2 = (a1 + a2 + resultant2) / 2.f;
-    float s3 = (a1 + a2 + a3 + resultant3) / 3.f;
+// Refines the surface bricks with a cube corner within FINE_REFINE_WIDTH of the surface, so a brick is refined
+// before the surface, moving less than a cell per step, comes into it; bricks the fine surface passes through stay
+// refined, whatever the samples show. Bricks that leave the set drop their fine values. Bricks that join start from
+// the samples interpolated, the values their nodes had before. reset drops every brick first, for a phi replaced
+// wholesale.
+void Grid::updateFineBricks(bool reset)
+{
+    const FieldSpan phi = fields.current(FIELD_PHI);
+    if (reset)
+    {
+        fineSlots.assign(surfaceTouched.size(), NO_FINE_SLOT);
+        fineBricks.clear();
+        fineFree.clear();
+        fineValues[0].clear();
+        fineValues[1].clear();
+    }
 
-    if (abs(s1) > abs(old_phi))
+    // bit 0: the brick is wanted; bit 2: refined just now
+    fineWanted.assign(fineSlots.size(), 0);
+    for (uint32_t base_index : bandCells)
     {
-        return old_phi;
+        if (std::abs(phi[base_index]) < FINE_REFINE_WIDTH)
+        {
+            touchSurfaceBricks(base_index, fineWanted);
+        }
     }
-    else if (abs(s1) < a2)
+    const float *fine = fineValues[fineCurrent].data();
+    threadPool.parallelFor((uint32_t)fineBricks.size(), 1, [&](uint32_t begin, uint32_t end)
+                           {
+        for (uint32_t n = begin; n < end; n++)
+        {
+            const float *values = fine + (size_t)fineSlots[fineBricks[n]] * FINE_BRICK_VALUES;
+            auto [low, high] = std::minmax_element(values, values + FINE_BRICK_VALUES);
+            if (*low < 0.0f && *high >= 0.0f)
+            {
+                fineWanted[fineBricks[n]] |= 1;
+            }
+        } });
+    // freed blocks first, so the bricks that join reuse them
+    for (uint32_t brick = 0; brick < fineSlots.size(); brick++)
     {
-        return positive ? s1 : -s1;
+        if (!(fineWanted[brick] & 1) && fineSlots[brick] != NO_FINE_SLOT)
+        {
+            fineFree.push_back(fineSlots[brick]);
+            fineSlots[brick] = NO_FINE_SLOT;
+        }
     }
-    else if (abs(s2) < a3)
+    fineBricks.clear();
+    for (uint32_t brick = 0; brick < fineSlots.size(); brick++)
     {
-        return positive ? s2 : -s2;
+        if (!(fineWanted[brick] & 1))
+        {
+            continue;
+        }
+        if (fineSlots[brick] == NO_FINE_SLOT)
+        {
+            if (fineFree.empty())
+            {
+                fineFree.push_back((uint32_t)(fineValues[0].size() / FINE_BRICK_VALUES));
+                fineValues[0].resize(fineValues[0].size() + FINE_BRICK_VALUES);
+                fineValues[1].resize(fineValues[1].size() + FINE_BRICK_VALUES);
+            }
+            fineSlots[brick] = fineFree.back();
+            fineFree.pop_back();
+            fineWanted[brick] |= 4;
+        }
+        fineBricks.push_back(brick);
     }
-    else
+
+    float *values = fineValues[fineCurrent].data();
+    threadPool.parallelFor((uint32_t)fineBricks.size(), 1, [&](uint32_t begin, uint32_t end)
+                           {
+        for (uint32_t n = begin; n < end; n++)
+        {
+            const uint32_t brick = fineBricks[n];
+            if (!(fineWanted[brick] & 4))
+            {
+                continue;
+            }
+            const uint32_t bi = brick / (surfaceBricks[1] * surfaceBricks[2]), bj = (brick / surfaceBricks[2]) % surfaceBricks[1], bk = brick % surfaceBricks[2];
+            float *block = values + (size_t)fineSlots[brick] * FINE_BRICK_VALUES;
+            for (uint32_t li = 0; li < FINE_BRICK_SIZE; li++)
+            {
+                for (uint32_t lj = 0; lj < FINE_BRICK_SIZE; lj++)
+                {
+                    for (uint32_t lk = 0; lk < FINE_BRICK_SIZE; lk++)
+                    {
+                        block[fineCell(li, lj, lk)] = interpolateCoarse(phi, std::min(bi * FINE_BRICK_SIZE + li, FINE_LAST_NODE[0]),
+                                                                         std::min(bj * FINE_BRICK_SIZE + lj, FINE_LAST_NODE[1]),
+                                                                         std::min(bk * FINE_BRICK_SIZE + lk, FINE_LAST_NODE[2]));
+                    }
+                }
+            }
+        } });
+}
+
+// Air cells take the largest-magnitude velocity of their upwind neighbours (-1 looks back along each axis, +1 forward)
+inline void Grid::extrapolateVelocity(uint32_t base_index, int direction)
+{
+    const FieldSpan u_minus = fields.current(FIELD_U_MINUS);
+    const FieldSpan v_minus = fields.current(FIELD_V_MINUS);
+    const FieldSpan w_minus = fields.current(FIELD_W_MINUS);
+
+    float max_u = 0, max_v = 0, max_w = 0;
+    std::array<uint32_t, 3> neighbors = {base_index - direction * NyNz, base_index - direction * Nz, base_index - direction};
+    for (uint32_t neighbor : neighbors)
+    {
+        if (std::abs(u_minus[neighbor]) > std::abs(max_u))
+        {
+            max_u = u_minus[neighbor];
+        }
+        if (std::abs(v_minus[neighbor]) > std::abs(max_v))
+        {
+            max_v = v_minus[neighbor];
+        }
+        if (std::abs(w_minus[neighbor]) > std::abs(max_w))
+        {
+            max_w = w_minus[neighbor];
+        }
+    }
+    u_minus[base_index] = max_u;
+    v_minus[base_index] = max_v;
+    w_minus[base_index] = max_w;
+}
+
+// Hashes the phi samples of one surface brick, refreshing its min/max blocks and its own range on the way
+uint64_t Grid::scanSurfaceBrick(uint32_t bi, uint32_t bj, uint32_t bk, bool hashSamples)
+{
+    const FieldSpan phi = fields.current(FIELD_PHI);
+    constexpr uint32_t BLOCKS = 1u << (SURFACE_BRICK_LOG2 - PHI_BLOCK_LOG2); // per surface brick edge
+    constexpr PhiRange EMPTY = {INFINITY, -INFINITY};
+
+    // cubes of this brick, and the samples at their corners
+    uint32_t i0 = bi * SURFACE_BRICK_SIZE, i1 = std::min(i0 + SURFACE_BRICK_SIZE, Nx - 1);
+    uint32_t j0 = bj * SURFACE_BRICK_SIZE, j1 = std::min(j0 + SURFACE_BRICK_SIZE, Ny - 1);
+    uint32_t k0 = bk * SURFACE_BRICK_SIZE, k1 = std::min(k0 + SURFACE_BRICK_SIZE, Nz - 1);
+
+    // a sample on a block face is a corner of the blocks on both sides of it
+    auto firstBlock = [](uint32_t local)
+    { return (local > 0 ? local - 1 : 0) >> PHI_BLOCK_LOG2; };
+    auto lastBlock = [](uint32_t local)
+    { return std::min(local >> PHI_BLOCK_LOG2, BLOCKS - 1); };
+
+    std::array<PhiRange, BLOCKS * BLOCKS * BLOCKS> ranges;
+    ranges.fill(EMPTY);
+    uint64_t hash = 0xcbf29ce484222325ull; // FNV-1a over the sample bit patterns
+    for (uint32_t i = i0; i <= i1; i++)
+    {
+        for (uint32_t j = j0; j <= j1; j++)
+        {
+            const uint32_t row = i * NyNz + j * Nz;
+            if (hashSamples)
+            {
+                for (uint32_t k = k0; k <= k1; k++)
+                {
+                    float value = phi[row + k];
+                    uint32_t bits;
+                    std::memcpy(&bits, &value, sizeof(bits));
+                    hash = (hash ^ bits) * 0x100000001b3ull;
+                }
+            }
+            std::array<PhiRange, BLOCKS> rowRanges;
+            rowRanges.fill(EMPTY);
+            for (uint32_t xk = 0; xk < BLOCKS && k0 + (xk << PHI_BLOCK_LOG2) < k1; xk++)
+            {
+                uint32_t kStart = k0 + (xk << PHI_BLOCK_LOG2);
+                uint32_t kEnd = std::min(kStart + (1u << PHI_BLOCK_LOG2), k1);
+                for (uint32_t k = kStart; k <= kEnd; k++)
+                {
+                    float value = phi[row + k];
+                    rowRanges[xk].min = std::min(rowRanges[xk].min, value);
+                    rowRanges[xk].max = std::max(rowRanges[xk].max, value);
+                }
+            }
+            for (uint32_t xi = firstBlock(i - i0); xi <= lastBlock(i - i0); xi++)
+            {
+                for (uint32_t xj = firstBlock(j - j0); xj <= lastBlock(j - j0); xj++)
+                {
+                    for (uint32_t xk = 0; xk < BLOCKS; xk++)
+                    {
+                        PhiRange &range = ranges[(xi * BLOCKS + xj) * BLOCKS + xk];
+                        range.min = std::min(range.min, rowRanges[xk].min);
+                        range.max = std::max(range.max, rowRanges[xk].max);
+                    }
+                }
+            }
+        }
+    }
+
+    // blocks past the end of the grid in a boundary brick hold no cubes
+    PhiRange brickRange = EMPTY;
+    for (uint32_t xi = 0; xi < BLOCKS && i0 + (xi << PHI_BLOCK_LOG2) < i1; xi++)
+    {
+        for (uint32_t xj = 0; xj < BLOCKS && j0 + (xj << PHI_BLOCK_LOG2) < j1; xj++)
+        {
+            for (uint32_t xk = 0; xk < BLOCKS && k0 + (xk << PHI_BLOCK_LOG2) < k1; xk++)
+            {
+                const PhiRange &range = ranges[(xi * BLOCKS + xj) * BLOCKS + xk];
+                blockRanges[(((i0 >> PHI_BLOCK_LOG2) + xi) * phiBlocks[1] + (j0 >> PHI_BLOCK_LOG2) + xj) * phiBlocks[2] + (k0 >> PHI_BLOCK_LOG2) + xk] = range;
+                brickRange.min = std::min(brickRange.min, range.min);
+                brickRange.max = std::max(brickRange.max, range.max);
+            }
+        }
+    }
+    brickRanges[(bi * surfaceBricks[1] + bj) * surfaceBricks[2] + bk] = brickRange;
+    return hash;
+}
+
+void Grid::updateSuperBrickRanges()
+{
+    std::fill(superBrickRanges.begin(), superBrickRanges.end(), PhiRange{INFINITY, -INFINITY});
+    for (uint32_t bi = 0; bi < surfaceBricks[0]; bi++)
+    {
+        for (uint32_t bj = 0; bj < surfaceBricks[1]; bj++)
+        {
+            for (uint32_t bk = 0; bk < surfaceBricks[2]; bk++)
+            {
+                const PhiRange &range = brickRanges[(bi * surfaceBricks[1] + bj) * surfaceBricks[2] + bk];
+                PhiRange &super = superBrickRanges[((bi >> PHI_SUPER_BRICK_LOG2) * phiSuperBricks[1] + (bj >> PHI_SUPER_BRICK_LOG2)) * phiSuperBricks[2] + (bk >> PHI_SUPER_BRICK_LOG2)];
+                super.min = std::min(super.min, range.min);
+                super.max = std::max(super.max, range.max);
+            }
+        }
+    }
+}
+
+void Grid::rebuildPhiRanges()
+{
+    for (uint32_t bi = 0; bi < surfaceBricks[0]; bi++)
+    {
+        for (uint32_t bj = 0; bj < surfaceBricks[1]; bj++)
+        {
+            for (uint32_t bk = 0; bk < surfaceBricks[2]; bk++)
+            {
+                scanSurfaceBrick(bi, bj, bk, false);
+            }
+        }
+    }
+    updateSuperBrickRanges();
+}
+
+// A phi sample at index n is a corner of cubes n - 1 and n, which can lie in two surface bricks along each axis
+void Grid::touchSurfaceBricks(uint32_t index, std::vector<uint8_t> &flags) const
+{
+    uint32_t i = index / NyNz;
+    uint32_t j = (index / Nz) % Ny;
+    uint32_t k = index % Nz;
+    uint32_t loI = (i > 0 ? i - 1 : 0) >> SURFACE_BRICK_LOG2, hiI = std::min(i, Nx - 2) >> SURFACE_BRICK_LOG2;
+    uint32_t loJ = (j > 0 ? j - 1 : 0) >> SURFACE_BRICK_LOG2, hiJ = std::min(j, Ny - 2) >> SURFACE_BRICK_LOG2;
+    uint32_t loK = (k > 0 ? k - 1 : 0) >> SURFACE_BRICK_LOG2, hiK = std::min(k, Nz - 2) >> SURFACE_BRICK_LOG2;
+    for (uint32_t bi = loI; bi <= hiI; bi++)
+    {
+        for (uint32_t bj = loJ; bj <= hiJ; bj++)
+        {
+            for (uint32_t bk = loK; bk <= hiK; bk++)
+            {
+                flags[(bi * surfaceBricks[1] + bj) * surfaceBricks[2] + bk] |= 1;
+            }
+        }
+    }
+}
+
+// Appends the triangles of a cube of the given width at position, with phi corners and their signs vertexMask
+static void marchCorners(const std::array<float, 8> &corners, uint8_t vertexMask, const glm::vec3 &position, float width, std::vector<Vertex> &vertices)
+{
+    const MarchingCube &marchingCube = marchingCubeLookup[vertexMask];
+
+    // boundary point of each edge the triangles use, relative to the cube's lowest corner
+    std::array<glm::vec3, 12> boundaryVertices;
+    for (uint32_t edges = marchingCubeEdges[vertexMask]; edges != 0; edges &= edges - 1)
     {
-        return positive ? s3 : -s3;
+        uint32_t edge = __builtin_ctz(edges);
+        uint32_t a = EDGE_CORNERS[edge][0];
+        uint32_t b = EDGE_CORNERS[edge][1];
+        uint32_t axis = __builtin_ctz(a ^ b);
+        boundaryVertices[edge] = glm::vec3(0.0f, 0.0f, 0.0f);
+        if (((vertexMask >> a) ^ (vertexMask >> b)) & 1)
+        {
+            boundaryVertices[edge] = glm::vec3((a & 1) ? width : 0.0f, (a & 2) ? width : 0.0f, (a & 4) ? width : 0.0f);
+            float phiA = corners[a];
+            float phiB = corners[b];
+            boundaryVertices[edge][axis] = (-width * phiA) / (phiB - phiA);
+        }
+    }
+
+    for (uint32_t t = 0; t < marchingCube.size(); t++)
+    {
+        const Triple &triangle = marchingCube[t]; // { 0, 1, 4}
+        glm::vec3 normal = glm::normalize(glm::cross(boundaryVertices[triangle[1]] - boundaryVertices[triangle[0]], boundaryVertices[triangle[2]] - boundaryVertices[triangle[0]]));
+        for (uint32_t v = 0; v < 3; v++)
+        {
+            vertices.push_back({boundaryVertices[triangle[v]] + position, normal, SURFACE_COLOR});
+        }
     }
 }
 
-void Grid::constructSurface(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices)
+// Appends the triangles of the cube with lowest corner (i, j, k), whose corner signs are vertexMask
+void Grid::marchCube(const FieldSpan &phi, uint32_t i, uint32_t j, uint32_t k, uint8_t vertexMask, std::vector<Vertex> &vertices)
 {
-    const std::vector<float> &phi = phi_arrays[newStorage];
+    uint32_t baseIndex = i * NyNz + j * Nz + k;
+    const std::array<uint32_t, 8> cornerOffsets = {0, NyNz, Nz, NyNz + Nz, 1, NyNz + 1, Nz + 1, NyNz + Nz + 1};
+    std::array<float, 8> corners;
+    for (uint32_t corner = 0; corner < 8; corner++)
+    {
+        corners[corner] = phi[baseIndex + cornerOffsets[corner]];
+    }
+    marchCorners(corners, vertexMask, getPosition(i, j, k), CELL_WIDTH, vertices);
+}
 
-    vertices.resize(0);
-    indices.resize(0);
+// Lists the cubes of a brick whose corners do not all share a sign, with their marching-cubes case. The signs of
+// each sample row come from one vectorised compare; a row of cubes is then classified with a few bitwise ops on
+// the masks of the four sample rows at its corners.
+void Grid::classifyCubes(const FieldSpan &phi, uint32_t i0, uint32_t i1, uint32_t j0, uint32_t j1, uint32_t k0, uint32_t k1, std::vector<ActiveCube> &cubes)
+{
+    constexpr uint32_t ROW = SURFACE_BRICK_SIZE + 1; // sample rows per brick edge
+    std::array<uint32_t, ROW * ROW> rowSigns;
+    for (uint32_t i = i0; i <= i1; i++)
+    {
+        for (uint32_t j = j0; j <= j1; j++)
+        {
+            rowSigns[(i - i0) * ROW + (j - j0)] = signMask(phi, i * NyNz + j * Nz + k0, k1 - k0 + 1);
+        }
+    }
+    classifyRows(rowSigns.data(), ROW, i0, i1, j0, j1, k0, k1, cubes);
+}
 
-    std::array<float, 8> localPhis;
-    std::array<bool, 8> isWater{};
+// The cubes of classifyCubes from the sign masks of their sample rows, row (i, j) at (i - i0) * rowStride + j - j0
+void Grid::classifyRows(const uint32_t *rowSigns, uint32_t rowStride, uint32_t i0, uint32_t i1, uint32_t j0, uint32_t j1, uint32_t k0, uint32_t k1,
+                        std::vector<ActiveCube> &cubes)
+{
+    cubes.resize(0);
+    const uint32_t rowCubes = (1u << (k1 - k0)) - 1;
+    for (uint32_t i = i0; i < i1; i++)
+    {
+        for (uint32_t j = j0; j < j1; j++)
+        {
+            const uint32_t *row = &rowSigns[(i - i0) * rowStride + (j - j0)];
+            uint32_t r00 = row[0], r10 = row[rowStride], r01 = row[1], r11 = row[rowStride + 1];
+            uint32_t any = r00 | r10 | r01 | r11;
+            uint32_t all = r00 & r10 & r01 & r11;
+            // cube k spans sample bits k and k + 1
+            uint32_t mixed = (any | (any >> 1)) & ~(all & (all >> 1)) & rowCubes;
+            for (; mixed != 0; mixed &= mixed - 1)
+            {
+                uint32_t lk = __builtin_ctz(mixed);
+                uint32_t low = ((r00 >> lk) & 1) | (((r10 >> lk) & 1) << 1) | (((r01 >> lk) & 1) << 2) | (((r11 >> lk) & 1) << 3);
+                uint32_t high = ((r00 >> (lk + 1)) & 1) | (((r10 >> (lk + 1)) & 1) << 1) | (((r01 >> (lk + 1)) & 1) << 2) | (((r11 >> (lk + 1)) & 1) << 3);
+                cubes.push_back({i, j, k0 + lk, (uint8_t)(low | (high << 4))});
+            }
+        }
+    }
+}
 
-    // loop through entire grid and draw marching cubes
-    for (uint32_t i = 0; i < Nx - 1; i++)
+// Fine phi at the corners of the fine cubes of surface brick (bi, bj, bk), row (li, lj) at (li * FINE_TILE_SIZE +
+// lj) * FINE_TILE_SIZE. Returns the hash of the values for the mesh cache, and their bounds in range.
+uint64_t Grid::loadFineTile(uint32_t bi, uint32_t bj, uint32_t bk, float *tile, PhiRange &range) const
+{
+    const FieldSpan phi = fields.current(FIELD_PHI);
+    const float *fine = fineValues[fineCurrent].data();
+    const uint32_t I0 = bi * FINE_BRICK_SIZE, J0 = bj * FINE_BRICK_SIZE, K0 = bk * FINE_BRICK_SIZE;
+    const uint32_t I1 = std::min(I0 + FINE_BRICK_SIZE, FINE_LAST_NODE[0]);
+    const uint32_t J1 = std::min(J0 + FINE_BRICK_SIZE, FINE_LAST_NODE[1]);
+    const uint32_t K1 = std::min(K0 + FINE_BRICK_SIZE, FINE_LAST_NODE[2]);
+    range = {INFINITY, -INFINITY};
+    uint64_t hash = 0xcbf29ce484222325ull; // FNV-1a over the value bit patterns
+    for (uint32_t I = I0; I <= I1; I++)
     {
-        for (uint32_t j = 0; j < Ny - 1; j++)
+        for (uint32_t J = J0; J <= J1; J++)
         {
-            for (uint32_t k = 0; k < Nz - 1; k++)
+            float *row = tile + ((I - I0) * FINE_TILE_SIZE + J - J0) * FINE_TILE_SIZE;
+            fineRow(fine, phi, I, J, K0, K1 - K0 + 1, row);
+            for (uint32_t K = K0; K <= K1; K++)
             {
-                uint8_t vertexMask = 0;
+                float value = row[K - K0];
+                range.min = std::min(range.min, value);
+                range.max = std::max(range.max, value);
+                uint32_t bits;
+                std::memcpy(&bits, &value, sizeof(bits));
+                hash = (hash ^ bits) * 0x100000001b3ull;
+            }
+        }
+    }
+    return hash;
+}
+
+// Appends the triangles of the fine cubes of surface brick (bi, bj, bk), from the tile loadFineTile filled
+void Grid::marchFineTile(uint32_t bi, uint32_t bj, uint32_t bk, const float *tile, std::vector<ActiveCube> &cubes, std::vector<Vertex> &vertices)
+{
+    constexpr uint32_t T = FINE_TILE_SIZE;
+    const uint32_t I0 = bi * FINE_BRICK_SIZE, J0 = bj * FINE_BRICK_SIZE, K0 = bk * FINE_BRICK_SIZE;
+    const uint32_t I1 = std::min(I0 + FINE_BRICK_SIZE, FINE_LAST_NODE[0]);
+    const uint32_t J1 = std::min(J0 + FINE_BRICK_SIZE, FINE_LAST_NODE[1]);
+    const uint32_t K1 = std::min(K0 + FINE_BRICK_SIZE, FINE_LAST_NODE[2]);
+    std::array<uint32_t, T * T> rowSigns;
+    for (uint32_t li = 0; li <= I1 - I0; li++)
+    {
+        for (uint32_t lj = 0; lj <= J1 - J0; lj++)
+        {
+            rowSigns[li * T + lj] = signMask(tile + (li * T + lj) * T, K1 - K0 + 1);
+        }
+    }
+    classifyRows(rowSigns.data(), T, I0, I1, J0, J1, K0, K1, cubes);
+
+    const std::array<uint32_t, 8> cornerOffsets = {0, T * T, T, T * T + T, 1, T * T + 1, T + 1, T * T + T + 1};
+    for (const ActiveCube &cube : cubes)
+    {
+        const float *first = tile + ((cube.i - I0) * T + cube.j - J0) * T + cube.k - K0;
+        std::array<float, 8> corners;
+        for (uint32_t corner = 0; corner < 8; corner++)
+        {
+            corners[corner] = first[cornerOffsets[corner]];
+        }
+        glm::vec3 position = getPosition(cube.i >> 1, cube.j >> 1, cube.k >> 1) +
+                             0.5f * CELL_WIDTH * glm::vec3((float)(cube.i & 1), (float)(cube.j & 1), (float)(cube.k & 1));
+        marchCorners(corners, cube.vertexMask, position, 0.5f * CELL_WIDTH, vertices);
+    }
+}
 
-                uint32_t baseIndex = i * NyNz + j * Nz + k;
-                localPhis[0] = phi[baseIndex];                 // i, j, k
-                localPhis[1] = phi[baseIndex + NyNz];          // i+1, j, k
-                localPhis[2] = phi[baseIndex + Nz];            // i, j+1, k
-                localPhis[3] = phi[baseIndex + NyNz + Nz];     // i+1, j+1, k
-                localPhis[4] = phi[baseIndex + 1];             // i, j, k+1
-                localPhis[5] = phi[baseIndex + NyNz + 1];      // i+1, j, k+1
-                localPhis[6] = phi[baseIndex + Nz + 1];        // i, j+1, k+1
-                localPhis[7] = phi[baseIndex + NyNz + Nz + 1]; // i+1, j+1, k+1
+// Only surface bricks with phi samples in this frame's or the previous frame's band can have changed: band cells
+// are the only ones advected and reinitialised, and cells leaving the band are clamped by updateBand while still
+// in the previous band. Those bricks are hashed, and re-meshed if their samples differ from the cached mesh's; the
+// min/max pyramid is refreshed by the same pass, so bricks the surface misses are emptied without classifying.
+void Grid::constructSurface(SurfaceMesh &mesh)
+{
+    prepareSurface(mesh);
+    for (uint32_t bi = 0; bi < surfaceBricks[0]; bi++)
+    {
+        meshSurfaceSlab(bi, mesh);
+        commitSurfaceSlab(bi, mesh);
+    }
+    finishSurface(mesh);
+}
 
-                // identify polarity of air-water boundary, 8-bit pattern
-                for (uint8_t byte = 0; byte < 8; byte++)
+void Grid::prepareSurface(SurfaceMesh &mesh)
+{
+    if (mesh.bricksX() != surfaceBricks[0] || mesh.bricksY() != surfaceBricks[1] || mesh.bricksZ() != surfaceBricks[2])
+    {
+        throw std::runtime_error("Surface mesh does not match the grid dimensions");
+    }
+    if (surfaceReset)
+    {
+        // resetBand clamped cells after building the pyramid
+        mesh.invalidate();
+        rebuildPhiRanges();
+        surfaceReset = false;
+    }
+    for (uint8_t &touched : surfaceTouched)
+    {
+        touched = (touched & 1) << 1;
+    }
+    for (uint32_t index : bandCells)
+    {
+        touchSurfaceBricks(index, surfaceTouched);
+    }
+    // fine nodes change in the refined bricks, whose first nodes are also the last of the bricks before them
+    for (uint32_t brick : fineBricks)
+    {
+        const uint32_t bi = brick / (surfaceBricks[1] * surfaceBricks[2]), bj = (brick / surfaceBricks[2]) % surfaceBricks[1], bk = brick % surfaceBricks[2];
+        for (uint32_t ni = bi > 0 ? bi - 1 : 0; ni <= bi; ni++)
+        {
+            for (uint32_t nj = bj > 0 ? bj - 1 : 0; nj <= bj; nj++)
+            {
+                for (uint32_t nk = bk > 0 ? bk - 1 : 0; nk <= bk; nk++)
                 {
-                    isWater[byte] = localPhis[byte] < 0.0f;
-                    vertexMask |= isWater[byte] << byte;
+                    surfaceTouched[(ni * surfaceBricks[1] + nj) * surfaceBricks[2] + nk] |= 1;
                 }
+            }
+        }
+    }
+    surfaceSlabs.resize(surfaceBricks[0]);
+}
+
+// Hashes the touched bricks of surface slab bi and marches the stale ones, keeping their triangles until
+// commitSurfaceSlab. Slabs only write their own bricks' ranges and scratch, so any number can run at once.
+void Grid::meshSurfaceSlab(uint32_t bi, const SurfaceMesh &mesh)
+{
+    const FieldSpan phi = fields.current(FIELD_PHI);
+    SurfaceSlab &slab = surfaceSlabs[bi];
+    slab.bricks.resize(0);
+    slab.hashes.resize(0);
+    slab.hashed = 0;
+    for (uint32_t bj = 0; bj < surfaceBricks[1]; bj++)
+    {
+        for (uint32_t bk = 0; bk < surfaceBricks[2]; bk++)
+        {
+            uint32_t brick = (bi * surfaceBricks[1] + bj) * surfaceBricks[2] + bk;
+            if (!surfaceTouched[brick] && mesh.meshed(brick))
+            {
+                continue;
+            }
 
-                MarchingCube marchingCube = marchingCubeLookup[vertexMask];
+            // with a refined surface the mesh comes from the fine lattice, whose nodes decide the hash
+            uint64_t hash = scanSurfaceBrick(bi, bj, bk, !options.refineSurface);
+            PhiRange fineRange = {};
+            if (options.refineSurface)
+            {
+                slab.fineTile.resize(FINE_TILE_SIZE * FINE_TILE_SIZE * FINE_TILE_SIZE);
+                hash = loadFineTile(bi, bj, bk, slab.fineTile.data(), fineRange);
+            }
+            slab.hashed++;
+            if (!mesh.stale(brick, hash))
+            {
+                continue;
+            }
 
-                if (marchingCube.size() == 0)
+            // only cubes whose corners change sign can hold triangles
+            if (slab.vertices.size() <= slab.bricks.size())
+            {
+                slab.vertices.emplace_back();
+            }
+            std::vector<Vertex> &vertices = slab.vertices[slab.bricks.size()];
+            vertices.resize(0);
+            if (options.refineSurface)
+            {
+                if (crossesSurface(fineRange))
                 {
-                    continue;
+                    marchFineTile(bi, bj, bk, slab.fineTile.data(), slab.cubes, vertices);
+                }
+            }
+            else if (crossesSurface(brickRanges[brick]))
+            {
+                uint32_t i0 = bi * SURFACE_BRICK_SIZE, i1 = std::min(i0 + SURFACE_BRICK_SIZE, Nx - 1);
+                uint32_t j0 = bj * SURFACE_BRICK_SIZE, j1 = std::min(j0 + SURFACE_BRICK_SIZE, Ny - 1);
+                uint32_t k0 = bk * SURFACE_BRICK_SIZE, k1 = std::min(k0 + SURFACE_BRICK_SIZE, Nz - 1);
+                classifyCubes(phi, i0, i1, j0, j1, k0, k1, slab.cubes);
+                for (const ActiveCube &cube : slab.cubes)
+                {
+                    marchCube(phi, cube.i, cube.j, cube.k, cube.vertexMask, vertices);
                 }
+            }
+            slab.bricks.push_back(brick);
+            slab.hashes.push_back(hash);
+        }
+    }
+}
 
-                glm::vec3 position = getPosition(i, j, k);
+// Hands slab bi's re-meshed bricks to the mesh. The mesh allocates their blocks in call order, so slabs are
+// committed in order to lay the vertex array out the same way every time.
+void Grid::commitSurfaceSlab(uint32_t bi, SurfaceMesh &mesh)
+{
+    const SurfaceSlab &slab = surfaceSlabs[bi];
+    for (uint32_t n = 0; n < slab.bricks.size(); n++)
+    {
+        mesh.update(slab.bricks[n], slab.hashes[n], slab.vertices[n]);
+    }
+}
+
+void Grid::finishSurface(const SurfaceMesh &mesh)
+{
+    uint32_t bricksHashed = 0;
+    uint32_t bricksMeshed = 0;
+    for (const SurfaceSlab &slab : surfaceSlabs)
+    {
+        bricksHashed += slab.hashed;
+        bricksMeshed += (uint32_t)slab.bricks.size();
+    }
+    updateSuperBrickRanges();
+    std::cout << "Number of triangles: " << mesh.triangleCount() << ", " << bricksMeshed << " of " << bricksHashed
+              << " checked surface bricks re-meshed" << std::endl;
+}
+
+bool Grid::saveCheckpoint(const std::string &path)
+{
+    if (checkpointWriter.busy())
+    {
+        std::cout << "Checkpoint skipped, previous write still in flight" << std::endl;
+        return false;
+    }
 
-                // std::cout << position.x << ", " << position.y << ", " << position.z << std::endl;
+    checkpointImage.reset(Nx, Ny, Nz, simTime, frame, windowOrigin,
+                          {fields.size(FIELD_PHI),
+                           fields.size(FIELD_U_MINUS),
+                           fields.size(FIELD_V_MINUS),
+                           fields.size(FIELD_W_MINUS),
+                           (uint64_t)Nx * NyNz});
 
-                // pre-compute each edge's boundary
-                std::array<glm::vec3, 12> boundaryVertices{};
-                boundaryVertices[0] = isWater[0] != isWater[1] ? glm::vec3((-CELL_WIDTH * localPhis[0]) / (localPhis[1] - localPhis[0]), 0.0f, 0.0f) : glm::vec3(0.0f, 0.0f, 0.0f);              // v0 -> v1
-                boundaryVertices[1] = isWater[0] != isWater[2] ? glm::vec3(0.0f, (-CELL_WIDTH * localPhis[0]) / (localPhis[2] - localPhis[0]), 0.0f) : glm::vec3(0.0f, 0.0f, 0.0f);              // v0 -> v2
-                boundaryVertices[2] = isWater[1] != isWater[3] ? glm::vec3(CELL_WIDTH, (-CELL_WIDTH * localPhis[1]) / (localPhis[3] - localPhis[1]), 0.0f) : glm::vec3(0.0f, 0.0f, 0.0f);        // v1 -> v3
-                boundaryVertices[3] = isWater[2] != isWater[3] ? glm::vec3((-CELL_WIDTH * localPhis[2]) / (localPhis[3] - localPhis[2]), CELL_WIDTH, 0.0f) : glm::vec3(0.0f, 0.0f, 0.0f);        // v2 -> v3
-                boundaryVertices[4] = isWater[0] != isWater[4] ? glm::vec3(0.0f, 0.0f, (-CELL_WIDTH * localPhis[0]) / (localPhis[4] - localPhis[0])) : glm::vec3(0.0f, 0.0f, 0.0f);              // v0 -> v4
-                boundaryVertices[5] = isWater[1] != isWater[5] ? glm::vec3(CELL_WIDTH, 0.0f, (-CELL_WIDTH * localPhis[1]) / (localPhis[5] - localPhis[1])) : glm::vec3(0.0f, 0.0f, 0.0f);        // v1 -> v5
-                boundaryVertices[6] = isWater[2] != isWater[6] ? glm::vec3(0.0f, CELL_WIDTH, (-CELL_WIDTH * localPhis[2]) / (localPhis[6] - localPhis[2])) : glm::vec3(0.0f, 0.0f, 0.0f);        // v2 -> v6
-                boundaryVertices[7] = isWater[3] != isWater[7] ? glm::vec3(CELL_WIDTH, CELL_WIDTH, (-CELL_WIDTH * localPhis[3]) / (localPhis[7] - localPhis[3])) : glm::vec3(0.0f, 0.0f, 0.0f);  // v3 -> v7
-                boundaryVertices[8] = isWater[4] != isWater[5] ? glm::vec3((-CELL_WIDTH * localPhis[4]) / (localPhis[5] - localPhis[4]), 0.0f, CELL_WIDTH) : glm::vec3(0.0f, 0.0f, 0.0f);        // v4 -> v5
-                boundaryVertices[9] = isWater[4] != isWater[6] ? glm::vec3(0.0f, (-CELL_WIDTH * localPhis[4]) / (localPhis[6] - localPhis[4]), CELL_WIDTH) : glm::vec3(0.0f, 0.0f, 0.0f);        // v4 -> v6
-                boundaryVertices[10] = isWater[5] != isWater[7] ? glm::vec3(CELL_WIDTH, (-CELL_WIDTH * localPhis[5]) / (localPhis[7] - localPhis[5]), CELL_WIDTH) : glm::vec3(0.0f, 0.0f, 0.0f); // v5 -> v7
-                boundaryVertices[11] = isWater[6] != isWater[7] ? glm::vec3((-CELL_WIDTH * localPhis[6]) / (localPhis[7] - localPhis[6]), CELL_WIDTH, CELL_WIDTH) : glm::vec3(0.0f, 0.0f, 0.0f); // v6 -> v7
+    for (uint32_t field = 0; field < FIELD_COUNT; field++)
+    {
+        const FieldSpan values = fields.current((FieldId)field);
+        values.read(checkpointImage.field((CheckpointField)field)); // checkpoints always hold fp32
+    }
+    gatherPressure(checkpointImage.field(CHECKPOINT_PRESSURE));
+    return checkpointWriter.submit(path, checkpointImage);
+}
 
-                for (uint32_t i = 0; i < marchingCube.size(); i++)
+// Pressures of the active bricks at full resolution, zero elsewhere
+void Grid::gatherPressure(float *dense) const
+{
+    solver.gather(SOLVER_PRESSURE, dense);
+    for (uint32_t brick : solver.activeBricks())
+    {
+        if (!isCoarse(brick))
+        {
+            continue;
+        }
+        // every cell of an aggregate has its pressure
+        const BrickInfo &brickInfo = solver.info(brick);
+        const float *coarse = solver.data(SOLVER_PRESSURE, brick);
+        for (uint32_t li = 0; li < BRICK_SIZE; li++)
+        {
+            for (uint32_t lj = 0; lj < BRICK_SIZE; lj++)
+            {
+                for (uint32_t lk = 0; lk < BRICK_SIZE; lk++)
                 {
-                    Triple triangle = marchingCube[i]; // { 0, 1, 4}
-                    uint32_t startIndex = vertices.size();
-                    uint32_t indicesSize = indices.size();
-                    vertices.resize(startIndex + 3);
-                    indices.resize(indicesSize + 3);
-                    glm::vec3 normal = glm::normalize(glm::cross(boundaryVertices[triangle[1]] - boundaryVertices[triangle[0]], boundaryVertices[triangle[2]] - boundaryVertices[triangle[0]]));
-                    for (uint32_t j = 0; j < 3; j++)
-                    {
-                        vertices[startIndex + j] = {boundaryVertices[triangle[j]] + position, normal, SURFACE_COLOR};
-                        indices[indicesSize + j] = startIndex + j;
-                    }
+                    uint32_t base_index = (brickInfo.bi * BRICK_SIZE + li) * NyNz + (brickInfo.bj * BRICK_SIZE + lj) * Nz + brickInfo.bk * BRICK_SIZE + lk;
+                    dense[base_index] = 0.5f * coarse[coarseCell(li >> 1, lj >> 1, lk >> 1)];
                 }
             }
         }
     }
-    std::cout << "Number of triangles: " << indices.size() / 3 << std::endl;
+}
+
+void Grid::loadCheckpoint(const std::string &path)
+{
+    MappedCheckpoint checkpoint(path);
+    const CheckpointHeader &header = checkpoint.header();
+    if (header.nx != Nx || header.ny != Ny || header.nz != Nz)
+    {
+        throw std::runtime_error("Checkpoint grid dimensions do not match this build");
+    }
+
+    // fields are copied straight out of the mapped pages, both storage slots get the same state
+    for (uint32_t field = 0; field < FIELD_COUNT; field++)
+    {
+        const float *values = checkpoint.field((CheckpointField)field, fields.size((FieldId)field));
+        fields.current((FieldId)field).write(values);
+        fields.previous((FieldId)field).write(values);
+    }
+    for (uint32_t axis = 0; axis < 3; axis++)
+    {
+        windowOrigin[axis] = header.windowOrigin[axis];
+    }
+    particles.clear(); // not checkpointed, the next step seeds the liquid again from the grid velocities
+    resetDerivedState();
+    solver.scatter(SOLVER_PRESSURE, checkpoint.field(CHECKPOINT_PRESSURE, (uint64_t)Nx * NyNz)); // warm start for the first solve
+
+    simTime = header.simTime;
+    frame = header.frame;
+}
+
+// Rebuilds the band, the solver bricks and the surface cache from phi alone
+void Grid::resetDerivedState()
+{
+    resetBand();
+    tallTop = tallBottom = Ny - 2; // placed again by the next updateSOE
+    brickCoarse.assign(brickCoarse.size(), 0); // likewise, pressures are scattered at full resolution
+    updateSolverBricks(true);
+    if (options.refineSurface)
+    {
+        updateFineBricks(true); // fine phi is not kept, it starts again from the samples
+    }
+    surfaceReset = true;
+}
+
+void Grid::copyPhi(void *out) const
+{
+    const FieldSpan phi = fields.current(FIELD_PHI);
+#if defined(FIELD_STORAGE_FP16)
+    std::memcpy(out, phi.data(), phi.size() * sizeof(FieldStorage)); // already the half format the renderer samples
+#else
+    phi.read(static_cast<float *>(out));
+#endif
+}
+
+void Grid::captureFields(FieldFrame &out, float bandWidth)
+{
+    const FieldSpan phi = fields.current(FIELD_PHI);
+    const FieldSpan u_minus = fields.current(FIELD_U_MINUS);
+    const FieldSpan v_minus = fields.current(FIELD_V_MINUS);
+    const FieldSpan w_minus = fields.current(FIELD_W_MINUS);
+
+    out.frame = frame;
+    out.simTime = simTime;
+    out.bandWidth = bandWidth;
+    out.windowOrigin = windowOrigin;
+    out.runs.clear();
+    for (std::vector<float> &values : out.values)
+    {
+        values.clear();
+    }
+
+    uint32_t runStart = 0;
+    uint32_t lastEnd = 0;
+    bool inBand = false;
+    for (uint32_t index = 0; index < Nx * NyNz; index++)
+    {
+        bool active = std::abs(phi[index]) < bandWidth;
+        if (active)
+        {
+            if (!inBand)
+            {
+                runStart = index;
+                inBand = true;
+            }
+            out.values[0].push_back(phi[index]);
+            out.values[1].push_back(u_minus[index]);
+            out.values[2].push_back(v_minus[index]);
+            out.values[3].push_back(w_minus[index]);
+        }
+        else if (inBand)
+        {
+            out.runs.push_back(runStart - lastEnd);
+            out.runs.push_back(index - runStart);
+            lastEnd = index;
+            inBand = false;
+        }
+    }
+    if (inBand)
+    {
+        out.runs.push_back(runStart - lastEnd);
+        out.runs.push_back(Nx * NyNz - runStart);
+    }
 }
 
 void Grid::flipStorage()
 {
-    newStorage = 1 - newStorage;
-    oldStorage = 1 - oldStorage;
+    fields.swap();
 }
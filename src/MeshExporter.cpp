@@ -0,0 +1,163 @@
+#include "MeshExporter.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+constexpr uint32_t FLOATS_PER_VERTEX = 9;
+constexpr size_t FACE_RECORD_BYTES = 1 + 3 * sizeof(uint32_t); // uchar count + three uint indices
+
+MeshExporter::MeshExporter(const std::string &prefix) : prefix(prefix), worker(&MeshExporter::run, this) {}
+
+MeshExporter::~MeshExporter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    meshQueued.notify_one();
+    worker.join(); // the pending frame, if any, is still written
+    printStats();
+}
+
+void MeshExporter::submit(uint64_t frame, std::vector<Vertex> &vertices, std::vector<uint32_t> &indices)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (backFull)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        bufferFreed.wait(lock, [this]
+                         { return !backFull; });
+        stallSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        stalledFrames++;
+    }
+    std::swap(backVertices, vertices);
+    std::swap(backIndices, indices);
+    backFrame = frame;
+    backFull = true;
+    lock.unlock();
+    meshQueued.notify_one();
+}
+
+void MeshExporter::printStats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    double megabytes = bytesWritten / (1024.0 * 1024.0);
+    double throughput = writeSeconds > 0.0 ? megabytes / writeSeconds : 0.0;
+    uint32_t queued = (backFull ? 1 : 0) + (writing ? 1 : 0);
+    std::cout << "Mesh export: " << framesWritten << " frames, " << megabytes << " MB, " << throughput << " MB/s, "
+              << queued << " queued, " << stalledFrames << " stalls (" << stallSeconds * 1000.0 << " ms)";
+    if (failedFrames > 0)
+    {
+        std::cout << ", " << failedFrames << " failed";
+    }
+    std::cout << std::endl;
+}
+
+void MeshExporter::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        meshQueued.wait(lock, [this]
+                        { return backFull || stopping; });
+        if (!backFull)
+        {
+            return;
+        }
+        std::swap(frontVertices, backVertices);
+        std::swap(frontIndices, backIndices);
+        frontFrame = backFrame;
+        backFull = false;
+        writing = true;
+        lock.unlock();
+        bufferFreed.notify_one();
+
+        writeMesh();
+
+        lock.lock();
+        writing = false;
+    }
+}
+
+void MeshExporter::writeMesh()
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    size_t vertexCount = frontVertices.size();
+    size_t faceCount = frontIndices.size() / 3;
+
+    // Vertex may be padded depending on glm alignment settings, so pack to 9 floats explicitly
+    packedVertices.resize(vertexCount * FLOATS_PER_VERTEX);
+    for (size_t v = 0; v < vertexCount; v++)
+    {
+        const Vertex &vertex = frontVertices[v];
+        float *out = &packedVertices[v * FLOATS_PER_VERTEX];
+        out[0] = vertex.pos.x;
+        out[1] = vertex.pos.y;
+        out[2] = vertex.pos.z;
+        out[3] = vertex.normal.x;
+        out[4] = vertex.normal.y;
+        out[5] = vertex.normal.z;
+        out[6] = vertex.color.x;
+        out[7] = vertex.color.y;
+        out[8] = vertex.color.z;
+    }
+
+    packedFaces.resize(faceCount * FACE_RECORD_BYTES);
+    for (size_t f = 0; f < faceCount; f++)
+    {
+        uint8_t *out = &packedFaces[f * FACE_RECORD_BYTES];
+        out[0] = 3;
+        std::memcpy(out + 1, &frontIndices[f * 3], 3 * sizeof(uint32_t));
+    }
+
+    char header[512];
+    int headerSize = std::snprintf(header, sizeof(header),
+                                   "ply\n"
+                                   "format binary_little_endian 1.0\n"
+                                   "comment frame %llu\n"
+                                   "element vertex %zu\n"
+                                   "property float x\nproperty float y\nproperty float z\n"
+                                   "property float nx\nproperty float ny\nproperty float nz\n"
+                                   "property float red\nproperty float green\nproperty float blue\n"
+                                   "element face %zu\n"
+                                   "property list uchar uint vertex_indices\n"
+                                   "end_header\n",
+                                   (unsigned long long)frontFrame, vertexCount, faceCount);
+
+    char path[64];
+    std::snprintf(path, sizeof(path), "_%06llu.ply", (unsigned long long)frontFrame);
+    std::string filename = prefix + path;
+
+    // header, vertices and faces go out in a single syscall
+    iovec iov[3] = {
+        {header, (size_t)headerSize},
+        {packedVertices.data(), packedVertices.size() * sizeof(float)},
+        {packedFaces.data(), packedFaces.size()}};
+    size_t total = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
+
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0 && writev(fd, iov, 3) == (ssize_t)total;
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    std::lock_guard<std::mutex> lock(mutex);
+    writeSeconds += seconds;
+    if (ok)
+    {
+        framesWritten++;
+        bytesWritten += total;
+    }
+    else
+    {
+        failedFrames++;
+    }
+}
@@ -0,0 +1,184 @@
+#include "ParticleSet.h"
+#include <algorithm>
+
+constexpr uint32_t PARTICLE_CHUNK = 16384; // particles per task of the slab pass
+
+// Pools grow by at least half, so appending a few particles each step does not reallocate each step
+static inline size_t grownSize(size_t size, size_t needed)
+{
+    return size >= needed ? size : std::max(needed, size + size / 2);
+}
+
+ParticleSet::ParticleSet(uint32_t channelCount, uint32_t slabCount, uint32_t cellsPerSlab) : slabs(slabCount), slabCells(cellsPerSlab)
+{
+    pools.resize(channelCount);
+    scratch.resize(channelCount);
+    starts.assign((size_t)slabs * slabCells + 1, 0);
+    slabCounts.resize(slabs);
+    slabOffsets.resize(slabs + 1);
+}
+
+uint32_t ParticleSet::append(uint32_t added)
+{
+    uint32_t first = count;
+    count += added;
+    for (std::vector<float> &pool : pools)
+    {
+        pool.resize(grownSize(pool.size(), count));
+    }
+    return first;
+}
+
+void ParticleSet::clear()
+{
+    count = 0;
+    std::fill(starts.begin(), starts.end(), 0);
+}
+
+uint32_t ParticleSet::rebin(const uint32_t *keys, uint32_t maxPerCell, ThreadPool &threadPool)
+{
+    const uint32_t channelCount = (uint32_t)pools.size();
+    for (std::vector<float> &pool : scratch)
+    {
+        pool.resize(grownSize(pool.size(), count));
+    }
+    scratchKeys.resize(grownSize(scratchKeys.size(), count));
+    destinations.resize(grownSize(destinations.size(), count));
+
+    // slab pass: each chunk counts its particles per slab, the counts are turned into slab-major offsets so every
+    // chunk writes its own runs, then the chunk scatters its particles channel by channel
+    const uint32_t chunks = (count + PARTICLE_CHUNK - 1) / PARTICLE_CHUNK;
+    chunkSlabs.assign((size_t)chunks * slabs, 0);
+    threadPool.parallelFor(chunks, 1, [&](uint32_t begin, uint32_t end)
+                           {
+        for (uint32_t chunk = begin; chunk < end; chunk++)
+        {
+            uint32_t *slabHistogram = &chunkSlabs[(size_t)chunk * slabs];
+            for (uint32_t n = chunk * PARTICLE_CHUNK; n < std::min((chunk + 1) * PARTICLE_CHUNK, count); n++)
+            {
+                if (keys[n] != PARTICLE_DROPPED)
+                {
+                    slabHistogram[keys[n] / slabCells]++;
+                }
+            }
+        } });
+    uint32_t sorted = 0;
+    for (uint32_t slab = 0; slab < slabs; slab++)
+    {
+        slabOffsets[slab] = sorted;
+        for (uint32_t chunk = 0; chunk < chunks; chunk++)
+        {
+            uint32_t inSlab = chunkSlabs[(size_t)chunk * slabs + slab];
+            chunkSlabs[(size_t)chunk * slabs + slab] = sorted;
+            sorted += inSlab;
+        }
+    }
+    slabOffsets[slabs] = sorted;
+    threadPool.parallelFor(chunks, 1, [&](uint32_t begin, uint32_t end)
+                           {
+        for (uint32_t chunk = begin; chunk < end; chunk++)
+        {
+            uint32_t *cursors = &chunkSlabs[(size_t)chunk * slabs];
+            uint32_t first = chunk * PARTICLE_CHUNK;
+            uint32_t last = std::min(first + PARTICLE_CHUNK, count);
+            for (uint32_t n = first; n < last; n++)
+            {
+                uint32_t key = keys[n];
+                destinations[n] = key == PARTICLE_DROPPED ? PARTICLE_DROPPED : cursors[key / slabCells]++;
+                if (key != PARTICLE_DROPPED)
+                {
+                    scratchKeys[destinations[n]] = key;
+                }
+            }
+            for (uint32_t channel = 0; channel < channelCount; channel++)
+            {
+                const float *from = pools[channel].data();
+                float *to = scratch[channel].data();
+                for (uint32_t n = first; n < last; n++)
+                {
+                    if (destinations[n] != PARTICLE_DROPPED)
+                    {
+                        to[destinations[n]] = from[n];
+                    }
+                }
+            }
+        } });
+
+    // cell pass: each slab counts its cells, capped at maxPerCell, and once the slabs are placed scatters its
+    // particles back in cell order
+    threadPool.parallelFor(slabs, 1, [&](uint32_t begin, uint32_t end)
+                           {
+        for (uint32_t slab = begin; slab < end; slab++)
+        {
+            uint32_t *cellCounts = &starts[(size_t)slab * slabCells];
+            std::fill_n(cellCounts, slabCells, 0);
+            for (uint32_t n = slabOffsets[slab]; n < slabOffsets[slab + 1]; n++)
+            {
+                cellCounts[scratchKeys[n] - slab * slabCells]++;
+            }
+            uint32_t kept = 0;
+            for (uint32_t cell = 0; cell < slabCells; cell++)
+            {
+                cellCounts[cell] = std::min(cellCounts[cell], maxPerCell);
+                kept += cellCounts[cell];
+            }
+            slabCounts[slab] = kept;
+        } });
+    uint32_t kept = 0;
+    for (uint32_t slab = 0; slab < slabs; slab++)
+    {
+        uint32_t inSlab = slabCounts[slab];
+        slabCounts[slab] = kept;
+        kept += inSlab;
+    }
+    threadPool.parallelFor(slabs, 1, [&](uint32_t begin, uint32_t end)
+                           {
+        static thread_local std::vector<uint32_t> cursors;
+        static thread_local std::vector<uint32_t> limits;
+        cursors.resize(slabCells);
+        limits.resize(slabCells);
+        for (uint32_t slab = begin; slab < end; slab++)
+        {
+            uint32_t *cellStarts = &starts[(size_t)slab * slabCells];
+            uint32_t next = slabCounts[slab];
+            for (uint32_t cell = 0; cell < slabCells; cell++)
+            {
+                cursors[cell] = next;
+                next += cellStarts[cell];
+                limits[cell] = next;
+                cellStarts[cell] = cursors[cell];
+            }
+            for (uint32_t n = slabOffsets[slab]; n < slabOffsets[slab + 1]; n++)
+            {
+                uint32_t cell = scratchKeys[n] - slab * slabCells;
+                destinations[n] = cursors[cell] < limits[cell] ? cursors[cell]++ : PARTICLE_DROPPED;
+            }
+            for (uint32_t channel = 0; channel < channelCount; channel++)
+            {
+                const float *from = scratch[channel].data();
+                float *to = pools[channel].data();
+                for (uint32_t n = slabOffsets[slab]; n < slabOffsets[slab + 1]; n++)
+                {
+                    if (destinations[n] != PARTICLE_DROPPED)
+                    {
+                        to[destinations[n]] = from[n];
+                    }
+                }
+            }
+        } });
+    starts[(size_t)slabs * slabCells] = kept;
+
+    uint32_t removed = count - kept;
+    count = kept;
+    return removed;
+}
+
+size_t ParticleSet::memoryBytes() const
+{
+    size_t bytes = (scratchKeys.size() + destinations.size() + starts.size() + chunkSlabs.size()) * sizeof(uint32_t);
+    for (uint32_t channel = 0; channel < pools.size(); channel++)
+    {
+        bytes += (pools[channel].size() + scratch[channel].size()) * sizeof(float);
+    }
+    return bytes;
+}
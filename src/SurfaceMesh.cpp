@@ -0,0 +1,144 @@
+#include "SurfaceMesh.h"
+#include <algorithm>
+#include <stdexcept>
+
+// Unused slots become zero-area triangles at the origin, which rasterise to nothing
+static const Vertex DEGENERATE_VERTEX = {glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f)};
+
+SurfaceMesh::SurfaceMesh(uint32_t cubesX, uint32_t cubesY, uint32_t cubesZ, uint32_t maxVertices)
+    : brickDims{(cubesX + SURFACE_BRICK_SIZE - 1) / SURFACE_BRICK_SIZE, (cubesY + SURFACE_BRICK_SIZE - 1) / SURFACE_BRICK_SIZE,
+                (cubesZ + SURFACE_BRICK_SIZE - 1) / SURFACE_BRICK_SIZE},
+      capacity(maxVertices)
+{
+    bricks.resize((size_t)brickDims[0] * brickDims[1] * brickDims[2]);
+}
+
+void SurfaceMesh::update(uint32_t brick, uint64_t hash, const std::vector<Vertex> &brickVertices)
+{
+    Brick &entry = bricks[brick];
+    uint32_t count = (uint32_t)brickVertices.size();
+    entry.hash = hash;
+    entry.meshed = true;
+    triangles = triangles - entry.count / 3 + count / 3;
+
+    uint32_t sizeClass = NO_BLOCK;
+    if (count > 0)
+    {
+        sizeClass = 0;
+        while (blockVertices(sizeClass) < count)
+        {
+            sizeClass++;
+        }
+    }
+
+    // keep the block unless the mesh outgrew it or now fits in a quarter of it
+    if (entry.sizeClass != NO_BLOCK && (sizeClass == NO_BLOCK || sizeClass > entry.sizeClass || sizeClass + 2 <= entry.sizeClass))
+    {
+        clearSlots(entry.first, entry.count);
+        freeBlocks[entry.sizeClass].push_back(entry.first);
+        entry.sizeClass = NO_BLOCK;
+        entry.count = 0;
+    }
+    if (sizeClass == NO_BLOCK)
+    {
+        return;
+    }
+    if (entry.sizeClass == NO_BLOCK)
+    {
+        entry.sizeClass = sizeClass;
+        entry.first = allocateBlock(sizeClass);
+        entry.count = 0;
+    }
+
+    std::copy(brickVertices.begin(), brickVertices.end(), arena.begin() + entry.first);
+    if (count < entry.count)
+    {
+        clearSlots(entry.first + count, entry.count - count);
+    }
+    dirty.push_back({entry.first, count});
+    entry.count = count;
+}
+
+void SurfaceMesh::invalidate()
+{
+    for (Brick &entry : bricks)
+    {
+        entry.meshed = false;
+    }
+}
+
+uint32_t SurfaceMesh::allocateBlock(uint32_t sizeClass)
+{
+    if (freeBlocks.size() <= sizeClass)
+    {
+        freeBlocks.resize(sizeClass + 1);
+    }
+    if (!freeBlocks[sizeClass].empty())
+    {
+        uint32_t first = freeBlocks[sizeClass].back();
+        freeBlocks[sizeClass].pop_back();
+        return first;
+    }
+
+    uint32_t first = (uint32_t)arena.size();
+    if ((uint64_t)first + blockVertices(sizeClass) > capacity)
+    {
+        throw std::runtime_error("Surface mesh does not fit in the vertex buffer");
+    }
+    arena.resize(first + blockVertices(sizeClass), DEGENERATE_VERTEX);
+    return first;
+}
+
+void SurfaceMesh::clearSlots(uint32_t first, uint32_t count)
+{
+    if (count == 0)
+    {
+        return;
+    }
+    std::fill_n(arena.begin() + first, count, DEGENERATE_VERTEX);
+    dirty.push_back({first, count});
+}
+
+const std::vector<VertexRange> &SurfaceMesh::dirtyRanges()
+{
+    std::sort(dirty.begin(), dirty.end(), [](const VertexRange &a, const VertexRange &b)
+              { return a.first < b.first; });
+    size_t merged = 0;
+    for (size_t n = 0; n < dirty.size(); n++)
+    {
+        if (dirty[n].count == 0)
+        {
+            continue;
+        }
+        if (merged > 0 && dirty[merged - 1].first + dirty[merged - 1].count >= dirty[n].first)
+        {
+            uint32_t end = std::max(dirty[merged - 1].first + dirty[merged - 1].count, dirty[n].first + dirty[n].count);
+            dirty[merged - 1].count = end - dirty[merged - 1].first;
+        }
+        else
+        {
+            dirty[merged++] = dirty[n];
+        }
+    }
+    dirty.resize(merged);
+    return dirty;
+}
+
+void SurfaceMesh::compact(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices) const
+{
+    vertices.resize(0);
+    indices.resize(0);
+    for (const Brick &entry : bricks)
+    {
+        if (entry.sizeClass == NO_BLOCK)
+        {
+            continue;
+        }
+        vertices.insert(vertices.end(), arena.begin() + entry.first, arena.begin() + entry.first + entry.count);
+    }
+    indices.resize(vertices.size());
+    for (uint32_t n = 0; n < indices.size(); n++)
+    {
+        indices[n] = n;
+    }
+}
@@ -0,0 +1,259 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+static thread_local bool insideWorker = false;
+
+uint32_t TaskGraph::add(std::function<void()> body)
+{
+    tasks.push_back({std::move(body), {}, 0});
+    return (uint32_t)tasks.size() - 1;
+}
+
+void TaskGraph::precede(uint32_t before, uint32_t after)
+{
+    tasks[before].successors.push_back(after);
+    tasks[after].predecessors++;
+}
+
+ThreadPool::ThreadPool(uint32_t threadCount)
+{
+    uint32_t extraThreads = std::max(threadCount, 1u) - 1; // the caller is the remaining thread
+    queues = std::make_unique<TaskQueue[]>(extraThreads + 1);
+    for (uint32_t t = 0; t < extraThreads; t++)
+    {
+        workers.emplace_back(&ThreadPool::workerLoop, this, t + 1);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    jobReady.notify_all();
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::parallelFor(uint32_t count, uint32_t grain, const std::function<void(uint32_t, uint32_t)> &body)
+{
+    grain = std::max(grain, 1u);
+    if (workers.empty() || count <= grain || insideWorker)
+    {
+        body(0, count);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &body;
+        jobCount = count;
+        jobGrain = grain;
+        nextIndex.store(0, std::memory_order_relaxed);
+        busyWorkers = (uint32_t)workers.size();
+        generation++;
+    }
+    jobReady.notify_all();
+
+    insideWorker = true;
+    runChunks();
+    insideWorker = false;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    jobDone.wait(lock, [this]
+                 { return busyWorkers == 0; });
+    job = nullptr;
+}
+
+void ThreadPool::runChunks()
+{
+    while (true)
+    {
+        uint32_t begin = nextIndex.fetch_add(jobGrain, std::memory_order_relaxed);
+        if (begin >= jobCount)
+        {
+            return;
+        }
+        (*job)(begin, std::min(begin + jobGrain, jobCount));
+    }
+}
+
+void ThreadPool::run(TaskGraph &taskGraph)
+{
+    const uint32_t count = taskGraph.size();
+    if (taskGraph.pending.size() != count)
+    {
+        taskGraph.pending = std::vector<std::atomic<uint32_t>>(count);
+    }
+    for (uint32_t task = 0; task < count; task++)
+    {
+        taskGraph.pending[task].store(taskGraph.tasks[task].predecessors, std::memory_order_relaxed);
+    }
+
+    if (workers.empty() || insideWorker)
+    {
+        // one thread: Kahn's order from a stack, which keeps to the newest ready task like the queues do
+        std::vector<uint32_t> ready;
+        for (uint32_t task = count; task-- > 0;)
+        {
+            if (taskGraph.tasks[task].predecessors == 0)
+            {
+                ready.push_back(task);
+            }
+        }
+        while (!ready.empty())
+        {
+            uint32_t task = ready.back();
+            ready.pop_back();
+            taskGraph.tasks[task].body();
+            for (uint32_t successor : taskGraph.tasks[task].successors)
+            {
+                if (--taskGraph.pending[successor] == 0)
+                {
+                    ready.push_back(successor);
+                }
+            }
+        }
+        return;
+    }
+
+    // the tasks ready from the start are dealt round the threads
+    const uint32_t threads = size();
+    uint32_t dealt = 0;
+    for (uint32_t task = 0; task < count; task++)
+    {
+        if (taskGraph.tasks[task].predecessors == 0)
+        {
+            queues[dealt++ % threads].tasks.push_back(task);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        graph = &taskGraph;
+        tasksLeft.store(count, std::memory_order_relaxed);
+        busyWorkers = (uint32_t)workers.size();
+        generation++;
+    }
+    jobReady.notify_all();
+
+    insideWorker = true;
+    runTasks(0);
+    insideWorker = false;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    jobDone.wait(lock, [this]
+                 { return busyWorkers == 0; });
+    graph = nullptr;
+}
+
+void ThreadPool::runTasks(uint32_t self)
+{
+    while (tasksLeft.load(std::memory_order_acquire) > 0)
+    {
+        uint64_t pushed = pushCount.load();
+        uint32_t task;
+        if (!takeTask(self, task))
+        {
+            // the remaining tasks wait on ones other threads are running; sleep until one of those makes a task
+            // ready or the last one finishes
+            std::unique_lock<std::mutex> lock(idleMutex);
+            idleThreads++;
+            taskPushed.wait(lock, [&]
+                            { return pushCount.load() != pushed || tasksLeft.load() == 0; });
+            idleThreads--;
+            continue;
+        }
+        graph->tasks[task].body();
+        for (uint32_t successor : graph->tasks[task].successors)
+        {
+            if (graph->pending[successor].fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                pushTask(self, successor);
+            }
+        }
+        if (tasksLeft.fetch_sub(1) == 1)
+        {
+            std::lock_guard<std::mutex> lock(idleMutex);
+            taskPushed.notify_all();
+        }
+    }
+}
+
+void ThreadPool::pushTask(uint32_t self, uint32_t task)
+{
+    {
+        std::lock_guard<std::mutex> lock(queues[self].mutex);
+        queues[self].tasks.push_back(task);
+    }
+    // an idle thread either sees the new count before it sleeps or is counted here and woken
+    pushCount++;
+    if (idleThreads.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(idleMutex);
+        taskPushed.notify_one();
+    }
+}
+
+// The newest task of this thread's own deque, else the oldest of the first other thread that has one
+bool ThreadPool::takeTask(uint32_t self, uint32_t &task)
+{
+    const uint32_t threads = size();
+    for (uint32_t n = 0; n < threads; n++)
+    {
+        TaskQueue &queue = queues[(self + n) % threads];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+        {
+            continue;
+        }
+        if (n == 0)
+        {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+        }
+        else
+        {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::workerLoop(uint32_t index)
+{
+    insideWorker = true;
+    uint64_t seenGeneration = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        jobReady.wait(lock, [&]
+                      { return stopping || generation != seenGeneration; });
+        if (stopping)
+        {
+            return;
+        }
+        seenGeneration = generation;
+        bool graphJob = graph != nullptr;
+        lock.unlock();
+
+        if (graphJob)
+        {
+            runTasks(index);
+        }
+        else
+        {
+            runChunks();
+        }
+
+        lock.lock();
+        if (--busyWorkers == 0)
+        {
+            jobDone.notify_one();
+        }
+    }
+}
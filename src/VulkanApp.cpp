@@ -31,16 +31,33 @@ const uint32_t HEIGHT = 600;
 const int MAX_FRAMES_IN_FLIGHT = 2;
 const size_t MAX_VERTICES = 1'000'000;
 
+// phi samples are uploaded as the grid stores them, so fp16 builds skip the conversion
+#if defined(FIELD_STORAGE_FP16)
+const VkFormat PHI_TEXTURE_FORMAT = VK_FORMAT_R16_SFLOAT;
+const VkDeviceSize PHI_TEXEL_SIZE = 2;
+#else
+const VkFormat PHI_TEXTURE_FORMAT = VK_FORMAT_R32_SFLOAT;
+const VkDeviceSize PHI_TEXEL_SIZE = 4;
+#endif
+
 struct UniformBufferObject
 {
     alignas(16) glm::mat4 model;
     alignas(16) glm::mat4 view;
     alignas(16) glm::mat4 proj;
+    // raymarch mode only
+    alignas(16) glm::mat4 inverseViewProj;
+    alignas(16) glm::vec4 eye;
+    alignas(16) glm::vec4 gridOrigin; // world position of phi sample (0, 0, 0), w = 1 / cell width
+    alignas(16) glm::vec4 gridSize;   // phi samples along i, j, k
 };
 
 void VulkanApp::run()
 {
-    initWindow();
+    if (!options.headless)
+    {
+        initWindow();
+    }
     initVulkan();
     mainLoop();
     cleanup();
@@ -65,10 +82,20 @@ void VulkanApp::framebufferResizeCallback(GLFWwindow *window, int width, int hei
 void VulkanApp::initVulkan()
 {
     createInstance();
-    createSurface();
+    if (!options.headless)
+    {
+        createSurface();
+    }
     pickPhysicalDevice();
     createLogicalDevice();
-    createSwapChain();
+    if (options.headless)
+    {
+        createOffscreenTargets();
+    }
+    else
+    {
+        createSwapChain();
+    }
     createImageViews();
     createRenderPass();
     createDescriptorSetLayout();
@@ -77,33 +104,114 @@ void VulkanApp::initVulkan()
     createDepthResources();
     createFramebuffers();
     createVertexBuffer();
-    createIndexBuffer();
+    if (options.raymarch)
+    {
+        createPhiTexture();
+    }
     createUniformBuffers();
     createDescriptorPool();
     createDescriptorSets();
     createCommandBuffers();
     createSyncObjects();
+    if (options.headless)
+    {
+        createReadbackBuffers();
+    }
 }
 
 void VulkanApp::mainLoop()
 {
     float deltaT = 0.04f; // if this is zero, solver will break
-    while (!glfwWindowShouldClose(window))
+    if (!options.restorePath.empty())
+    {
+        grid_ptr->loadCheckpoint(options.restorePath);
+        std::cout << "Restored " << options.restorePath << " at t = " << grid_ptr->getSimTime() << " s" << std::endl;
+    }
+    if (!options.capturePath.empty())
+    {
+        fieldWriter = std::make_unique<FieldSequenceWriter>(options.capturePath);
+    }
+    if (!options.meshPrefix.empty())
+    {
+        meshExporter = std::make_unique<MeshExporter>(options.meshPrefix);
+    }
+    if (options.targetFrameTime > 0.0)
+    {
+        governor = std::make_unique<FrameGovernor>(options.targetFrameTime);
+    }
+    auto runStart = std::chrono::high_resolution_clock::now();
+    uint32_t framesRendered = 0;
+    while (options.headless ? framesRendered < options.headlessFrames : !glfwWindowShouldClose(window))
     {
-        glfwPollEvents();
+        if (!options.headless)
+        {
+            glfwPollEvents();
+        }
         auto start = std::chrono::high_resolution_clock::now();
-        grid_ptr->advect(deltaT);
+        if (options.pipeline)
+        {
+            grid_ptr->advectAndAssemble(deltaT);
+        }
+        else
+        {
+            grid_ptr->advect(deltaT);
+        }
         auto start0 = std::chrono::high_resolution_clock::now();
-        grid_ptr->updateSOE(deltaT);
+        if (!options.pipeline)
+        {
+            grid_ptr->updateSOE(deltaT);
+        }
         auto start1 = std::chrono::high_resolution_clock::now();
         grid_ptr->solveSOE();
-        grid_ptr->project(deltaT);
+        auto startProject = std::chrono::high_resolution_clock::now();
+        // raymarching draws phi directly, the mesh is only needed for export, which the governor never thins out
+        bool meshDue = !governor || framesRendered % governor->getMeshInterval() == 0;
+        bool meshWanted = (!options.raymarch && meshDue) || meshExporter;
+        if (options.pipeline)
+        {
+            // the mesh is built beside the projection, its time lands in the project column
+            grid_ptr->projectAndMesh(deltaT, meshWanted ? surfaceMesh.get() : nullptr);
+        }
+        else
+        {
+            grid_ptr->project(deltaT);
+        }
         auto start2 = std::chrono::high_resolution_clock::now();
-        // grid_ptr->smoothSurface();
+        grid_ptr->smoothSurface();
         auto start3 = std::chrono::high_resolution_clock::now();
-        grid_ptr->constructSurface(vertices, indices);
+        if (meshWanted && !options.pipeline)
+        {
+            grid_ptr->constructSurface(*surfaceMesh);
+        }
         auto start4 = std::chrono::high_resolution_clock::now();
-        drawFrame();
+        if (options.checkpointInterval > 0 && grid_ptr->getFrame() % options.checkpointInterval == 0)
+        {
+            grid_ptr->saveCheckpoint(options.checkpointPath);
+        }
+        if (fieldWriter)
+        {
+            grid_ptr->captureFields(fieldWriter->acquire(), options.captureBand * CELL_WIDTH);
+            fieldWriter->submit();
+        }
+        if (options.headless)
+        {
+            drawFrameOffscreen();
+        }
+        else
+        {
+            drawFrame();
+        }
+        framesRendered++;
+        if (meshExporter)
+        {
+            // the mesh has already been copied to the staging buffer, hand a compacted copy to the exporter
+            surfaceMesh->compact(vertices, indices);
+            meshExporter->submit(grid_ptr->getFrame(), vertices, indices);
+            if (grid_ptr->getFrame() % 100 == 0)
+            {
+                meshExporter->printStats();
+            }
+        }
         auto end = std::chrono::high_resolution_clock::now();
         auto duration0 = std::chrono::duration_cast<std::chrono::milliseconds>(start0 - start);
         auto duration1 = std::chrono::duration_cast<std::chrono::milliseconds>(start1 - start0);
@@ -111,7 +219,29 @@ void VulkanApp::mainLoop()
         auto duration3 = std::chrono::duration_cast<std::chrono::milliseconds>(start3 - start2);
         auto duration4 = std::chrono::duration_cast<std::chrono::milliseconds>(start4 - start3);
         auto duration5 = std::chrono::duration_cast<std::chrono::milliseconds>(end - start4);
-        std::cout << duration0.count() << " ms, " << duration1.count() << " ms, " << duration2.count() << " ms, " << duration3.count() << " ms, " << duration4.count() << " ms, " << duration5.count() << " ms" << std::endl;
+        std::cout << duration0.count() << " ms, " << duration1.count() << " ms, " << duration2.count() << " ms, " << duration3.count() << " ms, " << duration4.count() << " ms, " << duration5.count() << " ms";
+        if (governor)
+        {
+            FrameTimings timings;
+            timings.advect = std::chrono::duration<double>(start0 - start).count();
+            timings.assemble = std::chrono::duration<double>(start1 - start0).count();
+            timings.solve = std::chrono::duration<double>(startProject - start1).count();
+            timings.project = std::chrono::duration<double>(start2 - startProject).count();
+            timings.reinit = std::chrono::duration<double>(start3 - start2).count();
+            timings.mesh = std::chrono::duration<double>(start4 - start3).count();
+            timings.present = std::chrono::duration<double>(end - start4).count();
+            governor->update(timings, grid_ptr->getSolveCut());
+            grid_ptr->setEffort(governor->getGridEffort());
+            std::cout << ", governor level " << governor->getLevel() << ", solve budget " << governor->getGridEffort().solveBudget * 1000.0 << " ms";
+        }
+        std::cout << std::endl;
+        if (options.headless)
+        {
+            // offline frames use a fixed time step and are not throttled
+            double elapsed = std::chrono::duration<double>(end - runStart).count();
+            std::cout << "Headless: " << framesRendered << " frames, " << framesRendered / elapsed << " fps" << std::endl;
+            continue;
+        }
         usleep(1000); // sleep for 1ms
 
         auto total = std::chrono::duration_cast<std::chrono::milliseconds>(end - start);
@@ -119,6 +249,17 @@ void VulkanApp::mainLoop()
         std::cout << "DeltaT = " << deltaT << " s" << std::endl;
     }
     vkDeviceWaitIdle(device);
+    if (options.headless)
+    {
+        // frames still sitting in the ring have finished rendering but were never read back
+        for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            flushReadback((currentFrame + i) % MAX_FRAMES_IN_FLIGHT);
+        }
+        frameWriter.reset();
+    }
+    fieldWriter.reset(); // flushes queued frames
+    meshExporter.reset();
 }
 
 void VulkanApp::drawFrame()
@@ -190,21 +331,74 @@ void VulkanApp::drawFrame()
     currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
 }
 
+void VulkanApp::drawFrameOffscreen()
+{
+    // waiting on this slot's fence also means its previous frame is ready to read back
+    vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+    flushReadback(currentFrame);
+
+    updateUniformBuffer(currentFrame);
+    vkResetFences(device, 1, &inFlightFences[currentFrame]);
+
+    vkResetCommandBuffer(commandBuffers[currentFrame], 0);
+    recordCommandBuffer(commandBuffers[currentFrame], currentFrame);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
+
+    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS)
+    {
+        throw std::runtime_error("Failed to submit offscreen command buffer");
+    }
+    readbackPending[currentFrame] = true;
+    currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+}
+
+void VulkanApp::flushReadback(uint32_t slot)
+{
+    if (!readbackPending[slot])
+    {
+        return;
+    }
+    vkWaitForFences(device, 1, &inFlightFences[slot], VK_TRUE, UINT64_MAX);
+    if (frameWriter)
+    {
+        frameWriter->write(static_cast<const uint8_t *>(readbackMapped[slot]));
+    }
+    readbackPending[slot] = false;
+}
+
 void VulkanApp::cleanup()
 {
     cleanupSwapChain();
     vkDestroyDescriptorPool(device, descriptorPool, nullptr);
     vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
     vkUnmapMemory(device, stagingVertexMemory);
-    vkUnmapMemory(device, stagingIndexMemory);
     vkDestroyBuffer(device, vertexBuffer, nullptr);
-    vkDestroyBuffer(device, indexBuffer, nullptr);
     vkDestroyBuffer(device, stagingVertexBuffer, nullptr);
-    vkDestroyBuffer(device, stagingIndexBuffer, nullptr);
     vkFreeMemory(device, vertexBufferMemory, nullptr);
-    vkFreeMemory(device, indexBufferMemory, nullptr);
     vkFreeMemory(device, stagingVertexMemory, nullptr);
-    vkFreeMemory(device, stagingIndexMemory, nullptr);
+    if (options.raymarch)
+    {
+        vkDestroySampler(device, phiSampler, nullptr);
+        vkDestroyImageView(device, phiImageView, nullptr);
+        vkDestroyImage(device, phiImage, nullptr);
+        vkFreeMemory(device, phiImageMemory, nullptr);
+        for (size_t i = 0; i < phiStagingBuffers.size(); i++)
+        {
+            vkUnmapMemory(device, phiStagingMemory[i]);
+            vkDestroyBuffer(device, phiStagingBuffers[i], nullptr);
+            vkFreeMemory(device, phiStagingMemory[i], nullptr);
+        }
+    }
+    for (size_t i = 0; i < readbackBuffers.size(); i++)
+    {
+        vkUnmapMemory(device, readbackMemory[i]);
+        vkDestroyBuffer(device, readbackBuffers[i], nullptr);
+        vkFreeMemory(device, readbackMemory[i], nullptr);
+    }
 
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
     {
@@ -220,10 +414,16 @@ void VulkanApp::cleanup()
     vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
     vkDestroyRenderPass(device, renderPass, nullptr);
     vkDestroyDevice(device, nullptr);
-    vkDestroySurfaceKHR(instance, surface, nullptr);
+    if (!options.headless)
+    {
+        vkDestroySurfaceKHR(instance, surface, nullptr);
+    }
     vkDestroyInstance(instance, nullptr);
-    glfwDestroyWindow(window);
-    glfwTerminate();
+    if (!options.headless)
+    {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
 }
 
 void VulkanApp::createInstance()
@@ -245,9 +445,12 @@ void VulkanApp::createInstance()
     createInfo.pApplicationInfo = &appInfo;
 
     uint32_t glfwExtensionCount = 0;
-    const char **glfwExtensions;
+    const char **glfwExtensions = nullptr;
 
-    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    if (!options.headless) // no surface extensions needed when rendering offscreen
+    {
+        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    }
 
     createInfo.enabledExtensionCount = glfwExtensionCount;
     createInfo.ppEnabledExtensionNames = glfwExtensions;
@@ -363,6 +566,49 @@ void VulkanApp::createSwapChain()
     swapChainExtent = extent;
 }
 
+void VulkanApp::createOffscreenTargets()
+{
+    swapChainImageFormat = VK_FORMAT_R8G8B8A8_UNORM; // matches the byte order PPM/Y4M conversion expects
+    swapChainExtent = {WIDTH, HEIGHT};
+
+    swapChainImages.resize(MAX_FRAMES_IN_FLIGHT);
+    offscreenImageMemory.resize(MAX_FRAMES_IN_FLIGHT);
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        createImage(WIDTH, HEIGHT, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, swapChainImages[i], offscreenImageMemory[i]);
+    }
+}
+
+void VulkanApp::createReadbackBuffers()
+{
+    VkDeviceSize frameSize = (VkDeviceSize)WIDTH * HEIGHT * 4;
+
+    readbackBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    readbackMemory.resize(MAX_FRAMES_IN_FLIGHT);
+    readbackMapped.resize(MAX_FRAMES_IN_FLIGHT);
+    readbackPending.assign(MAX_FRAMES_IN_FLIGHT, false);
+
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        // cached memory makes the CPU-side reads much faster where the device offers it
+        try
+        {
+            createBuffer(frameSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT, readbackBuffers[i], readbackMemory[i]);
+        }
+        catch (const std::runtime_error &)
+        {
+            vkDestroyBuffer(device, readbackBuffers[i], nullptr);
+            createBuffer(frameSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, readbackBuffers[i], readbackMemory[i]);
+        }
+        vkMapMemory(device, readbackMemory[i], 0, frameSize, 0, &readbackMapped[i]);
+    }
+
+    if (!options.framePath.empty())
+    {
+        frameWriter = std::make_unique<FrameWriter>(options.framePath, WIDTH, HEIGHT);
+    }
+}
+
 void VulkanApp::cleanupSwapChain()
 {
     vkDestroyImageView(device, depthImageView, nullptr);
@@ -376,7 +622,18 @@ void VulkanApp::cleanupSwapChain()
     {
         vkDestroyImageView(device, imageView, nullptr);
     }
-    vkDestroySwapchainKHR(device, swapChain, nullptr);
+    if (options.headless)
+    {
+        for (size_t i = 0; i < swapChainImages.size(); i++)
+        {
+            vkDestroyImage(device, swapChainImages[i], nullptr);
+            vkFreeMemory(device, offscreenImageMemory[i], nullptr);
+        }
+    }
+    else
+    {
+        vkDestroySwapchainKHR(device, swapChain, nullptr);
+    }
 }
 
 void VulkanApp::recreateSwapChain()
@@ -418,7 +675,7 @@ void VulkanApp::createRenderPass()
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    colorAttachment.finalLayout = options.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
     VkAttachmentDescription depthAttachment{};
     depthAttachment.format = findDepthFormat();
@@ -452,6 +709,16 @@ void VulkanApp::createRenderPass()
     subpass.pColorAttachments = &colorAttachmentRef;
     subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
+    // headless frames are copied out right after the pass, so color writes must be visible to transfer reads
+    VkSubpassDependency readbackDependency{};
+    readbackDependency.srcSubpass = 0;
+    readbackDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+    readbackDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    readbackDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    readbackDependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    readbackDependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+    std::array<VkSubpassDependency, 2> dependencies = {dependency, readbackDependency};
     std::array<VkAttachmentDescription, 2> attachments = {colorAttachment, depthAttachment};
     VkRenderPassCreateInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -459,8 +726,8 @@ void VulkanApp::createRenderPass()
     renderPassInfo.pAttachments = attachments.data();
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
+    renderPassInfo.dependencyCount = options.headless ? 2 : 1;
+    renderPassInfo.pDependencies = dependencies.data();
 
     if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS)
     {
@@ -474,13 +741,21 @@ void VulkanApp::createDescriptorSetLayout()
     uboLayoutBinding.binding = 0;
     uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
     uboLayoutBinding.descriptorCount = 1;
-    uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
     uboLayoutBinding.pImmutableSamplers = nullptr;
 
+    VkDescriptorSetLayoutBinding phiLayoutBinding{};
+    phiLayoutBinding.binding = 1;
+    phiLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    phiLayoutBinding.descriptorCount = 1;
+    phiLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    phiLayoutBinding.pImmutableSamplers = nullptr;
+
+    std::array<VkDescriptorSetLayoutBinding, 2> bindings = {uboLayoutBinding, phiLayoutBinding};
     VkDescriptorSetLayoutCreateInfo layoutInfo{};
     layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    layoutInfo.bindingCount = 1;
-    layoutInfo.pBindings = &uboLayoutBinding;
+    layoutInfo.bindingCount = options.raymarch ? 2 : 1;
+    layoutInfo.pBindings = bindings.data();
 
     if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS)
     {
@@ -522,13 +797,33 @@ void VulkanApp::createDescriptorSets()
         descriptorWrite.pTexelBufferView = nullptr; // Optional
 
         vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+
+        if (options.raymarch)
+        {
+            VkDescriptorImageInfo imageInfo{};
+            imageInfo.sampler = phiSampler;
+            imageInfo.imageView = phiImageView;
+            imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+            VkWriteDescriptorSet imageWrite{};
+            imageWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            imageWrite.dstSet = descriptorSets[i];
+            imageWrite.dstBinding = 1;
+            imageWrite.dstArrayElement = 0;
+            imageWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            imageWrite.descriptorCount = 1;
+            imageWrite.pImageInfo = &imageInfo;
+
+            vkUpdateDescriptorSets(device, 1, &imageWrite, 0, nullptr);
+        }
     }
 }
 
 void VulkanApp::createGraphicsPipeline()
 {
-    auto vertShaderCode = readFile("shaders/vert.spv");
-    auto fragShaderCode = readFile("shaders/frag.spv");
+    // raymarch mode draws one fullscreen triangle whose fragments trace phi
+    auto vertShaderCode = readFile(options.raymarch ? "shaders/raymarch_vert.spv" : "shaders/vert.spv");
+    auto fragShaderCode = readFile(options.raymarch ? "shaders/raymarch_frag.spv" : "shaders/frag.spv");
 
     VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
     VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
@@ -552,9 +847,9 @@ void VulkanApp::createGraphicsPipeline()
 
     VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
+    vertexInputInfo.vertexBindingDescriptionCount = options.raymarch ? 0 : 1;
     vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-    vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+    vertexInputInfo.vertexAttributeDescriptionCount = options.raymarch ? 0 : static_cast<uint32_t>(attributeDescriptions.size());
     vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
 
     VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
@@ -816,22 +1111,116 @@ VkFormat VulkanApp::findSupportedFormat(const std::vector<VkFormat> &candidates,
 
 void VulkanApp::createVertexBuffer()
 {
-    VkDeviceSize maxBufferSize = sizeof(Vertex) * MAX_VERTICES;
+    // The refined band meshes its bricks at twice the resolution, with about four times the triangles
+    size_t maxVertices = options.grid.refineSurface ? 4 * MAX_VERTICES : MAX_VERTICES;
+    VkDeviceSize maxBufferSize = sizeof(Vertex) * maxVertices;
 
     createBuffer(maxBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingVertexBuffer, stagingVertexMemory);
     createBuffer(maxBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
 
     vkMapMemory(device, stagingVertexMemory, 0, maxBufferSize, 0, &cpuVertexBuffer);
+    surfaceMesh = std::make_unique<SurfaceMesh>(Nx - 1, Ny - 1, Nz - 1, (uint32_t)maxVertices);
 }
 
-void VulkanApp::createIndexBuffer()
+// One 3D image holding phi with k along x, j along y and i along z, so the grid's i-major layout uploads as one
+// tightly packed copy. Its size is fixed at Nx * Ny * Nz samples whatever the surface looks like.
+void VulkanApp::createPhiTexture()
 {
-    VkDeviceSize maxBufferSize = sizeof(uint32_t) * MAX_VERTICES * 3;
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, PHI_TEXTURE_FORMAT, &formatProperties);
+    if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT))
+    {
+        throw std::runtime_error("Device cannot filter the phi texture format, build with FIELD_PRECISION=fp16 to raymarch");
+    }
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    if (std::max({Nx, Ny, Nz}) > deviceProperties.limits.maxImageDimension3D)
+    {
+        throw std::runtime_error("Grid is larger than the device's largest 3D image");
+    }
 
-    createBuffer(maxBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingIndexBuffer, stagingIndexMemory);
-    createBuffer(maxBufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_3D;
+    imageInfo.extent.width = Nz;
+    imageInfo.extent.height = Ny;
+    imageInfo.extent.depth = Nx;
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = PHI_TEXTURE_FORMAT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if (vkCreateImage(device, &imageInfo, nullptr, &phiImage) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create phi image!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(device, phiImage, &memRequirements);
 
-    vkMapMemory(device, stagingIndexMemory, 0, maxBufferSize, 0, &cpuIndexBuffer);
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = memRequirements.size;
+    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    if (vkAllocateMemory(device, &allocInfo, nullptr, &phiImageMemory) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to allocate phi image memory!");
+    }
+    vkBindImageMemory(device, phiImage, phiImageMemory, 0);
+
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = phiImage;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_3D;
+    viewInfo.format = PHI_TEXTURE_FORMAT;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    if (vkCreateImageView(device, &viewInfo, nullptr, &phiImageView) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create phi image view!");
+    }
+
+    // trilinear filtering of texel centres reproduces the grid's own trilinear interpolation of phi
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.anisotropyEnable = VK_FALSE;
+    samplerInfo.maxAnisotropy = 1.0f;
+    samplerInfo.compareEnable = VK_FALSE;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = 0.0f;
+    samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
+    samplerInfo.unnormalizedCoordinates = VK_FALSE;
+
+    if (vkCreateSampler(device, &samplerInfo, nullptr, &phiSampler) != VK_SUCCESS)
+    {
+        throw std::runtime_error("failed to create phi sampler!");
+    }
+
+    // one staging buffer per frame in flight, so a frame never overwrites phi another is still copying
+    VkDeviceSize phiSize = (VkDeviceSize)Nx * NyNz * PHI_TEXEL_SIZE;
+    phiStagingBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    phiStagingMemory.resize(MAX_FRAMES_IN_FLIGHT);
+    phiStagingMapped.resize(MAX_FRAMES_IN_FLIGHT);
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+    {
+        createBuffer(phiSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, phiStagingBuffers[i], phiStagingMemory[i]);
+        vkMapMemory(device, phiStagingMemory[i], 0, phiSize, 0, &phiStagingMapped[i]);
+    }
 }
 
 void VulkanApp::createUniformBuffers()
@@ -851,14 +1240,16 @@ void VulkanApp::createUniformBuffers()
 
 void VulkanApp::createDescriptorPool()
 {
-    VkDescriptorPoolSize poolSize{};
-    poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSize.descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    std::array<VkDescriptorPoolSize, 2> poolSizes{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
 
     VkDescriptorPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    poolInfo.poolSizeCount = 1;
-    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.poolSizeCount = options.raymarch ? 2 : 1;
+    poolInfo.pPoolSizes = poolSizes.data();
     poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
 
     if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
@@ -992,9 +1383,14 @@ void VulkanApp::updateUniformBuffer(uint32_t currentImage)
     float time = 0.0f;
     UniformBufferObject ubo{};
     ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f) * 0.1f, glm::vec3(0.0f, 1.0f, 0.0f));
-    ubo.view = glm::lookAt(glm::vec3(0.0f, 0.0f, -20.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f));
+    glm::vec3 windowOffset = grid_ptr->getWindowOffset(); // the camera follows a moving window
+    ubo.view = glm::lookAt(glm::vec3(0.0f, 0.0f, -20.0f) + windowOffset, windowOffset, glm::vec3(0.0f, -1.0f, 0.0f));
     ubo.proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 20.0f);
     ubo.proj[1][1] *= -1;
+    ubo.inverseViewProj = glm::inverse(ubo.proj * ubo.view);
+    ubo.eye = glm::vec4(glm::vec3(0.0f, 0.0f, -20.0f) + windowOffset, 1.0f);
+    ubo.gridOrigin = glm::vec4(globalOffset + windowOffset, INV_CELL_WIDTH);
+    ubo.gridSize = glm::vec4((float)Nx, (float)Ny, (float)Nz, 0.0f);
 
     memcpy(uniformBuffersMapped[currentImage], &ubo, sizeof(ubo));
 }
@@ -1004,21 +1400,32 @@ void VulkanApp::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imag
     VkCommandBufferBeginInfo beginInfo{};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
-    // Copy vertex and index buffers
     if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
     {
         throw std::runtime_error("failed to begin recording command buffer!");
     }
 
-    // --- Copy CPU-written staging buffers to GPU-local buffers ---
-    if (!vertices.empty())
+    // --- Copy the surface bricks re-meshed since the last upload to the GPU-local buffer ---
+    const std::vector<VertexRange> &dirtyRanges = surfaceMesh->dirtyRanges();
+    if (!dirtyRanges.empty())
     {
-        VkDeviceSize vertexBufferSize = sizeof(Vertex) * vertices.size();
-        memcpy(cpuVertexBuffer, vertices.data(), (size_t)vertexBufferSize);
+        const Vertex *meshVertices = surfaceMesh->vertexData();
+        vertexCopies.resize(0);
+        for (const VertexRange &range : dirtyRanges)
+        {
+            VkDeviceSize offset = sizeof(Vertex) * range.first;
+            VkDeviceSize size = sizeof(Vertex) * range.count;
+            memcpy(static_cast<char *>(cpuVertexBuffer) + offset, meshVertices + range.first, (size_t)size);
+            vertexCopies.push_back({offset, offset, size});
+        }
+        surfaceMesh->clearDirty();
 
-        VkBufferCopy vtxCopy{};
-        vtxCopy.size = vertexBufferSize;
-        vkCmdCopyBuffer(commandBuffer, stagingVertexBuffer, vertexBuffer, 1, &vtxCopy);
+        // the previous frame may still be drawing from the ranges about to be overwritten
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0, 0, nullptr, 0, nullptr, 0, nullptr);
+        vkCmdCopyBuffer(commandBuffer, stagingVertexBuffer, vertexBuffer, static_cast<uint32_t>(vertexCopies.size()), vertexCopies.data());
 
         VkBufferMemoryBarrier vtxBarrier{};
         vtxBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
@@ -1036,29 +1443,50 @@ void VulkanApp::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imag
                              0, 0, nullptr, 1, &vtxBarrier, 0, nullptr);
     }
 
-    if (!indices.empty())
+    // --- Raymarch mode: upload all of phi to the 3D image ---
+    if (options.raymarch)
     {
-        VkDeviceSize indexBufferSize = sizeof(uint32_t) * indices.size();
-        memcpy(cpuIndexBuffer, indices.data(), (size_t)indexBufferSize);
-
-        VkBufferCopy idxCopy{};
-        idxCopy.size = indexBufferSize;
-        vkCmdCopyBuffer(commandBuffer, stagingIndexBuffer, indexBuffer, 1, &idxCopy);
+        grid_ptr->copyPhi(phiStagingMapped[currentFrame]);
+
+        // the previous frame may still be sampling the image about to be overwritten
+        VkImageMemoryBarrier toTransfer{};
+        toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        toTransfer.srcAccessMask = 0;
+        toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED; // every texel is rewritten, the old contents can go
+        toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        toTransfer.image = phiImage;
+        toTransfer.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
 
-        VkBufferMemoryBarrier idxBarrier{};
-        idxBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-        idxBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        idxBarrier.dstAccessMask = VK_ACCESS_INDEX_READ_BIT;
-        idxBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        idxBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-        idxBarrier.buffer = indexBuffer;
-        idxBarrier.offset = 0;
-        idxBarrier.size = VK_WHOLE_SIZE;
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             0, 0, nullptr, 0, nullptr, 1, &toTransfer);
+
+        VkBufferImageCopy region{};
+        region.bufferOffset = 0;
+        region.bufferRowLength = 0; // tightly packed
+        region.bufferImageHeight = 0;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = {Nz, Ny, Nx};
+        vkCmdCopyBufferToImage(commandBuffer, phiStagingBuffers[currentFrame], phiImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+        VkImageMemoryBarrier toShader = toTransfer;
+        toShader.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        toShader.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        toShader.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        toShader.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
         vkCmdPipelineBarrier(commandBuffer,
                              VK_PIPELINE_STAGE_TRANSFER_BIT,
-                             VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
-                             0, 0, nullptr, 1, &idxBarrier, 0, nullptr);
+                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                             0, 0, nullptr, 0, nullptr, 1, &toShader);
     }
 
     VkRenderPassBeginInfo renderPassInfo{};
@@ -1076,17 +1504,54 @@ void VulkanApp::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imag
 
     vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
     vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
-
-    VkBuffer vertexBuffers[] = {vertexBuffer};
-    VkDeviceSize offsets[] = {0};
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-
     vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentFrame], 0, nullptr);
 
-    vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+    if (options.raymarch)
+    {
+        vkCmdDraw(commandBuffer, 3, 1, 0, 0); // fullscreen triangle
+    }
+    else
+    {
+        VkBuffer vertexBuffers[] = {vertexBuffer};
+        VkDeviceSize offsets[] = {0};
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+
+        // unused slots hold degenerate triangles, so the whole allocated range is drawn without an index buffer
+        vkCmdDraw(commandBuffer, surfaceMesh->vertexCount(), 1, 0, 0);
+    }
     vkCmdEndRenderPass(commandBuffer);
 
+    if (options.headless)
+    {
+        // the render pass leaves the image in TRANSFER_SRC layout; copy it into this slot's readback buffer
+        VkBufferImageCopy region{};
+        region.bufferOffset = 0;
+        region.bufferRowLength = 0; // tightly packed
+        region.bufferImageHeight = 0;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = {swapChainExtent.width, swapChainExtent.height, 1};
+        vkCmdCopyImageToBuffer(commandBuffer, swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffers[imageIndex], 1, &region);
+
+        VkBufferMemoryBarrier readbackBarrier{};
+        readbackBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        readbackBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        readbackBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        readbackBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        readbackBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        readbackBarrier.buffer = readbackBuffers[imageIndex];
+        readbackBarrier.offset = 0;
+        readbackBarrier.size = VK_WHOLE_SIZE;
+
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_HOST_BIT,
+                             0, 0, nullptr, 1, &readbackBarrier, 0, nullptr);
+    }
+
     if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
     {
         throw std::runtime_error("failed to record command buffer");
@@ -1129,6 +1594,10 @@ std::vector<char> VulkanApp::readFile(const std::string &filename)
 bool VulkanApp::isDeviceSuitable(VkPhysicalDevice device)
 {
     QueueFamilyIndices indices = findQueueFamilies(device);
+    if (options.headless)
+    {
+        return indices.isComplete(); // any device that can draw, including lavapipe
+    }
     bool extensionsSupported = checkDeviceExtensionSupport(device);
 
     bool swapChainAdequate = false;
@@ -1243,6 +1712,11 @@ QueueFamilyIndices VulkanApp::findQueueFamilies(VkPhysicalDevice device)
         if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
         {
             indices.graphicsFamily = i;
+            if (options.headless) // nothing is presented, the graphics queue stands in
+            {
+                indices.presentFamily = i;
+                break;
+            }
         }
 
         VkBool32 presentSupport = false;
@@ -1289,8 +1763,8 @@ void VulkanApp::createLogicalDevice()
     createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
     createInfo.pEnabledFeatures = &deviceFeatures;
 
-    createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-    createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+    createInfo.enabledExtensionCount = options.headless ? 0 : static_cast<uint32_t>(deviceExtensions.size());
+    createInfo.ppEnabledExtensionNames = options.headless ? nullptr : deviceExtensions.data();
 
     if (enableValidationLayers)
     {
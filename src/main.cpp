@@ -1,16 +1,124 @@
 #include "VulkanApp.h"
+#include <cstring>
+#include <iostream>
 
-int main()
+static AppOptions parseOptions(int argc, char **argv)
 {
-    VulkanApp app;
+    AppOptions options;
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if (std::strcmp(argv[i], "--restore") == 0 && hasValue)
+        {
+            options.restorePath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--checkpoint") == 0 && hasValue)
+        {
+            options.checkpointPath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--checkpoint-every") == 0 && hasValue)
+        {
+            options.checkpointInterval = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--capture") == 0 && hasValue)
+        {
+            options.capturePath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--capture-band") == 0 && hasValue)
+        {
+            options.captureBand = std::strtof(argv[++i], nullptr);
+        }
+        else if (std::strcmp(argv[i], "--export-mesh") == 0 && hasValue)
+        {
+            options.meshPrefix = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--headless") == 0)
+        {
+            options.headless = true;
+        }
+        else if (std::strcmp(argv[i], "--frames") == 0 && hasValue)
+        {
+            options.headlessFrames = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (std::strcmp(argv[i], "--output") == 0 && hasValue)
+        {
+            options.framePath = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--raymarch") == 0)
+        {
+            options.raymarch = true;
+        }
+        else if (std::strcmp(argv[i], "--pool") == 0 && hasValue)
+        {
+            options.grid.poolDepth = std::strtof(argv[++i], nullptr);
+        }
+        else if (std::strcmp(argv[i], "--tall-cells") == 0)
+        {
+            options.grid.tallCells = true;
+        }
+        else if (std::strcmp(argv[i], "--coarse-bricks") == 0)
+        {
+            options.grid.coarseBricks = true;
+        }
+        else if (std::strcmp(argv[i], "--refine-surface") == 0)
+        {
+            options.grid.refineSurface = true;
+        }
+        else if (std::strcmp(argv[i], "--moving-window") == 0)
+        {
+            options.grid.movingWindow = true;
+        }
+        else if (std::strcmp(argv[i], "--flip") == 0)
+        {
+            options.grid.particles = TRANSFER_FLIP;
+        }
+        else if (std::strcmp(argv[i], "--apic") == 0)
+        {
+            options.grid.particles = TRANSFER_APIC;
+        }
+        else if (std::strcmp(argv[i], "--chebyshev") == 0)
+        {
+            options.grid.pressureSolver = PRESSURE_CHEBYSHEV;
+        }
+        else if (std::strcmp(argv[i], "--pipeline") == 0)
+        {
+            options.pipeline = true;
+        }
+        else if (std::strcmp(argv[i], "--target-frame") == 0 && hasValue)
+        {
+            options.targetFrameTime = std::strtod(argv[++i], nullptr) / 1000.0; // given in ms
+        }
+        else if (std::strcmp(argv[i], "--solve-budget") == 0 && hasValue)
+        {
+            options.grid.solveBudget = std::strtod(argv[++i], nullptr) / 1000.0; // given in ms
+        }
+        else if (std::strcmp(argv[i], "--threads") == 0 && hasValue)
+        {
+            options.grid.threads = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+        }
+        else
+        {
+            throw std::runtime_error(std::string("Unknown or incomplete option: ") + argv[i]);
+        }
+    }
+    if (options.checkpointInterval > 0 && options.checkpointPath.empty())
+    {
+        options.checkpointPath = "checkpoint.vfc";
+    }
+    return options;
+}
 
+int main(int argc, char **argv)
+{
     try
     {
+        VulkanApp app(parseOptions(argc, argv));
         app.run();
     }
     catch (const std::exception &e)
     {
+        std::cerr << e.what() << std::endl;
         return EXIT_FAILURE;
     }
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}